@@ -0,0 +1,527 @@
+/** 
+ * -----------------------------------------------------------------------------
+ * Clovece nezlob se (Server) - simple board game
+ * 
+ * Server for board game Clovece nezlob se using UDP datagrams for communication
+ * with clients and SEND-AND-WAIT method to ensure that all packets arrive
+ * and that they arrive in correct order.
+ * 
+ * Semestral work for "Uvod do pocitacovich siti" KIV/UPS at
+ * University of West Bohemia.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * File: io_bench.c
+ * Description: Loopback load generator comparing I/O backends of the server.
+ *              Starts server once for each backend (recvfrom, recvmmsg,
+ *              io_uring), connects clients which keep a window of KEEPALIVE
+ *              packets in flight and reports how many packets per second
+ *              the server acknowledged.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * @author: Martin Kucera, 2014
+ * @version: 1.02
+ * 
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <linux/io_uring.h>
+
+#include "global.h"
+
+/* Maximum number of simulated clients */
+#define BENCH_MAX_CLIENTS 256
+/* Maximum number of KEEPALIVE packets client keeps in flight */
+#define BENCH_MAX_WINDOW 8
+/* Client resends its window if nothing was ACKd for this long (usec) */
+#define BENCH_RESEND_USEC 200000
+/* Time before measuring starts (usec) */
+#define BENCH_WARMUP_USEC 200000
+/* Time allowed for clients to connect (usec) */
+#define BENCH_CONNECT_USEC 3000000
+
+/* Server is driven with io_uring */
+#define MODE_URING 2
+
+typedef struct {
+    /* Name shown in results */
+    const char *name;
+    /* Argument of server's -i option */
+    const char *backend;
+    /* Receive batch size set through server's console */
+    int recv_batch;
+} bench_mode_t;
+
+typedef struct {
+    /* Connected socket */
+    int sockfd;
+    /* Client got RECONNECT_CODE (it is connected) */
+    int connected;
+    /* Highest SEQ_ID ACKd by server */
+    int acked;
+    /* Next SEQ_ID to send */
+    int next;
+    /* Last time ACK moved forward */
+    struct timeval progress;
+} bench_client_t;
+
+/* Backends compared by benchmark */
+static const bench_mode_t modes[] = {
+    { "recvfrom", "syscall", 1 },
+    { "recvmmsg", "syscall", DEFAULT_RECV_BATCH_SIZE },
+    { "io_uring", "uring", DEFAULT_RECV_BATCH_SIZE }
+};
+
+static bench_client_t clients[BENCH_MAX_CLIENTS];
+
+static int num_clients = 16;
+static int window = BENCH_MAX_WINDOW;
+static int duration_ms = 2000;
+static int shards = 1;
+
+/**
+ * long usec_since(struct timeval *tv)
+ * 
+ * Returns number of microseconds elapsed since tv.
+ */
+static long usec_since(struct timeval *tv) {
+    struct timeval cur_tv;
+    
+    gettimeofday(&cur_tv, NULL);
+    
+    return (cur_tv.tv_sec - tv->tv_sec) * 1000000L + (cur_tv.tv_usec - tv->tv_usec);
+}
+
+/**
+ * int uring_supported()
+ * 
+ * Checks if kernel supports io_uring by creating a small ring.
+ */
+static int uring_supported() {
+    struct io_uring_params params;
+    int fd;
+    
+    memset(&params, 0, sizeof(params));
+    
+    fd = (int) syscall(__NR_io_uring_setup, 2, &params);
+    
+    if(fd < 0) {
+        return 0;
+    }
+    
+    close(fd);
+    
+    return 1;
+}
+
+/**
+ * int free_port()
+ * 
+ * Returns loopback UDP port which isn't used at the moment.
+ */
+static int free_port() {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    
+    bind(fd, (struct sockaddr *) &addr, sizeof(addr));
+    getsockname(fd, (struct sockaddr *) &addr, &len);
+    close(fd);
+    
+    return ntohs(addr.sin_port);
+}
+
+/**
+ * pid_t start_server(const char *bin, const bench_mode_t *mode, int port, int *console)
+ * 
+ * Starts server with given backend, its standard input (console) is
+ * returned in console.
+ */
+static pid_t start_server(const char *bin, const bench_mode_t *mode, int port, int *console) {
+    char port_str[16];
+    char shards_str[16];
+    char cmd[64];
+    int fds[2];
+    int null_fd;
+    pid_t pid;
+    
+    snprintf(port_str, sizeof(port_str), "%d", port);
+    snprintf(shards_str, sizeof(shards_str), "%d", shards);
+    
+    if(pipe(fds) < 0 || (pid = fork()) < 0) {
+        perror("Error starting server");
+        exit(EXIT_FAILURE);
+    }
+    
+    if(pid == 0) {
+        null_fd = open("/dev/null", O_WRONLY);
+        
+        dup2(fds[0], STDIN_FILENO);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        close(fds[1]);
+        
+        execl(bin, bin, "-i", mode->backend, "-s", shards_str,
+                "127.0.0.1", port_str, "/dev/null", "0", "0", (char *) NULL);
+        
+        _exit(EXIT_FAILURE);
+    }
+    
+    close(fds[0]);
+    *console = fds[1];
+    
+    snprintf(cmd, sizeof(cmd), "set_recv_batch %d\n", mode->recv_batch);
+    
+    if(write(*console, cmd, strlen(cmd)) < 0) {
+        perror("Error writing to server console");
+    }
+    
+    return pid;
+}
+
+/**
+ * void stop_server(pid_t pid, int console)
+ * 
+ * Shuts server down through its console and waits for it.
+ */
+static void stop_server(pid_t pid, int console) {
+    static const char cmd[] = "exit\n";
+    
+    if(write(console, cmd, sizeof(cmd) - 1) < 0) {
+        kill(pid, SIGTERM);
+    }
+    
+    close(console);
+    waitpid(pid, NULL, 0);
+}
+
+/**
+ * void client_send(bench_client_t *client, const char *msg, int seq_id, int arg)
+ * 
+ * Sends one datagram APP_TOKEN;SEQ_ID;MESSAGE[;ARG] to server, argument
+ * is left out if it is negative.
+ */
+static void client_send(bench_client_t *client, const char *msg, int seq_id, int arg) {
+    char buff[64];
+    int len;
+    
+    len = snprintf(buff, sizeof(buff), STRINGIFY(APP_TOKEN) ";%d;%s", seq_id, msg);
+    
+    if(arg >= 0) {
+        len += snprintf(buff + len, sizeof(buff) - len, ";%d", arg);
+    }
+    
+    send(client->sockfd, buff, len, 0);
+}
+
+/**
+ * void client_fill_window(bench_client_t *client)
+ * 
+ * Sends KEEPALIVE packets until client has window packets in flight.
+ */
+static void client_fill_window(bench_client_t *client) {
+    while(client->next - client->acked <= window) {
+        client_send(client, "KEEPALIVE", client->next++, -1);
+    }
+}
+
+/**
+ * void client_recv(bench_client_t *client)
+ * 
+ * Reads all datagrams waiting for client. ACKs move client's window
+ * forward, data packets of server are ACKd.
+ */
+static void client_recv(bench_client_t *client) {
+    char buff[MAX_DGRAM_SIZE + 1];
+    char *seq;
+    char *msg;
+    int len;
+    int ack_id;
+    
+    while((len = recv(client->sockfd, buff, MAX_DGRAM_SIZE, MSG_DONTWAIT)) > 0) {
+        buff[len] = 0;
+        
+        /* APP_TOKEN;SEQ_ID[:ACK_ID];MESSAGE */
+        if((seq = strchr(buff, ';')) == NULL || (msg = strchr(seq + 1, ';')) == NULL) {
+            continue;
+        }
+        
+        msg++;
+        ack_id = 0;
+        
+        if(strncmp(msg, "ACK;", 4) == 0) {
+            ack_id = (int) strtol(msg + 4, NULL, 10);
+        }
+        else {
+            /* Piggybacked ACK */
+            if(strchr(seq, ':') != NULL && strchr(seq, ':') < msg) {
+                ack_id = (int) strtol(strchr(seq, ':') + 1, NULL, 10);
+            }
+            
+            client_send(client, "ACK", client->next, (int) strtol(seq + 1, NULL, 10));
+            
+            if(strncmp(msg, "RECONNECT_CODE", 14) == 0) {
+                client->connected = 1;
+            }
+        }
+        
+        if(ack_id > client->acked) {
+            client->acked = ack_id;
+            gettimeofday(&client->progress, NULL);
+        }
+    }
+}
+
+/**
+ * int connect_clients(int port, int epfd)
+ * 
+ * Opens sockets of all clients and connects them to server. Returns 0 if
+ * server didn't accept all clients in time.
+ */
+static int connect_clients(int port, int epfd) {
+    struct sockaddr_in addr;
+    struct epoll_event ev;
+    struct timeval start;
+    int connected;
+    int i;
+    
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    
+    for(i = 0; i < num_clients; i++) {
+        memset(&clients[i], 0, sizeof(clients[i]));
+        clients[i].next = 1;
+        
+        clients[i].sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+        connect(clients[i].sockfd, (struct sockaddr *) &addr, sizeof(addr));
+        
+        ev.events = EPOLLIN;
+        ev.data.ptr = &clients[i];
+        epoll_ctl(epfd, EPOLL_CTL_ADD, clients[i].sockfd, &ev);
+    }
+    
+    gettimeofday(&start, NULL);
+    
+    /* Server may not be listening yet, CONNECT is repeated */
+    do {
+        connected = 0;
+        
+        for(i = 0; i < num_clients; i++) {
+            if(!clients[i].connected) {
+                client_send(&clients[i], "CONNECT", 1, -1);
+            }
+        }
+        
+        usleep(20000);
+        
+        for(i = 0; i < num_clients; i++) {
+            client_recv(&clients[i]);
+            
+            connected += clients[i].connected;
+        }
+    } while(connected < num_clients && usec_since(&start) < BENCH_CONNECT_USEC);
+    
+    for(i = 0; i < num_clients; i++) {
+        clients[i].acked = 1;
+        clients[i].next = 2;
+    }
+    
+    return (connected == num_clients);
+}
+
+/**
+ * double run_load(int epfd)
+ * 
+ * Keeps windows of all clients full for warmup and measured duration.
+ * Returns number of packets ACKd by server per second.
+ */
+static double run_load(int epfd) {
+    struct epoll_event events[BENCH_MAX_CLIENTS];
+    struct timeval start;
+    bench_client_t *client;
+    long base = 0;
+    long total;
+    long elapsed;
+    int measuring = 0;
+    int n;
+    int i;
+    
+    gettimeofday(&start, NULL);
+    
+    for(i = 0; i < num_clients; i++) {
+        clients[i].progress = start;
+        client_fill_window(&clients[i]);
+    }
+    
+    for(;;) {
+        n = epoll_wait(epfd, events, BENCH_MAX_CLIENTS, 10);
+        
+        for(i = 0; i < n; i++) {
+            client = events[i].data.ptr;
+            
+            client_recv(client);
+            client_fill_window(client);
+        }
+        
+        /* Lost datagrams, send window again */
+        for(i = 0; i < num_clients; i++) {
+            if(usec_since(&clients[i].progress) > BENCH_RESEND_USEC) {
+                clients[i].next = clients[i].acked + 1;
+                gettimeofday(&clients[i].progress, NULL);
+                
+                client_fill_window(&clients[i]);
+            }
+        }
+        
+        elapsed = usec_since(&start);
+        
+        if(!measuring && elapsed >= BENCH_WARMUP_USEC) {
+            for(i = 0; i < num_clients; i++) {
+                base += clients[i].acked;
+            }
+            
+            gettimeofday(&start, NULL);
+            measuring = 1;
+        }
+        else if(measuring && elapsed >= duration_ms * 1000L) {
+            break;
+        }
+    }
+    
+    total = -base;
+    
+    for(i = 0; i < num_clients; i++) {
+        total += clients[i].acked;
+    }
+    
+    return total * 1000000.0 / elapsed;
+}
+
+/**
+ * void help()
+ * 
+ * Prints brief help, basic program usage.
+ */
+void help() {
+    printf("NAME:\n");
+    printf("\t\t io_bench - Compares I/O backends of cns_server on loopback\n");
+    
+    printf("--------------------------------------------------\n");
+    printf("USAGE:\n");
+    printf("\t\t io_bench [-c clients] [-w window] [-d msec] [-s shards] [server]\n");
+    
+    printf("--------------------------------------------------\n");
+    printf("OPTIONS:\n");
+    printf("\t\t -c <clients> - Number of clients (default 16, max %d).\n", BENCH_MAX_CLIENTS);
+    printf("\t\t -w <window> - Packets each client keeps in flight (default and max %d).\n", BENCH_MAX_WINDOW);
+    printf("\t\t -d <msec> - Measured time per backend (default 2000).\n");
+    printf("\t\t -s <shards> - Number of server's shards (default 1).\n");
+    printf("\t\t [server] - Server binary (default ./cns_server).\n");
+    
+    printf("\n\n");
+}
+
+/**
+ * int main(int argc, char **argv)
+ * 
+ * Runs load against server with every backend and prints the results.
+ */
+int main(int argc, char **argv) {
+    const char *bin = "./cns_server";
+    double rate;
+    unsigned int m;
+    int console;
+    int epfd;
+    int port;
+    int opt;
+    int i;
+    pid_t pid;
+    
+    while((opt = getopt(argc, argv, "c:w:d:s:")) != -1) {
+        switch(opt) {
+            case 'c':
+                num_clients = atoi(optarg);
+                break;
+            
+            case 'w':
+                window = atoi(optarg);
+                break;
+            
+            case 'd':
+                duration_ms = atoi(optarg);
+                break;
+            
+            case 's':
+                shards = atoi(optarg);
+                break;
+            
+            default:
+                help();
+                return EXIT_FAILURE;
+        }
+    }
+    
+    if(num_clients < 1 || num_clients > BENCH_MAX_CLIENTS || window < 1 ||
+            window > BENCH_MAX_WINDOW || duration_ms < 1 || shards < 1 || shards > MAX_SHARDS) {
+        help();
+        return EXIT_FAILURE;
+    }
+    
+    if(optind < argc) {
+        bin = argv[optind];
+    }
+    
+    printf("%d clients, %d packets in flight each, %d shards, %d ms per backend\n",
+            num_clients, window, shards, duration_ms);
+    
+    for(m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        if(m == MODE_URING && !uring_supported()) {
+            printf("%-10s io_uring is not supported by kernel, skipped\n", modes[m].name);
+            continue;
+        }
+        
+        port = free_port();
+        pid = start_server(bin, &modes[m], port, &console);
+        epfd = epoll_create1(0);
+        
+        if(connect_clients(port, epfd)) {
+            rate = run_load(epfd);
+            
+            printf("%-10s %10.0f packets/s\n", modes[m].name, rate);
+        }
+        else {
+            printf("%-10s server didn't accept all clients\n", modes[m].name);
+        }
+        
+        for(i = 0; i < num_clients; i++) {
+            close(clients[i].sockfd);
+        }
+        
+        close(epfd);
+        stop_server(pid, console);
+    }
+    
+    return (EXIT_SUCCESS);
+}
@@ -0,0 +1,326 @@
+/** 
+ * -----------------------------------------------------------------------------
+ * Clovece nezlob se (Server) - simple board game
+ * 
+ * Server for board game Clovece nezlob se using UDP datagrams for communication
+ * with clients and SEND-AND-WAIT method to ensure that all packets arrive
+ * and that they arrive in correct order.
+ * 
+ * Semestral work for "Uvod do pocitacovich siti" KIV/UPS at
+ * University of West Bohemia.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * File: msg_bench.c
+ * Description: Measures cost of one outgoing text message built by message
+ *              builder (msg_begin .. msg_send and packet header) against
+ *              the way server built messages before: sprintf into malloc'd
+ *              buffer, copy into malloc'd packet and sprintf'd payload.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * @author: Martin Kucera, 2014
+ * @version: 1.02
+ * 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+
+#include "global.h"
+#include "client.h"
+#include "com.h"
+#include "proto.h"
+#include "shard.h"
+#include "pool.h"
+#include "ring.h"
+
+/* Number of runs of each measurement, the fastest one is reported */
+#define BENCH_RUNS 5
+
+/* Number of iterations of each measurement */
+static long iterations = 1000000;
+
+/* Shard owning packet pool of benchmark */
+static shard_t bench_shard;
+/* Client messages are built for */
+static client_t bench_client;
+/* Client's address */
+static struct sockaddr_in bench_addr;
+
+/* Figure positions sent in GAME_STATE */
+static const unsigned int figures[16] = {
+    56, 57, 58, 59, 60, 61, 62, 63, 64, 65, 66, 67, 68, 69, 70, 71
+};
+
+/* Keeps compiler from leaving out measured calls */
+static volatile int sink;
+
+/**
+ * long usec_since(struct timeval *tv)
+ * 
+ * Returns number of microseconds elapsed since tv.
+ */
+static long usec_since(struct timeval *tv) {
+    struct timeval cur_tv;
+    
+    gettimeofday(&cur_tv, NULL);
+    
+    return (cur_tv.tv_sec - tv->tv_sec) * 1000000L + (cur_tv.tv_usec - tv->tv_usec);
+}
+
+/**
+ * int old_enqueue(char *msg, int seq_id)
+ * 
+ * Copies message into malloc'd packet and builds its payload by sprintf,
+ * as enqueue_dgram and build_packet_payload did. Returns payload length.
+ */
+static int old_enqueue(char *msg, int seq_id) {
+    packet_t *packet;
+    char seq_id_buff[11];
+    int len;
+    
+    packet = (packet_t *) malloc(sizeof(packet_t));
+    
+    /* Make copy of message */
+    packet->msg = (char *) malloc(strlen(msg) + 1);
+    strcpy(packet->msg, msg);
+    
+    sprintf(seq_id_buff, "%u", seq_id);
+    len = strlen(STRINGIFY(APP_TOKEN)) + strlen(seq_id_buff) + strlen(packet->msg) + 4;
+    
+    packet->payload = (char *) malloc(len);
+    
+    len = sprintf(packet->payload, "%s;%u;%s", STRINGIFY(APP_TOKEN), seq_id, packet->msg);
+    
+    free(packet->payload);
+    free(packet->msg);
+    free(packet);
+    
+    return len;
+}
+
+/**
+ * int old_game_started()
+ * 
+ * Builds GAME_STARTED the old way, returns payload length.
+ */
+static int old_game_started() {
+    char *buff;
+    int len;
+    
+    buff = (char *) malloc(16 + 11);
+    sprintf(buff, "GAME_STARTED;%d;%d", 0, 45);
+    
+    len = old_enqueue(buff, bench_client.pkt_send_seq_id);
+    
+    free(buff);
+    
+    return len;
+}
+
+/**
+ * int old_game_state()
+ * 
+ * Builds GAME_STATE the old way, returns payload length.
+ */
+static int old_game_state() {
+    const unsigned int *f = figures;
+    char *buff;
+    int len;
+    
+    buff = (char *) malloc(105 + GAME_CODE_LEN + 11 + 12);
+    
+    sprintf(buff,
+            "GAME_STATE;%s;%u;%u;%u;%u;%u;%u;%u;%u;%u;%u;%u;%u;%u;%u;%u;%u;%u;%u;%u;%u;%u;%u;%u;%d;%d;%d",
+            "AYVFU", 1, 1, 1, 0, 0,
+            f[0], f[1], f[2], f[3], f[4], f[5], f[6], f[7],
+            f[8], f[9], f[10], f[11], f[12], f[13], f[14], f[15],
+            0, 1, 42, -1, 12
+            );
+    
+    len = old_enqueue(buff, bench_client.pkt_send_seq_id);
+    
+    free(buff);
+    
+    return len;
+}
+
+/**
+ * int finish_packet()
+ * 
+ * Takes packet of just built message from client's queue, writes its
+ * header like send_packet does and returns it to pool. Returns payload
+ * length.
+ */
+static int finish_packet() {
+    packet_t *pkt = ring_pop(&bench_client.dgram_queue);
+    int len;
+    
+    pkt->seq_id = bench_client.pkt_send_seq_id;
+    build_packet_payload(pkt, 0);
+    
+    len = (pkt->msg - pkt->payload) + pkt->len;
+    
+    free_packet(pkt);
+    
+    return len;
+}
+
+/**
+ * int builder_game_started()
+ * 
+ * Builds GAME_STARTED by message builder, returns payload length.
+ */
+static int builder_game_started() {
+    msg_t msg;
+    
+    msg_begin(&msg, &bench_client, MSG_GAME_STARTED, 1);
+    msg_int(&msg, 0);
+    msg_uint(&msg, 45);
+    msg_send(&msg);
+    
+    return finish_packet();
+}
+
+/**
+ * int builder_game_state()
+ * 
+ * Builds GAME_STATE by message builder, returns payload length.
+ */
+static int builder_game_state() {
+    msg_t msg;
+    int i;
+    
+    msg_begin(&msg, &bench_client, MSG_GAME_STATE, 1);
+    msg_str(&msg, "AYVFU");
+    msg_uint(&msg, 1);
+    
+    for(i = 0; i < 4; i++) {
+        msg_uint(&msg, i < 2);
+    }
+    
+    for(i = 0; i < 16; i++) {
+        msg_uint(&msg, figures[i]);
+    }
+    
+    msg_uint(&msg, 0);
+    msg_uint(&msg, 1);
+    msg_uint(&msg, 42);
+    msg_int(&msg, -1);
+    msg_int(&msg, 12);
+    msg_send(&msg);
+    
+    return finish_packet();
+}
+
+/**
+ * double bench(int (*build)(), int *len)
+ * 
+ * Builds message over and over, returns nanoseconds per message (of the
+ * fastest run). Payload length is stored to len.
+ */
+static double bench(int (*build)(), int *len) {
+    struct timeval start;
+    double best = 0;
+    double ns;
+    long i;
+    int run;
+    
+    *len = build();
+    
+    for(run = 0; run < BENCH_RUNS; run++) {
+        gettimeofday(&start, NULL);
+        
+        for(i = 0; i < iterations; i++) {
+            sink += build();
+        }
+        
+        ns = usec_since(&start) * 1000.0 / iterations;
+        
+        if(!run || ns < best) {
+            best = ns;
+        }
+    }
+    
+    return best;
+}
+
+/**
+ * void help()
+ * 
+ * Prints brief help, basic program usage.
+ */
+void help() {
+    printf("NAME:\n");
+    printf("\t\t msg_bench - Compares message builder with the old sprintf path\n");
+    
+    printf("--------------------------------------------------\n");
+    printf("USAGE:\n");
+    printf("\t\t msg_bench [-n iterations]\n");
+    
+    printf("--------------------------------------------------\n");
+    printf("OPTIONS:\n");
+    printf("\t\t -n <iterations> - Iterations of each measurement (default 1000000).\n");
+    
+    printf("\n\n");
+}
+
+/**
+ * int main(int argc, char **argv)
+ * 
+ * Runs all measurements and prints the results.
+ */
+int main(int argc, char **argv) {
+    double old_ns, builder_ns;
+    int old_len, builder_len;
+    int opt;
+    
+    while((opt = getopt(argc, argv, "n:")) != -1) {
+        switch(opt) {
+            case 'n':
+                iterations = atol(optarg);
+                break;
+            
+            default:
+                help();
+                return EXIT_FAILURE;
+        }
+    }
+    
+    if(iterations < 1) {
+        help();
+        return EXIT_FAILURE;
+    }
+    
+    /* Messages are built in packets of this thread's shard, coalescing
+     * client leaves them in queue, so nothing is sent
+     */
+    cur_shard = &bench_shard;
+    
+    bench_client.state = 1;
+    bench_client.addr = &bench_addr;
+    bench_client.pkt_send_seq_id = 12345;
+    bench_client.coalesce = 1;
+    ring_init(&bench_client.dgram_queue);
+    
+    printf("%ld iterations, fastest of %d runs\n", iterations, BENCH_RUNS);
+    
+    old_ns = bench(old_game_started, &old_len);
+    builder_ns = bench(builder_game_started, &builder_len);
+    
+    printf("GAME_STARTED %3d B   old %7.1f ns   builder %3d B %7.1f ns\n",
+            old_len, old_ns, builder_len, builder_ns);
+    
+    old_ns = bench(old_game_state, &old_len);
+    builder_ns = bench(builder_game_state, &builder_len);
+    
+    printf("GAME_STATE   %3d B   old %7.1f ns   builder %3d B %7.1f ns\n",
+            old_len, old_ns, builder_len, builder_ns);
+    
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,279 @@
+/** 
+ * -----------------------------------------------------------------------------
+ * Clovece nezlob se (Server) - simple board game
+ * 
+ * Server for board game Clovece nezlob se using UDP datagrams for communication
+ * with clients and SEND-AND-WAIT method to ensure that all packets arrive
+ * and that they arrive in correct order.
+ * 
+ * Semestral work for "Uvod do pocitacovich siti" KIV/UPS at
+ * University of West Bohemia.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * File: proto_bench.c
+ * Description: Measures cost of one packet in text protocol and binary
+ *              protocol (v2). Parses client's FIGURE_MOVE and builds
+ *              server's GAME_STATE the way server does (message builder
+ *              and packet header), binary GAME_STATE also by translating
+ *              text one, as server did before building binary directly.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * @author: Martin Kucera, 2014
+ * @version: 1.02
+ * 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+
+#include "global.h"
+#include "client.h"
+#include "com.h"
+#include "proto.h"
+#include "shard.h"
+#include "pool.h"
+#include "ring.h"
+
+/* Number of runs of each measurement, the fastest one is reported */
+#define BENCH_RUNS 5
+
+/* GAME_STATE is built by message builder */
+#define BUILD_BUILDER 0
+/* GAME_STATE is built as text and translated to binary protocol */
+#define BUILD_TRANSLATE 1
+
+/* Number of iterations of each measurement */
+static long iterations = 1000000;
+
+/* Shard owning packet pool of benchmark */
+static shard_t bench_shard;
+/* Client messages are built for */
+static client_t bench_client;
+/* Client's address */
+static struct sockaddr_in bench_addr;
+
+/* Keeps compiler from leaving out measured calls */
+static volatile int sink;
+
+/**
+ * long usec_since(struct timeval *tv)
+ * 
+ * Returns number of microseconds elapsed since tv.
+ */
+static long usec_since(struct timeval *tv) {
+    struct timeval cur_tv;
+    
+    gettimeofday(&cur_tv, NULL);
+    
+    return (cur_tv.tv_sec - tv->tv_sec) * 1000000L + (cur_tv.tv_usec - tv->tv_usec);
+}
+
+/**
+ * double bench_parse(char *dgram, int len)
+ * 
+ * Parses datagram over and over, returns nanoseconds per datagram
+ * (of the fastest run).
+ */
+static double bench_parse(char *dgram, int len) {
+    struct timeval start;
+    dgram_cmd_t cmd;
+    double best = 0;
+    double ns;
+    long i;
+    int run;
+    
+    for(run = 0; run < BENCH_RUNS; run++) {
+        gettimeofday(&start, NULL);
+        
+        for(i = 0; i < iterations; i++) {
+            sink += parse_dgram(dgram, len, &cmd);
+        }
+        
+        ns = usec_since(&start) * 1000.0 / iterations;
+        
+        if(!run || ns < best) {
+            best = ns;
+        }
+    }
+    
+    return best;
+}
+
+/**
+ * int build_game_state(int mode, char *frame)
+ * 
+ * Builds GAME_STATE for benchmark client like send_game_state does and
+ * writes header of its packet. Packet is translated to binary protocol
+ * in BUILD_TRANSLATE mode. Returns length of datagram on the wire.
+ */
+static int build_game_state(int mode, char *frame) {
+    msg_t msg;
+    packet_t *pkt;
+    int len;
+    int i;
+    
+    msg_begin(&msg, &bench_client, MSG_GAME_STATE, 1);
+    msg_str(&msg, "AYVFU");
+    msg_uint(&msg, 1);
+    
+    for(i = 0; i < 4; i++) {
+        msg_uint(&msg, i < 2);
+    }
+    
+    for(i = 0; i < 16; i++) {
+        msg_uint(&msg, 56 + i);
+    }
+    
+    msg_uint(&msg, 0);
+    msg_uint(&msg, 1);
+    msg_uint(&msg, 42);
+    msg_int(&msg, -1);
+    msg_int(&msg, 12);
+    msg_send(&msg);
+    
+    pkt = ring_pop(&bench_client.dgram_queue);
+    pkt->seq_id = bench_client.pkt_send_seq_id;
+    build_packet_payload(pkt, 0);
+    
+    len = (pkt->msg - pkt->payload) + pkt->len;
+    
+    if(mode == BUILD_TRANSLATE) {
+        len = encode_dgram(pkt->payload, len, frame, MAX_DGRAM_SIZE);
+    }
+    
+    free_packet(pkt);
+    
+    return len;
+}
+
+/**
+ * double bench_build(int binary, int mode, int *len)
+ * 
+ * Builds GAME_STATE over and over for client using given protocol, returns
+ * nanoseconds per packet (of the fastest run). Length of packet is stored
+ * to len.
+ */
+static double bench_build(int binary, int mode, int *len) {
+    char frame[MAX_DGRAM_SIZE];
+    struct timeval start;
+    double best = 0;
+    double ns;
+    long i;
+    int run;
+    
+    bench_client.binary = binary;
+    *len = build_game_state(mode, frame);
+    
+    for(run = 0; run < BENCH_RUNS; run++) {
+        gettimeofday(&start, NULL);
+        
+        for(i = 0; i < iterations; i++) {
+            sink += build_game_state(mode, frame);
+        }
+        
+        ns = usec_since(&start) * 1000.0 / iterations;
+        
+        if(!run || ns < best) {
+            best = ns;
+        }
+    }
+    
+    return best;
+}
+
+/**
+ * void help()
+ * 
+ * Prints brief help, basic program usage.
+ */
+void help() {
+    printf("NAME:\n");
+    printf("\t\t proto_bench - Compares per packet cost of text and binary protocol\n");
+    
+    printf("--------------------------------------------------\n");
+    printf("USAGE:\n");
+    printf("\t\t proto_bench [-n iterations]\n");
+    
+    printf("--------------------------------------------------\n");
+    printf("OPTIONS:\n");
+    printf("\t\t -n <iterations> - Iterations of each measurement (default 1000000).\n");
+    
+    printf("\n\n");
+}
+
+/**
+ * int main(int argc, char **argv)
+ * 
+ * Runs all measurements and prints the results.
+ */
+int main(int argc, char **argv) {
+    char text[] = STRINGIFY(APP_TOKEN) ";12345;FIGURE_MOVE;13";
+    char binary[16];
+    double text_ns, binary_ns, translate_ns;
+    int text_len, binary_len, translate_len;
+    int opt;
+    
+    while((opt = getopt(argc, argv, "n:")) != -1) {
+        switch(opt) {
+            case 'n':
+                iterations = atol(optarg);
+                break;
+            
+            default:
+                help();
+                return EXIT_FAILURE;
+        }
+    }
+    
+    if(iterations < 1) {
+        help();
+        return EXIT_FAILURE;
+    }
+    
+    init_proto();
+    
+    /* Messages are built in packets of this thread's shard, coalescing
+     * client leaves them in queue, so nothing is sent
+     */
+    cur_shard = &bench_shard;
+    
+    bench_client.state = 1;
+    bench_client.addr = &bench_addr;
+    bench_client.pkt_send_seq_id = 12345;
+    bench_client.coalesce = 1;
+    ring_init(&bench_client.dgram_queue);
+    
+    /* Binary FIGURE_MOVE with the same SEQ_ID */
+    memcpy(binary, PROTO_MAGIC, PROTO_MAGIC_LEN);
+    binary[4] = (char) (0x80 | (12345 & 0x7F));
+    binary[5] = (char) (12345 >> 7);
+    binary[6] = 0;
+    binary[7] = CMD_FIGURE_MOVE;
+    binary[8] = 13;
+    binary[9] = 0;
+    
+    printf("%ld iterations, fastest of %d runs\n", iterations, BENCH_RUNS);
+    
+    text_ns = bench_parse(text, sizeof(text) - 1);
+    binary_ns = bench_parse(binary, 9);
+    
+    printf("parse FIGURE_MOVE   text %3d B: %7.1f ns   binary %3d B: %7.1f ns\n",
+            (int) sizeof(text) - 1, text_ns, 9, binary_ns);
+    
+    text_ns = bench_build(0, BUILD_BUILDER, &text_len);
+    binary_ns = bench_build(1, BUILD_BUILDER, &binary_len);
+    translate_ns = bench_build(0, BUILD_TRANSLATE, &translate_len);
+    
+    printf("build GAME_STATE    text %3d B: %7.1f ns   binary %3d B: %7.1f ns\n",
+            text_len, text_ns, binary_len, binary_ns);
+    printf("                    binary translated from text %3d B: %7.1f ns\n",
+            translate_len, translate_ns);
+    
+    return EXIT_SUCCESS;
+}
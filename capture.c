@@ -0,0 +1,457 @@
+/** 
+ * -----------------------------------------------------------------------------
+ * Clovece nezlob se (Server) - simple board game
+ * 
+ * Server for board game Clovece nezlob se using UDP datagrams for communication
+ * with clients and SEND-AND-WAIT method to ensure that all packets arrive
+ * and that they arrive in correct order. 
+ * 
+ * Semestral work for "Uvod do pocitacovich siti" KIV/UPS at
+ * University of West Bohemia.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * File: capture.c
+ * Description: Capture of received and sent datagrams to pcap file, written
+ *              by background thread.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * @author: Martin Kucera, 2014
+ * @version: 1.02
+ * 
+ */
+
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <arpa/inet.h>
+
+#include "global.h"
+#include "event.h"
+#include "logger.h"
+#include "capture.h"
+
+/* pcap file format, datagrams are stored as raw IPv4 packets */
+#define PCAP_MAGIC 0xa1b2c3d4
+#define PCAP_VERSION_MAJOR 2
+#define PCAP_VERSION_MINOR 4
+#define PCAP_LINKTYPE_RAW 101
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t network;
+} pcap_header_t;
+
+typedef struct {
+    uint32_t ts_sec;
+    uint32_t ts_usec;
+    uint32_t incl_len;
+    uint32_t orig_len;
+} pcap_record_t;
+
+typedef struct {
+    /* Ring position record is ready for (see log_record_t) */
+    unsigned int seq;
+    /* CAPTURE_IN or CAPTURE_OUT */
+    int dir;
+    /* Time when datagram was received or sent */
+    struct timeval timestamp;
+    /* Client's address */
+    struct sockaddr_in addr;
+    /* Full length of datagram */
+    int len;
+    /* Captured part of datagram */
+    char data[CAPTURE_SNAPLEN];
+} capture_record_t;
+
+/* Datagrams are being captured */
+int capture_active = 0;
+/* Number of captured datagrams */
+unsigned int captured_dgrams = 0;
+/* Number of datagrams not captured because capture ring was full */
+unsigned int capture_dropped = 0;
+
+/* Capture file */
+static FILE *capture_file = NULL;
+/* Counters when current capture started */
+static unsigned int captured_at_start = 0;
+static unsigned int dropped_at_start = 0;
+/* Server's address, the other end of captured datagrams */
+static struct sockaddr_in capture_local;
+
+/* Only every n-th datagram of each thread is captured */
+static unsigned int capture_sample = 1;
+static __thread unsigned int capture_counter = 0;
+/* Only datagrams of one client are captured if lowest bit is set, address
+ * is in upper 32 bits, port (0 for any) in bits 16 to 31
+ */
+static uint64_t capture_filter = 0;
+
+/* Records waiting for writer thread (multiple producers, one consumer) */
+static capture_record_t capture_ring[CAPTURE_RING_SIZE];
+/* Ring and capture_event were initialized */
+static int capture_ring_ready = 0;
+/* Next position taken by producer */
+static unsigned int capture_ring_tail = 0;
+/* Next position consumed by writer thread */
+static unsigned int capture_ring_head = 0;
+
+/* Writer thread */
+static pthread_t capture_thread;
+/* Writer thread should finish */
+static int capture_thread_stop = 0;
+/* Wakes up writer thread */
+static int capture_event = -1;
+/* ID field of synthesized IP headers */
+static unsigned short capture_ip_id = 0;
+
+/**
+ * unsigned short ip_checksum(const void *data, int len)
+ * 
+ * Computes checksum of IP header.
+ */
+static unsigned short ip_checksum(const void *data, int len) {
+    const unsigned short *p = (const unsigned short *) data;
+    unsigned int sum = 0;
+    
+    for(; len > 1; len -= 2) {
+        sum += *p++;
+    }
+    
+    while(sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    
+    return (unsigned short) ~sum;
+}
+
+/**
+ * void write_capture_record(capture_record_t *rec)
+ * 
+ * Writes datagram to capture file behind synthesized IPv4 and UDP headers.
+ */
+static void write_capture_record(capture_record_t *rec) {
+    pcap_record_t pcap;
+    struct iphdr ip;
+    struct udphdr udp;
+    struct sockaddr_in *src = (rec->dir == CAPTURE_IN ? &rec->addr : &capture_local);
+    struct sockaddr_in *dst = (rec->dir == CAPTURE_IN ? &capture_local : &rec->addr);
+    int caplen = (rec->len < CAPTURE_SNAPLEN ? rec->len : CAPTURE_SNAPLEN);
+    
+    memset(&ip, 0, sizeof(ip));
+    ip.version = 4;
+    ip.ihl = sizeof(ip) / 4;
+    ip.tot_len = htons(sizeof(ip) + sizeof(udp) + rec->len);
+    ip.id = htons(capture_ip_id++);
+    ip.frag_off = htons(IP_DF);
+    ip.ttl = 64;
+    ip.protocol = IPPROTO_UDP;
+    ip.saddr = src->sin_addr.s_addr;
+    ip.daddr = dst->sin_addr.s_addr;
+    ip.check = ip_checksum(&ip, sizeof(ip));
+    
+    /* UDP checksum is optional over IPv4, left zero */
+    udp.source = src->sin_port;
+    udp.dest = dst->sin_port;
+    udp.len = htons(sizeof(udp) + rec->len);
+    udp.check = 0;
+    
+    pcap.ts_sec = rec->timestamp.tv_sec;
+    pcap.ts_usec = rec->timestamp.tv_usec;
+    pcap.incl_len = sizeof(ip) + sizeof(udp) + caplen;
+    pcap.orig_len = sizeof(ip) + sizeof(udp) + rec->len;
+    
+    fwrite(&pcap, sizeof(pcap), 1, capture_file);
+    fwrite(&ip, sizeof(ip), 1, capture_file);
+    fwrite(&udp, sizeof(udp), 1, capture_file);
+    fwrite(rec->data, 1, caplen, capture_file);
+}
+
+/**
+ * int write_captured()
+ * 
+ * Writes all published records to capture file. Returns number of
+ * written records. Only writer thread (or stop_capture once it finished)
+ * can consume records.
+ */
+static int write_captured() {
+    capture_record_t *rec;
+    int written = 0;
+    
+    for(;;) {
+        rec = &capture_ring[capture_ring_head & (CAPTURE_RING_SIZE - 1)];
+        
+        if(__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) != capture_ring_head + 1) {
+            break;
+        }
+        
+        write_capture_record(rec);
+        
+        /* Release slot to producers */
+        __atomic_store_n(&rec->seq, capture_ring_head + CAPTURE_RING_SIZE, __ATOMIC_RELEASE);
+        __atomic_store_n(&capture_ring_head, capture_ring_head + 1, __ATOMIC_RELAXED);
+        written++;
+        
+        /* Stats */
+        captured_dgrams++;
+    }
+    
+    return written;
+}
+
+/**
+ * void *run_capture(void *arg)
+ * 
+ * Writer thread, writes records in batches as long as there are any. Unlike
+ * logger thread, it isn't woken up by every record (capturing would cost
+ * a syscall per datagram), it wakes up every CAPTURE_FLUSH_USEC or once
+ * ring is half full.
+ */
+static void *run_capture(void *arg) {
+    int fds[2];
+    int ready[2];
+    int loop;
+    
+    fds[0] = capture_event;
+    fds[1] = create_timer();
+    loop = create_event_loop(fds, 2);
+    
+    for(;;) {
+        if(write_captured()) {
+            continue;
+        }
+        
+        fflush(capture_file);
+        
+        if(__atomic_load_n(&capture_thread_stop, __ATOMIC_SEQ_CST)) {
+            break;
+        }
+        
+        set_timer(fds[1], CAPTURE_FLUSH_USEC);
+        wait_events(loop, ready, 2);
+        
+        clear_event(fds[0]);
+        clear_event(fds[1]);
+    }
+    
+    close(loop);
+    close(fds[1]);
+    
+    return NULL;
+}
+
+/**
+ * void set_capture_local(struct sockaddr_in *addr)
+ * 
+ * Sets server's address used in synthesized headers.
+ */
+void set_capture_local(struct sockaddr_in *addr) {
+    memcpy(&capture_local, addr, sizeof(capture_local));
+}
+
+/**
+ * int start_capture(char *filename)
+ * 
+ * Creates pcap file with filename and starts capturing datagrams into it.
+ * Returns 0 if capture is already running or file can't be created.
+ * Only main thread starts and stops capture.
+ */
+int start_capture(char *filename) {
+    pcap_header_t header;
+    unsigned int i;
+    
+    if(capture_active) {
+        LOG_LINE(LOG_WARN, "Capture is already running.");
+        
+        return 0;
+    }
+    
+    if((capture_file = fopen(filename, "wb")) == NULL) {
+        LOG_FMT(LOG_ERR,
+                "Error creating capture file %s",
+                filename
+                );
+        
+        return 0;
+    }
+    
+    /* Ring and wake up event are kept for next captures, producer which
+     * saw capture running just before it stopped may still use them
+     */
+    if(!capture_ring_ready) {
+        for(i = 0; i < CAPTURE_RING_SIZE; i++) {
+            capture_ring[i].seq = i;
+        }
+        
+        capture_event = create_event();
+        capture_ring_ready = 1;
+    }
+    
+    setvbuf(capture_file, NULL, _IOFBF, CAPTURE_FILE_BUFFER_SIZE);
+    
+    memset(&header, 0, sizeof(header));
+    header.magic = PCAP_MAGIC;
+    header.version_major = PCAP_VERSION_MAJOR;
+    header.version_minor = PCAP_VERSION_MINOR;
+    header.snaplen = sizeof(struct iphdr) + sizeof(struct udphdr) + CAPTURE_SNAPLEN;
+    header.network = PCAP_LINKTYPE_RAW;
+    
+    fwrite(&header, sizeof(header), 1, capture_file);
+    
+    capture_thread_stop = 0;
+    captured_at_start = captured_dgrams;
+    dropped_at_start = capture_dropped;
+    
+    if(pthread_create(&capture_thread, NULL, run_capture, NULL) != 0) {
+        LOG_LINE(LOG_ERR, "Error creating capture thread.");
+        
+        fclose(capture_file);
+        capture_file = NULL;
+        
+        return 0;
+    }
+    
+    __atomic_store_n(&capture_active, 1, __ATOMIC_SEQ_CST);
+    
+    LOG_FMT(LOG_ALWAYS,
+            "Capturing datagrams to %s",
+            filename
+            );
+    
+    return 1;
+}
+
+/**
+ * void stop_capture()
+ * 
+ * Stops capturing, waits until writer thread writes all records and
+ * closes capture file.
+ */
+void stop_capture() {
+    if(!capture_active) {
+        return;
+    }
+    
+    __atomic_store_n(&capture_active, 0, __ATOMIC_SEQ_CST);
+    
+    __atomic_store_n(&capture_thread_stop, 1, __ATOMIC_SEQ_CST);
+    signal_event(capture_event);
+    
+    pthread_join(capture_thread, NULL);
+    
+    /* Records published while thread was finishing */
+    write_captured();
+    
+    fclose(capture_file);
+    capture_file = NULL;
+    
+    LOG_FMT(LOG_ALWAYS,
+            "Capture stopped, %u datagrams captured, %u dropped",
+            captured_dgrams - captured_at_start,
+            capture_dropped - dropped_at_start
+            );
+}
+
+/**
+ * void set_capture_sample(unsigned int n)
+ * 
+ * Captures only every n-th datagram of each shard (1 captures all).
+ */
+void set_capture_sample(unsigned int n) {
+    capture_sample = (n > 1 ? n : 1);
+}
+
+/**
+ * void set_capture_filter(struct sockaddr_in *addr)
+ * 
+ * Captures only datagrams of client with given address (any port if port
+ * is 0), NULL captures all clients.
+ */
+void set_capture_filter(struct sockaddr_in *addr) {
+    uint64_t filter = 0;
+    
+    if(addr) {
+        filter = (uint64_t) addr->sin_addr.s_addr << 32 | (uint64_t) addr->sin_port << 16 | 1;
+    }
+    
+    __atomic_store_n(&capture_filter, filter, __ATOMIC_RELAXED);
+}
+
+/**
+ * void capture_dgram(int dir, const char *buff, int len, struct sockaddr_in *addr)
+ * 
+ * Copies datagram received from or sent to given address to capture ring,
+ * headers are synthesized later by writer thread. If ring is full,
+ * datagram is counted in capture_dropped.
+ */
+void capture_dgram(int dir, const char *buff, int len, struct sockaddr_in *addr) {
+    uint64_t filter = __atomic_load_n(&capture_filter, __ATOMIC_RELAXED);
+    unsigned int port = (unsigned int) (filter >> 16) & 0xFFFF;
+    capture_record_t *rec;
+    unsigned int pos;
+    int diff;
+    
+    /* Other client */
+    if((filter & 1) && ((uint32_t) (filter >> 32) != addr->sin_addr.s_addr ||
+            (port && port != addr->sin_port))) {
+        return;
+    }
+    
+    /* Not sampled */
+    if(capture_sample > 1 && capture_counter++ % capture_sample != 0) {
+        return;
+    }
+    
+    /* Take free slot */
+    pos = __atomic_load_n(&capture_ring_tail, __ATOMIC_RELAXED);
+    
+    for(;;) {
+        rec = &capture_ring[pos & (CAPTURE_RING_SIZE - 1)];
+        diff = (int) (__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) - pos);
+        
+        if(diff == 0) {
+            if(__atomic_compare_exchange_n(&capture_ring_tail, &pos, pos + 1, 1,
+                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        }
+        /* Writer thread didn't consume this slot yet, ring is full */
+        else if(diff < 0) {
+            __sync_fetch_and_add(&capture_dropped, 1);
+            
+            return;
+        }
+        /* Other producer took the slot */
+        else {
+            pos = __atomic_load_n(&capture_ring_tail, __ATOMIC_RELAXED);
+        }
+    }
+    
+    gettimeofday(&rec->timestamp, NULL);
+    rec->dir = dir;
+    rec->addr = *addr;
+    rec->len = len;
+    
+    memcpy(rec->data, buff, (len < CAPTURE_SNAPLEN ? len : CAPTURE_SNAPLEN));
+    
+    /* Publish record */
+    __atomic_store_n(&rec->seq, pos + 1, __ATOMIC_RELEASE);
+    
+    /* Producer which fills half of the ring wakes up writer thread */
+    if(pos - __atomic_load_n(&capture_ring_head, __ATOMIC_RELAXED) == CAPTURE_RING_SIZE / 2) {
+        signal_event(capture_event);
+    }
+}
+
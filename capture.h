@@ -0,0 +1,70 @@
+/** 
+ * -----------------------------------------------------------------------------
+ * Clovece nezlob se (Server) - simple board game
+ * 
+ * Server for board game Clovece nezlob se using UDP datagrams for communication
+ * with clients and SEND-AND-WAIT method to ensure that all packets arrive
+ * and that they arrive in correct order. 
+ * 
+ * Semestral work for "Uvod do pocitacovich siti" KIV/UPS at
+ * University of West Bohemia.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * File: capture.c
+ * Description: Capture of received and sent datagrams to pcap file, written
+ *              by background thread.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * @author: Martin Kucera, 2014
+ * @version: 1.02
+ * 
+ */
+
+
+#ifndef CAPTURE_H
+#define	CAPTURE_H
+
+#include <netinet/in.h>
+
+#include "global.h"
+
+/* Number of records in capture ring (power of 2) */
+#define CAPTURE_RING_SIZE 1024
+/* Longest time captured datagram waits for writer thread */
+#define CAPTURE_FLUSH_USEC 50000
+/* Size of capture file's stdio buffer */
+#define CAPTURE_FILE_BUFFER_SIZE (1 << 20)
+/* Longest captured part of datagram */
+#define CAPTURE_SNAPLEN MAX_DGRAM_SIZE
+
+/* Direction of captured datagram */
+#define CAPTURE_IN 0
+#define CAPTURE_OUT 1
+
+/* Datagrams are being captured */
+extern int capture_active;
+/* Number of captured datagrams */
+extern unsigned int captured_dgrams;
+/* Number of datagrams not captured because capture ring was full */
+extern unsigned int capture_dropped;
+
+/* Captures datagram, arguments aren't evaluated if capture isn't running */
+#define CAPTURE_DGRAM(dir, buff, len, addr) \
+    do { \
+        if(capture_active) { \
+            capture_dgram((dir), (buff), (len), (addr)); \
+        } \
+    } while(0)
+
+/* Function prototypes */
+void set_capture_local(struct sockaddr_in *addr);
+int start_capture(char *filename);
+void stop_capture();
+void set_capture_sample(unsigned int n);
+void set_capture_filter(struct sockaddr_in *addr);
+void capture_dgram(int dir, const char *buff, int len, struct sockaddr_in *addr);
+
+#endif	/* CAPTURE_H */
+
@@ -33,44 +33,62 @@
 #include <unistd.h>
 
 #include "client.h"
-#include "client.h"
-#include "queue.h"
+#include "ring.h"
 #include "com.h"
+#include "proto.h"
 #include "logger.h"
 #include "game.h"
 #include "server.h"
+#include "shard.h"
+#include "err.h"
+#include "pool.h"
 
-/* Array of connected clients */
-client_t *clients[MAX_CONCURRENT_CLIENTS] = {NULL};
-/* Number of clients connected  */
+/* Number of clients connected (in all shards) */
 unsigned int client_num = 0;
-/* Reconnect codes */
-char *reconnect_code[MAX_CONCURRENT_CLIENTS] = {NULL};
+/* Maximum number of connected clients */
+unsigned int max_clients = MAX_CONCURRENT_CLIENTS;
 
-/* Logger buffer */
-char log_buffer[LOG_BUFFER_SIZE];
+/**
+ * int reserve_client()
+ * 
+ * Counts new client if server isn't full. Returns 0 if it is full.
+ */
+static int reserve_client() {
+    unsigned int num;
+    
+    do {
+        num = client_num;
+        
+        if(num >= max_clients) {
+            return 0;
+        }
+    } while(!__sync_bool_compare_and_swap(&client_num, num, num + 1));
+    
+    return 1;
+}
 
 /**
- * void add_client(struct sockaddr_in *addr)
+ * void add_client(struct sockaddr_in *addr, int binary)
  * 
  * Takes input sockaddr_in and checks if it isn't already present in the
  * client connected array. If it isn't, creates new client_t structure and
  * associates it's members. Afterwards inserts newly created client into
- * the client array. Client's ID is permanent for the whole durration
- * of connection.
+ * the client array of current shard. Client's ID is permanent for the whole
+ * durration of connection (unless he moves to another shard). Binary flag
+ * tells if client connected using binary protocol (v2).
  */
-void add_client(struct sockaddr_in *addr) {
-    client_t *existing_client;
+void add_client(struct sockaddr_in *addr, int binary) {
+    client_t record;
     client_t *new_client;
     struct sockaddr_in *new_addr;
-    int i;
+    char addr_str[INET_ADDRSTRLEN];
     
-    if(client_num < MAX_CONCURRENT_CLIENTS) {
-        existing_client = get_client_by_addr(addr);
-        
-        if(existing_client == NULL) {
-            /* Allocate memory for new client */
-            new_client = (client_t *) malloc(sizeof(client_t));
+    /* Client is already connected */
+    if(get_client_by_addr(addr) == NULL) {
+        if(reserve_client()) {
+            /* Record is copied to current shard's slab once it's complete */
+            new_client = &record;
+            memset(new_client, 0, sizeof(client_t));
 
             /* Allocate memory for client address */
             new_addr = (struct sockaddr_in *) malloc(sizeof(struct sockaddr_in));
@@ -82,64 +100,99 @@ void add_client(struct sockaddr_in *addr) {
             new_client->state = 1;
             new_client->pkt_recv_seq_id = 1;
             new_client->pkt_send_seq_id = 1;
+            new_client->send_window = 1;
+            new_client->rto_usec = INIT_RTO_USEC;
+            new_client->binary = binary;
             new_client->addr = new_addr;
-            new_client->addr_str = malloc(INET_ADDRSTRLEN + 1);
-            new_client->dgram_queue = malloc(sizeof(Queue));
             new_client->game_index = -1;
             new_client->reconnect_code = (char *) malloc(RECONNECT_CODE_LEN + 1);
-            
-            pthread_mutex_init(&new_client->mtx_client, NULL);
+            new_client->home_shard = cur_shard->index;
 
-            queue_init(new_client->dgram_queue);
-            inet_ntop(AF_INET, &addr->sin_addr, new_client->addr_str, INET_ADDRSTRLEN);
+            ring_init(&new_client->dgram_queue);
 
             /* Update timestamp */
             update_client_timestamp(new_client);
 
-            /* Add client to array */
-            for(i = 0; i < MAX_CONCURRENT_CLIENTS; i++) {
-                if(clients[i] == NULL) {                
-                    new_client->client_index = i;
-                    clients[i] = new_client;
+            /* Add client to table and assign reconnect code */
+            new_client = attach_client(new_client);
 
-                    client_num++;
-                    break;
-                }
+            if(LOG_TEXT_ENABLED(LOG_INFO)) {
+                inet_ntop(AF_INET, &addr->sin_addr, addr_str, INET_ADDRSTRLEN);
+                
+                LOG_FMT(LOG_INFO,
+                        "Added new client with IP address: %s and port %d",
+                        addr_str,
+                        htons(addr->sin_port)
+                        );
             }
             
-            /* Assign reconnect code */
-            generate_reconnect_code(new_client->reconnect_code, 0);
-            reconnect_code[new_client->client_index] = new_client->reconnect_code;            
-
-            sprintf(log_buffer,
-                    "Added new client with IP address: %s and port %d",
-                    new_client->addr_str,
-                    htons(addr->sin_port)
-                    );
-            
-            log_line(log_buffer, LOG_INFO);
-            
+            LOG_EVENT(LOG_INFO, EV_CLIENT_ADDED, new_client->client_index, -1, 0,
+                    0, 0, addr->sin_addr.s_addr, ntohs(addr->sin_port));
+        
             /* Stats */
-            num_connections++;
+            STAT_ADD(num_connections, 1);
         }
         else {
-            release_client(existing_client);
+            LOG_TEXT(LOG_INFO, "New client tried to connec but server is full");
+            LOG_EVENT(LOG_INFO, EV_CLIENT_FULL, -1, -1, 0, 0, 0, 0, 0);
+            inform_server_full(addr, binary);
         }
     }
-    else {
-        log_line("New client tried to connec but server is full", LOG_INFO);
-        inform_server_full(addr);
+}
+
+/**
+ * client_t *attach_client(client_t *client)
+ * 
+ * Copies client's record into the client table of current shard and assigns
+ * him reconnect code pointing to the shard. Returns the stored record.
+ */
+client_t *attach_client(client_t *client) {
+    int index = slab_alloc(&cur_shard->clients);
+    client_t *stored;
+    
+    if(index < 0) {
+        raise_error("Error allocating client record.");
     }
+    
+    stored = (client_t *) slab_get(&cur_shard->clients, index);
+    memcpy(stored, client, sizeof(client_t));
+    
+    stored->client_index = index;
+    index_map_put(&cur_shard->client_map, addr_key(stored->addr), index);
+    
+    generate_reconnect_code(stored->reconnect_code, 0);
+    index_map_put(&cur_shard->rcode_map, code_key(stored->reconnect_code, RECONNECT_CODE_LEN), index);
+    
+    return stored;
 }
 
 /**
- * void reconnect_client(client_t *client, struct sockaddr_in *addr)
+ * void detach_client(client_t *client)
+ * 
+ * Removes client from the client table of current shard without freeing
+ * his members, client is handed over to another shard (or freed).
+ */
+void detach_client(client_t *client) {
+    index_map_remove(&cur_shard->client_map, addr_key(client->addr), client->client_index);
+    index_map_remove(&cur_shard->rcode_map,
+            code_key(client->reconnect_code, RECONNECT_CODE_LEN), client->client_index);
+    
+    slab_free(&cur_shard->clients, client->client_index);
+}
+
+/**
+ * void reconnect_client(client_t *client, struct sockaddr_in *addr, int home, int binary)
  * 
  * Updates existing client's address and if he was in game, sends him game
- * state nad informs other players that he reconnected.
+ * state nad informs other players that he reconnected. Home is the shard
+ * which receives datagrams from client's new address, binary flag tells
+ * if client reconnected using binary protocol (v2).
  */
-void reconnect_client(client_t *client, struct sockaddr_in *addr) {
-    char buff[100];
+void reconnect_client(client_t *client, struct sockaddr_in *addr, int home, int binary) {
+    static char conn_close[] = STRINGIFY(APP_TOKEN) ";1;CONN_CLOSE";
+    char buff[MSG_BUFF_SIZE];
+    msg_t msg;
+    char addr_str[INET_ADDRSTRLEN];
     int i;
     game_t *game;
         
@@ -147,39 +200,47 @@ void reconnect_client(client_t *client, struct sockaddr_in *addr) {
         /* First check if client was still logged in */
         if(client->state) {
             /* Inform client that connection was closed */
-            sprintf(buff,
-                    "%s;1;CONN_CLOSE",
-                    STRINGIFY(APP_TOKEN)
-                    );
-            
-            sendto(
-                    server_sockfd,
-                    buff,
-                    strlen(buff),
-                    0,
-                    (struct sockaddr *) client->addr,
-                    sizeof(*(client->addr))
-            );
-            
-            /* Stats */
-            sent_bytes += strlen(buff);
-            sent_dgrams++;
+            send_client_dgram(conn_close, sizeof(conn_close) - 1, client->addr, client->binary);
         }
         
         client->state = 1;
+        client->binary = binary;
         client->pkt_recv_seq_id = 1;
         client->pkt_send_seq_id = 1;      
+        
+        /* Path may have changed, measure RTT again */
+        client->srtt_usec = 0;
+        client->rttvar_usec = 0;
+        client->rto_usec = INIT_RTO_USEC;
+        client->ack_pending = 0;
+        
+        /* Old address is not routed to us anymore */
+        if(client->home_shard != cur_shard->index &&
+                (client->home_shard != home ||
+                client->addr->sin_addr.s_addr != addr->sin_addr.s_addr ||
+                client->addr->sin_port != addr->sin_port)) {
+            
+            set_route(client->home_shard, client->addr, -1);
+        }
+        
+        /* Route new address to us */
+        if(home != cur_shard->index) {
+            set_route(home, addr, cur_shard->index);
+        }
+        
+        client->home_shard = home;
 
         /* Update timestamp */
         update_client_timestamp(client);
 
-        /* Copy address */
+        /* Copy address and reindex client by it */
+        index_map_remove(&cur_shard->client_map, addr_key(client->addr), client->client_index);
         memcpy(client->addr, addr, sizeof(struct sockaddr_in));
+        index_map_put(&cur_shard->client_map, addr_key(client->addr), client->client_index);
         
-        /* Clear packet queue */
+        /* Clear packet queue and packets held for reordering */
         clear_client_dgram_queue(client);
-        
-        inet_ntop(AF_INET, &addr->sin_addr, client->addr_str, INET_ADDRSTRLEN);
+        clear_client_reorder(client);
         
         /* Send ACK */
         send_ack(client, 1, 0);
@@ -197,133 +258,99 @@ void reconnect_client(client_t *client, struct sockaddr_in *addr) {
                 }
 
                 /* Notify players */
-                sprintf(buff,
-                        "CLIENT_RECONNECT;%d",
-                        i
-                        );
+                msg_begin_buff(&msg, buff, sizeof(buff), MSG_CLIENT_RECONNECT);
+                msg_int(&msg, i);
 
-                broadcast_game(game, buff, client, 0);
+                broadcast_game(game, &msg, client, 0);
 
                 /* Send game state to client */
                 send_game_state(client, game);
-                
-                /* Release game */
-                release_game(game);
             }
         }
 
         /* Log */
-        sprintf(log_buffer,
-                "Reconnected client IP address: %s and port %d",
-                client->addr_str,
-                htons(addr->sin_port)
-                );
-
-        log_line(log_buffer, LOG_INFO);
+        if(LOG_TEXT_ENABLED(LOG_INFO)) {
+            inet_ntop(AF_INET, &addr->sin_addr, addr_str, INET_ADDRSTRLEN);
+            
+            LOG_FMT(LOG_INFO,
+                    "Reconnected client IP address: %s and port %d",
+                    addr_str,
+                    htons(addr->sin_port)
+                    );
+        }
+        
+        LOG_EVENT(LOG_INFO, EV_CLIENT_RECONNECTED, client->client_index, client->game_index, 0,
+                0, 0, addr->sin_addr.s_addr, ntohs(addr->sin_port));
     }
 }
 
 /* 
  * client_t* get_client(struct sockaddr_in *addr)
  * 
- * Loops through the connected client array, trying to find
- * a 
- * Searches through connected clients to find matching
- * address and port. If it finds a match, returns client
- * with it's mutex locked, has to be released afterwards
- * with release_client(client_t *client)
+ * Looks up client of current shard with matching address and port
+ * in shard's address index. Clients are owned by their shard's thread,
+ * so no locking is needed.
  */
 client_t* get_client_by_addr(struct sockaddr_in *addr) {
-    int i = 0;
-    char addr_str[INET_ADDRSTRLEN];
-    
-    inet_ntop(AF_INET, &(addr)->sin_addr, addr_str, INET_ADDRSTRLEN);
-    
-    for(i = 0; i < MAX_CONCURRENT_CLIENTS; i++) {
-        if(clients[i] != NULL) {
-            pthread_mutex_lock(&clients[i]->mtx_client);
-
-            /* Check if client still exists */
-            if(clients[i] != NULL) {
-
-                    /* Check if address and port matches */
-                    if(strncmp(clients[i]->addr_str, addr_str, INET_ADDRSTRLEN) == 0
-                            && (htons((addr)->sin_port) == htons(clients[i]->addr->sin_port) )) {
-                        
-                        return clients[i];
-
-                    }
-            }
-
-            release_client(clients[i]);
-        }
-    }
-    
-    return NULL;
+    return get_client_by_index(index_map_get(&cur_shard->client_map, addr_key(addr)));
 }
 
 /* 
  * client_t* get_client_by_index(int index)
  * 
- * Returns client at given index and locks him.
+ * Returns client of current shard at given index.
  * If no client is at that index, returns NULL. 
  */
 client_t* get_client_by_index(int index) {
-    if(index>= 0 && MAX_CONCURRENT_CLIENTS > index && clients[index]) {    
-        pthread_mutex_lock(&clients[index]->mtx_client);
-        
-        return clients[index];
-    }
-    
-    return NULL;
-}
-
-/*
- * void release_client(client_t *client)
- * 
- * Tries to release client's mutex
- */
-void release_client(client_t *client) {    
-    if(client && pthread_mutex_trylock(&client->mtx_client) != 0) {
-        pthread_mutex_unlock(&client->mtx_client);
-    }
-    else {
-        log_line("Tried to release non-locked client", LOG_WARN);
-    }
+    return (client_t *) slab_get(&cur_shard->clients, index);
 }
 
 /*
  * void remove_client(client_t **client)
  * 
- * Removes client from client array, before deleting, wakes
- * up a possible thread waiting for its mutex.
+ * Removes client from client array of current shard and frees him.
+ * If his datagrams were routed to us by another shard, route is removed.
  * 
  */
 void remove_client(client_t **client) {            
+    char addr_str[INET_ADDRSTRLEN];
+    struct sockaddr_in *addr;
+    char *reconnect_code;
+    
     if(client != NULL) {
-        sprintf(log_buffer,
-                "Removing client with IP address: %s and port %d",
-                (*client)->addr_str,
-                htons((*client)->addr->sin_port)
-                );
+        if(LOG_TEXT_ENABLED(LOG_INFO)) {
+            inet_ntop(AF_INET, &(*client)->addr->sin_addr, addr_str, INET_ADDRSTRLEN);
+            
+            LOG_FMT(LOG_INFO,
+                    "Removing client with IP address: %s and port %d",
+                    addr_str,
+                    htons((*client)->addr->sin_port)
+                    );
+        }
+        
+        LOG_EVENT(LOG_INFO, EV_CLIENT_REMOVED, (*client)->client_index, (*client)->game_index, 0,
+                0, 0, (*client)->addr->sin_addr.s_addr, ntohs((*client)->addr->sin_port));
+        
+        /* Client won't get any more packets to carry his last ACK */
+        send_pending_ack(*client);
         
-        log_line(log_buffer, LOG_INFO);
+        clear_client_dgram_queue((*client));
+        clear_client_reorder((*client));
         
-        clients[(*client)->client_index] = NULL;
-        reconnect_code[(*client)->client_index] = NULL;
+        if((*client)->home_shard != cur_shard->index) {
+            set_route((*client)->home_shard, (*client)->addr, -1);
+        }
         
-        free((*client)->addr);
-        free((*client)->addr_str);
-        free((*client)->reconnect_code);
+        /* Slot is free once client is detached, members are freed after */
+        addr = (*client)->addr;
+        reconnect_code = (*client)->reconnect_code;
         
-        client_num --;
+        detach_client(*client);
         
-        /* Release client */
-        release_client((*client));
+        free(addr);
+        free(reconnect_code);
         
-	clear_client_dgram_queue((*client));
-        free((*client)->dgram_queue);
-        free((*client));
+        __sync_fetch_and_sub(&client_num, 1);
     }
     
     *client = NULL;
@@ -349,7 +376,7 @@ void clear_all_clients() {
     int i = 0;
     client_t *client;
     
-    for(i = 0; i < MAX_CONCURRENT_CLIENTS; i++) {
+    for(i = 0; i < cur_shard->clients.capacity; i++) {
         client = get_client_by_index(i);
         
         if(client) {
@@ -361,48 +388,250 @@ void clear_all_clients() {
 /**
  * void clear_client_dgram_queue(client_t *client)
  * 
- * Removes all packets from client's output queue and frees all alocated
- * memory
+ * Removes all packets from client's output queue and returns them
+ * to the pool
  */
 void clear_client_dgram_queue(client_t *client) {
-    packet_t *packet = queue_front(client->dgram_queue);
+    packet_t *packet;
     
-    while(packet) {
-        queue_pop(client->dgram_queue, 0);
-        
-        if(packet->state) {
-            free(packet->payload);
-        }
+    while((packet = ring_pop(&client->dgram_queue)) != NULL) {
+        free_packet(packet);
+    }
+}
+
+/**
+ * int hold_reordered_dgram(client_t *client, int seq_id, char *dgram)
+ * 
+ * Keeps copy of client's datagram which arrived ahead of expected one,
+ * until the packets in front of it arrive. Returns 0 if datagram is too far
+ * ahead or shard holds too many packets already, datagram is dropped then
+ * and client has to resend it.
+ */
+int hold_reordered_dgram(client_t *client, int seq_id, char *dgram) {
+    packet_t *packet;
+    int slot = seq_id % REORDER_WINDOW;
+    
+    /* Already held */
+    if(client->reorder[slot] && client->reorder[slot]->seq_id == seq_id) {
+        return 1;
+    }
+    
+    if(seq_id - client->pkt_recv_seq_id > REORDER_WINDOW ||
+            client->reorder[slot] || cur_shard->reorder_held >= MAX_REORDER_HELD) {
         
-        free(packet->msg);
-        free(packet);
+        /* Stats */
+        STAT_ADD(reorder_dropped, 1);
         
-        packet = queue_front(client->dgram_queue);
+        return 0;
     }
+    
+    packet = alloc_packet();
+    packet->seq_id = seq_id;
+    packet->msg = packet->buffer;
+    
+    strncpy(packet->msg, dgram, MAX_DGRAM_SIZE);
+    packet->msg[MAX_DGRAM_SIZE] = 0;
+    
+    client->reorder[slot] = packet;
+    cur_shard->reorder_held++;
+    
+    /* Stats */
+    STAT_ADD(reorder_buffered, 1);
+    
+    return 1;
 }
 
 /**
- * int get_client_index_by_rcode(char *code)
+ * packet_t *take_reordered_dgram(client_t *client)
  * 
- * Searches through reconnect codes looking for a match. If match was found,
- * array index is the client index.
+ * Takes held datagram which client's expected SEQ_ID belongs to out of
+ * reorder buffer. Returns NULL if it didn't arrive yet. Packet has to be
+ * returned to pool once the datagram is processed.
  */
-int get_client_index_by_rcode(char *code) {
+packet_t *take_reordered_dgram(client_t *client) {
+    int slot = client->pkt_recv_seq_id % REORDER_WINDOW;
+    packet_t *packet = client->reorder[slot];
+    
+    if(!packet || packet->seq_id != client->pkt_recv_seq_id) {
+        return NULL;
+    }
+    
+    client->reorder[slot] = NULL;
+    cur_shard->reorder_held--;
+    
+    return packet;
+}
+
+/**
+ * unsigned int reorder_sack_bits(client_t *client, int seq_id)
+ * 
+ * Returns SACK bitmap of packets held in client's reorder buffer, bit i
+ * is set if packet with SEQ_ID seq_id + 1 + i is held.
+ */
+unsigned int reorder_sack_bits(client_t *client, int seq_id) {
+    unsigned int bits = 0;
+    int i;
+    
+    for(i = 0; i < REORDER_WINDOW; i++) {
+        if(client->reorder[i] && client->reorder[i]->seq_id > seq_id &&
+                client->reorder[i]->seq_id - seq_id <= SACK_BITMAP_BITS) {
+            
+            bits |= 1U << (client->reorder[i]->seq_id - seq_id - 1);
+        }
+    }
+    
+    return bits;
+}
+
+/**
+ * void clear_client_reorder(client_t *client)
+ * 
+ * Drops all packets held in client's reorder buffer
+ */
+void clear_client_reorder(client_t *client) {
     int i;
     
-    for(i = 0; i < MAX_CONCURRENT_CLIENTS; i++) {
-        if(reconnect_code[i] && strncmp(reconnect_code[i], code, RECONNECT_CODE_LEN) == 0) {
-            return i;
+    for(i = 0; i < REORDER_WINDOW; i++) {
+        if(client->reorder[i]) {
+            free_packet(client->reorder[i]);
+            
+            client->reorder[i] = NULL;
+            cur_shard->reorder_held--;
         }
     }
+}
+
+/**
+ * void set_send_window(client_t *client, unsigned int size)
+ * 
+ * Sets client's send window to size requested in CONNECT (limited by
+ * MAX_SEND_WINDOW) and confirms it to client. Clients which don't request
+ * any window (size 0) keep stop-and-wait (window 1) and aren't informed.
+ */
+void set_send_window(client_t *client, unsigned int size) {
+    msg_t msg;
     
-    return -1;
+    if(!size) {
+        return;
+    }
+    
+    if(size > MAX_SEND_WINDOW) {
+        size = MAX_SEND_WINDOW;
+    }
+    
+    client->send_window = size;
+    
+    msg_begin(&msg, client, MSG_SEND_WINDOW, 1);
+    msg_uint(&msg, client->send_window);
+    msg_send(&msg);
+}
+
+/**
+ * void display_clients_rtt()
+ * 
+ * Logs smoothed RTT, RTT variance and retransmission timeout of all clients
+ * of current shard.
+ */
+void display_clients_rtt() {
+    int i = 0;
+    client_t *client;
+    
+    for(i = 0; i < cur_shard->clients.capacity; i++) {
+        client = get_client_by_index(i);
+        
+        if(client) {
+            LOG_FMT(LOG_ALWAYS,
+                    "Shard %d client %d: SRTT %d us, RTTVAR %d us, RTO %d us",
+                    cur_shard->index,
+                    client->client_index,
+                    client->srtt_usec,
+                    client->rttvar_usec,
+                    client->rto_usec
+                    );
+        }
+    }
+}
+
+/**
+ * void dump_client_recorder(client_t *client, int severity, char *reason)
+ * 
+ * Logs datagrams kept in flight recorder of client together with reason
+ * why they are dumped.
+ */
+void dump_client_recorder(client_t *client, int severity, char *reason) {
+    char addr_str[INET_ADDRSTRLEN];
+    
+    if(!LOG_ENABLED(severity)) {
+        return;
+    }
+    
+    inet_ntop(AF_INET, &client->addr->sin_addr, addr_str, INET_ADDRSTRLEN);
+    
+    LOG_FMT(severity,
+            "Flight recorder of client %d in shard %d (%s:%d), %s:",
+            client->client_index,
+            cur_shard->index,
+            addr_str,
+            htons(client->addr->sin_port),
+            reason
+            );
+    
+    log_recorder(&client->recorder, severity);
+}
+
+/**
+ * void dump_recorder_by_addr(struct sockaddr_in *addr)
+ * 
+ * Logs flight recorder of client with given address if he is owned by
+ * current shard.
+ */
+void dump_recorder_by_addr(struct sockaddr_in *addr) {
+    client_t *client = get_client_by_addr(addr);
+    
+    if(client) {
+        dump_client_recorder(client, LOG_ALWAYS, "requested from console");
+    }
+}
+
+/**
+ * void set_piggyback_acks(client_t *client, unsigned int flag)
+ * 
+ * Enables ACKs carried in header of data packets if client asked for them
+ * in CONNECT.
+ */
+void set_piggyback_acks(client_t *client, unsigned int flag) {
+    client->piggyback_acks = (flag != 0);
+}
+
+/**
+ * void set_coalescing(client_t *client, unsigned int flag)
+ * 
+ * Enables packing of several messages into one datagram if client asked
+ * for it in CONNECT.
+ */
+void set_coalescing(client_t *client, unsigned int flag) {
+    client->coalesce = (flag != 0);
+}
+
+/**
+ * int get_client_index_by_rcode(char *code)
+ * 
+ * Looks up reconnect code in index of current shard and returns index
+ * of client it belongs to, or -1 if there is none.
+ */
+int get_client_index_by_rcode(char *code) {
+    if(!code) {
+        return -1;
+    }
+    
+    return index_map_get(&cur_shard->rcode_map, code_key(code, RECONNECT_CODE_LEN));
 }
 
 /**
  * int generate_reconnect_code(char *s, int iteration)
  * 
- * Generates unique code for client to use for reconnecting.
+ * Generates unique code for client to use for reconnecting. First letter
+ * of the code identifies current shard.
  */
 int generate_reconnect_code(char *s, int iteration)  {
     int existing_index;
@@ -414,10 +643,11 @@ int generate_reconnect_code(char *s, int iteration)  {
     }
     
     gen_random(s, RECONNECT_CODE_LEN);
+    s[0] = SHARD_CODE_CHAR(cur_shard->index);
     existing_index = get_client_index_by_rcode(s);
     
     if(existing_index != -1) {
-        generate_reconnect_code(s, iteration++);
+        generate_reconnect_code(s, iteration + 1);
     }
     
     return 1;
@@ -429,14 +659,9 @@ int generate_reconnect_code(char *s, int iteration)  {
  * Sends generated reconnection code to client
  */
 void send_reconnect_code(client_t *client) {
-    char *buff = (char *) malloc(30 + strlen(client->reconnect_code));
-    
-    sprintf(buff,
-            "RECONNECT_CODE;%s",
-            client->reconnect_code
-            );
-    
-    enqueue_dgram(client, buff, 1);
+    msg_t msg;
     
-    free(buff);
+    msg_begin(&msg, client, MSG_RECONNECT_CODE, 1);
+    msg_str(&msg, client->reconnect_code);
+    msg_send(&msg);
 }
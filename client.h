@@ -24,43 +24,62 @@
 #ifndef CLIENT_H
 #define	CLIENT_H
 
-#define RECONNECT_CODE_LEN 4
+#define RECONNECT_CODE_LEN 6
 
 #include <sys/time.h>
 
-#include "queue.h"
+#include "ring.h"
+#include "recorder.h"
 #include "global.h"
 
-/* Reconnect codes */
-extern char *reconnect_code[MAX_CONCURRENT_CLIENTS];
-
 /* Global client number */
 extern unsigned int client_num;
+/* Maximum number of connected clients */
+extern unsigned int max_clients;
 
 typedef struct {
-    /* Client access mutex */
-    pthread_mutex_t mtx_client;
-    
     /* Client state - 1 active, 0 inactive*/
     unsigned short state;
     /* Client address */
     struct sockaddr_in *addr;
-    /* Client address as a string */
-    char *addr_str;
     
-    /* Client index in an array */
+    /* Client index in an array of owning shard */
     int client_index;
+    /* Shard receiving client's datagrams */
+    int home_shard;
     
     /* Sequantial ID of sent packets to client */
     int pkt_send_seq_id;
     /* Sequential ID of received packets from client */
     int pkt_recv_seq_id;
+    /* Maximum number of packets sent to client waiting for ACK at once */
+    unsigned int send_window;
+    
+    /* Smoothed round trip time in microseconds, 0 if not measured yet */
+    int srtt_usec;
+    /* Round trip time variance in microseconds */
+    int rttvar_usec;
+    /* Current retransmission timeout in microseconds */
+    int rto_usec;
+    
+    /* Client accepts ACKs in header of data packets */
+    unsigned short piggyback_acks;
+    /* Client accepts several messages in one datagram */
+    unsigned short coalesce;
+    /* Client uses binary protocol (v2) */
+    unsigned short binary;
+    /* SEQ_ID of held ACK (cumulative), 0 if none */
+    int ack_pending;
+    /* Time when ACK started being held */
+    struct timeval ack_timestamp;
     
     /* Timestamp of last communication with client */
     struct timeval timestamp;
     
     /* Output datagram queue */
-    Queue *dgram_queue;
+    packet_ring_t dgram_queue;
+    /* Received packets ahead of expected one, slot is SEQ_ID % REORDER_WINDOW */
+    struct packet *reorder[REORDER_WINDOW];
     
     /* Current game index */
     unsigned int game_index;
@@ -71,18 +90,32 @@ typedef struct {
     /* Reconnect code */
     char *reconnect_code;
     
+    /* The last datagrams received from and sent to client */
+    recorder_t recorder;
+    
 } client_t;
 
 /* Function prototypes */
-void add_client(struct sockaddr_in *addr);
-void reconnect_client(client_t *client, struct sockaddr_in *addr);
+void add_client(struct sockaddr_in *addr, int binary);
+client_t *attach_client(client_t *client);
+void detach_client(client_t *client);
+void reconnect_client(client_t *client, struct sockaddr_in *addr, int home, int binary);
 client_t* get_client_by_addr(struct sockaddr_in *addr);
 client_t* get_client_by_index(int index);
-void release_client(client_t *client);
 void remove_client(client_t **client);
 void update_client_timestamp(client_t *client);
 void clear_all_clients();
 void clear_client_dgram_queue(client_t *client);
+int hold_reordered_dgram(client_t *client, int seq_id, char *dgram);
+struct packet *take_reordered_dgram(client_t *client);
+unsigned int reorder_sack_bits(client_t *client, int seq_id);
+void clear_client_reorder(client_t *client);
+void set_send_window(client_t *client, unsigned int size);
+void set_piggyback_acks(client_t *client, unsigned int flag);
+void set_coalescing(client_t *client, unsigned int flag);
+void display_clients_rtt();
+void dump_client_recorder(client_t *client, int severity, char *reason);
+void dump_recorder_by_addr(struct sockaddr_in *addr);
 int get_client_index_by_rcode(char *code);
 int generate_reconnect_code(char *s, int iteration);
 void send_reconnect_code(client_t *client);
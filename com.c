@@ -22,6 +22,8 @@
  * 
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <arpa/inet.h>
@@ -33,8 +35,12 @@
 #include "com.h"
 #include "global.h"
 #include "server.h"
-#include "sender.h"
+#include "uring.h"
 #include "logger.h"
+#include "shard.h"
+#include "pool.h"
+#include "proto.h"
+#include "capture.h"
 
 /* Number of sent bytes */
 unsigned int sent_bytes = 0;
@@ -46,86 +52,809 @@ unsigned int recv_bytes = 0;
 unsigned int recv_dgrams = 0;
 /* Number of client connections (total) */
 unsigned int num_connections = 0;
+/* Number of sending calls (sendto/sendmmsg) */
+unsigned int send_calls = 0;
+/* Number of datagrams dropped because client's queue was full */
+unsigned int queue_overflows = 0;
+/* Number of ACKs covered by later cumulative ACK */
+unsigned int acks_coalesced = 0;
+/* Number of ACKs carried in header of data packet */
+unsigned int acks_piggybacked = 0;
+/* Number of client packets held until packets in front of them arrived */
+unsigned int reorder_buffered = 0;
+/* Number of client packets ahead of expected one which couldn't be held */
+unsigned int reorder_dropped = 0;
+/* Number of messages appended to datagram of previous message */
+unsigned int coalesced_msgs = 0;
+/* Number of received datagrams of binary protocol */
+unsigned int binary_dgrams_in = 0;
+/* Number of sent datagrams of binary protocol */
+unsigned int binary_dgrams_out = 0;
+/* Number of bytes saved by sending binary datagrams instead of text (ACKs aside) */
+unsigned int binary_bytes_saved = 0;
+
+/* Maximum time ACK is held waiting for more packets (microseconds) */
+unsigned int ack_delay_usec = 0;
+/* Maximum time new datagram waits for more messages (microseconds) */
+unsigned int coalesce_delay_usec = 0;
+
+/* Start of every datagram header */
+static const char app_token[] = STRINGIFY(APP_TOKEN) ";";
+#define APP_TOKEN_LEN ((int) sizeof(app_token) - 1)
+
+/* Two-digit decimal strings 00 to 99 */
+static const char digit_pairs[201] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+/* Outgoing datagrams collected by one thread before being flushed at once */
+typedef struct {
+    /* Nesting depth of begin_send_batch calls, 0 if batch isn't open */
+    unsigned int depth;
+    /* Number of collected datagrams */
+    unsigned int count;
+    /* Message headers passed to sendmmsg */
+    struct mmsghdr msgs[MAX_SEND_BATCH_SIZE];
+    /* Datagram buffers */
+    struct iovec iov[MAX_SEND_BATCH_SIZE];
+    /* Destination addresses */
+    struct sockaddr_in addr[MAX_SEND_BATCH_SIZE];
+    /* Datagram payloads */
+    char dgram[MAX_SEND_BATCH_SIZE][MAX_DGRAM_SIZE];
+} send_batch_t;
+
+/* Each thread collects its own outgoing datagrams */
+static __thread send_batch_t send_batch;
+
+/**
+ * void send_batch_now(send_batch_t *batch)
+ * 
+ * Sends all datagrams collected in batch with as few sendmmsg calls as
+ * possible (or by sending ring when io_uring backend is used) and empties
+ * the batch.
+ */
+static void send_batch_now(send_batch_t *batch) {
+    unsigned int off = 0;
+    int n;
+    
+    if(capture_active) {
+        for(off = 0; off < batch->count; off++) {
+            capture_dgram(CAPTURE_OUT, batch->dgram[off], batch->iov[off].iov_len, &batch->addr[off]);
+        }
+        
+        off = 0;
+    }
+    
+    /* Submit whole batch to sending ring */
+    if(io_backend == IO_BACKEND_URING && uring_send(batch->msgs, batch->count) >= 0) {
+        batch->count = 0;
+        
+        return;
+    }
+    
+    while(off < batch->count) {
+        n = sendmmsg(server_sockfd, &batch->msgs[off], batch->count - off, 0);
+        
+        /* Stats */
+        STAT_ADD(send_calls, 1);
+        
+        /* Datagram couldn't be sent at all, skip it */
+        if(n <= 0) {
+            n = 1;
+        }
+        
+        off += n;
+    }
+    
+    batch->count = 0;
+}
+
+/**
+ * void begin_send_batch()
+ * 
+ * Starts collecting datagrams sent by calling thread. Datagrams are sent
+ * once the matching flush_send_batch is called. Calls can be nested, only
+ * the outermost flush actually sends the datagrams.
+ */
+void begin_send_batch() {
+    send_batch.depth++;
+}
+
+/**
+ * void flush_send_batch()
+ * 
+ * Closes batch opened by begin_send_batch. If it was the outermost one,
+ * sends all collected datagrams by sendmmsg.
+ */
+void flush_send_batch() {
+    if(send_batch.depth > 0 && --send_batch.depth == 0 && send_batch.count > 0) {
+        send_batch_now(&send_batch);
+    }
+}
+
+/**
+ * unsigned int batch_slot(send_batch_t *batch, struct sockaddr_in *addr)
+ * 
+ * Prepares next free slot of batch for datagram sent to given address
+ * and returns its index. Datagram is added to batch by setting its length
+ * and incrementing batch's count.
+ */
+static unsigned int batch_slot(send_batch_t *batch, struct sockaddr_in *addr) {
+    unsigned int i;
+    
+    if(batch->count == MAX_SEND_BATCH_SIZE) {
+        send_batch_now(batch);
+    }
+    
+    i = batch->count;
+    
+    memcpy(&batch->addr[i], addr, sizeof(*addr));
+    
+    batch->iov[i].iov_base = batch->dgram[i];
+    
+    memset(&batch->msgs[i], 0, sizeof(batch->msgs[i]));
+    batch->msgs[i].msg_hdr.msg_name = &batch->addr[i];
+    batch->msgs[i].msg_hdr.msg_namelen = sizeof(batch->addr[i]);
+    batch->msgs[i].msg_hdr.msg_iov = &batch->iov[i];
+    batch->msgs[i].msg_hdr.msg_iovlen = 1;
+    
+    return i;
+}
+
+/**
+ * void send_dgram(char *buff, int len, struct sockaddr_in *addr)
+ * 
+ * Sends datagram to given address. If calling thread has send batch open,
+ * datagram is copied to the batch and sent when the batch is flushed,
+ * otherwise it is sent immediately.
+ */
+void send_dgram(char *buff, int len, struct sockaddr_in *addr) {
+    send_batch_t *batch = &send_batch;
+    unsigned int i;
+    
+    /* Stats */
+    STAT_ADD(sent_bytes, len);
+    STAT_ADD(sent_dgrams, 1);
+    
+    /* No batch or datagram too big to be batched */
+    if(!batch->depth || len > MAX_DGRAM_SIZE) {
+        /* Keep order of datagrams already waiting in batch */
+        if(batch->count > 0) {
+            send_batch_now(batch);
+        }
+        
+        CAPTURE_DGRAM(CAPTURE_OUT, buff, len, addr);
+        
+        sendto(server_sockfd, buff, len, 0, (struct sockaddr *) addr, sizeof(*addr));
+        
+        /* Stats */
+        STAT_ADD(send_calls, 1);
+        
+        return;
+    }
+    
+    i = batch_slot(batch, addr);
+    
+    memcpy(batch->dgram[i], buff, len);
+    batch->iov[i].iov_len = len;
+    batch->count++;
+}
+
+/**
+ * void send_client_dgram(char *buff, int len, struct sockaddr_in *addr, int binary)
+ * 
+ * Sends fixed text datagram (not built by msg_begin) to client. If client
+ * uses binary protocol, datagram is encoded right into the send batch
+ * (or into stack buffer if there is no batch open).
+ */
+void send_client_dgram(char *buff, int len, struct sockaddr_in *addr, int binary) {
+    send_batch_t *batch = &send_batch;
+    char frame[MAX_DGRAM_SIZE];
+    char *out = frame;
+    int frame_len;
+    unsigned int i = 0;
+    
+    if(!binary) {
+        send_dgram(buff, len, addr);
+        
+        return;
+    }
+    
+    if(batch->depth) {
+        i = batch_slot(batch, addr);
+        out = batch->dgram[i];
+    }
+    
+    frame_len = encode_dgram(buff, len, out, MAX_DGRAM_SIZE);
+    
+    if(frame_len < 0) {
+        LOG_FMT(LOG_WARN,
+                "Datagram can't be encoded to binary protocol, dropping it: %s",
+                buff
+                );
+        
+        return;
+    }
+    
+    /* Stats */
+    STAT_ADD(binary_dgrams_out, 1);
+    STAT_ADD(binary_bytes_saved, len - frame_len);
+    
+    if(!batch->depth) {
+        send_dgram(frame, frame_len, addr);
+        
+        return;
+    }
+    
+    /* Stats */
+    STAT_ADD(sent_bytes, frame_len);
+    STAT_ADD(sent_dgrams, 1);
+    
+    batch->iov[i].iov_len = frame_len;
+    batch->count++;
+}
+
+/**
+ * int uint_len(unsigned int value)
+ * 
+ * Returns number of decimal digits of value.
+ */
+static int uint_len(unsigned int value) {
+    int len = 1;
+    
+    while(value >= 100) {
+        value /= 100;
+        len += 2;
+    }
+    
+    return len + (value >= 10);
+}
+
+/**
+ * char *fmt_uint(char *out, unsigned int value)
+ * 
+ * Writes value in decimal to out (without terminating zero), two digits
+ * at a time from the end. Returns position right after the last digit.
+ */
+static char *fmt_uint(char *out, unsigned int value) {
+    char *end = out + uint_len(value);
+    char *pos = end;
+    
+    while(value >= 100) {
+        pos -= 2;
+        memcpy(pos, digit_pairs + (value % 100) * 2, 2);
+        value /= 100;
+    }
+    
+    if(value >= 10) {
+        memcpy(pos - 2, digit_pairs + value * 2, 2);
+    }
+    else {
+        pos[-1] = (char) ('0' + value);
+    }
+    
+    return end;
+}
+
+/**
+ * char *fmt_hex(char *out, unsigned int value)
+ * 
+ * Writes value in lowercase hexadecimal to out (without terminating zero).
+ * Returns position right after the last digit.
+ */
+static char *fmt_hex(char *out, unsigned int value) {
+    int shift = 28;
+    
+    while(shift > 0 && !(value >> shift)) {
+        shift -= 4;
+    }
+    
+    for(; shift >= 0; shift -= 4) {
+        *out++ = "0123456789abcdef"[(value >> shift) & 0xF];
+    }
+    
+    return out;
+}
+
+/**
+ * int msg_new_packet(msg_t *msg)
+ * 
+ * Takes new packet from pool for message, message is written right behind
+ * header room of its buffer. Returns 0 if client's queue is full (client
+ * doesn't ACK fast enough), message is dropped then.
+ */
+static int msg_new_packet(msg_t *msg) {
+    client_t *client = msg->client;
+    packet_t *packet;
+    
+    if(ring_size(&client->dgram_queue) >= DGRAM_QUEUE_SIZE) {
+        LOG_FMT(LOG_WARN,
+                "Outgoing queue of client with index %d is full, dropping message %s",
+                client->client_index,
+                msg_name(msg->opcode)
+                );
+        
+        STAT_ADD(queue_overflows, 1);
+        
+        msg->dropped = 1;
+        
+        return 0;
+    }
+    
+    packet = alloc_packet();
+    
+    /* Set packet's state to new */
+    packet->state = 0;
+    /* Set packet's destination */
+    packet->addr = client->addr;
+    /* Set packet's req ACK flag */
+    packet->req_ack = msg->req_ack;
+    packet->retries = 0;
+    packet->binary = (unsigned short) msg->binary;
+    packet->opcode = (unsigned short) msg->opcode;
+    packet->msg = packet->buffer + PACKET_HEADER_ROOM;
+    packet->len = 0;
+    
+    msg->packet = packet;
+    msg->start = packet->msg;
+    /* Header has to fit the datagram too */
+    msg->end = packet->msg + MAX_COALESCED_LEN;
+    
+    return 1;
+}
+
+/**
+ * int msg_room(msg_t *msg, int len)
+ * 
+ * Checks if len more bytes fit the message. Message appended to queued
+ * datagram which outgrew it is moved to new datagram of its own first.
+ */
+static int msg_room(msg_t *msg, int len) {
+    char *written = msg->start;
+    int written_len = msg->pos - msg->start;
+    
+    if(msg->dropped) {
+        return 0;
+    }
+    
+    if(msg->pos + len <= msg->end) {
+        return 1;
+    }
+    
+    if(msg->queued) {
+        msg->queued = NULL;
+        
+        if(!msg_new_packet(msg)) {
+            return 0;
+        }
+        
+        memcpy(msg->start, written, written_len);
+        msg->pos = msg->start + written_len;
+        
+        if(msg->pos + len <= msg->end) {
+            return 1;
+        }
+    }
+    
+    msg->truncated = 1;
+    
+    return 0;
+}
+
+/**
+ * void msg_write(msg_t *msg, const char *data, int len)
+ * 
+ * Writes raw data to message, truncates it if it doesn't fit.
+ */
+static void msg_write(msg_t *msg, const char *data, int len) {
+    if(!msg_room(msg, len)) {
+        if(msg->dropped) {
+            return;
+        }
+        
+        len = msg->end - msg->pos;
+    }
+    
+    memcpy(msg->pos, data, len);
+    msg->pos += len;
+}
+
+/**
+ * void msg_field(msg_t *msg, unsigned int value, const char *str, int str_len)
+ * 
+ * Writes next field of message's layout in binary protocol, either to the
+ * message itself or to its binary form built in caller's buffer. Fields
+ * past the layout are left out, string which doesn't fit is cut.
+ */
+static void msg_field(msg_t *msg, unsigned int value, const char *str, int str_len) {
+    char layout = *msg->layout;
+    int len;
+    
+    if(!layout || (!msg->binary && !msg->bin_start)) {
+        return;
+    }
+    
+    msg->layout++;
+    
+    /* Byte fields (most of GAME_STATE) don't need the generic path */
+    if(layout == 'b' && msg->binary && msg->pos < msg->end) {
+        *msg->pos++ = (char) value;
+        
+        return;
+    }
+    
+    if(layout == 's' && str_len > 0xFF) {
+        str_len = 0xFF;
+        msg->truncated = 1;
+    }
+    
+    len = field_size(layout, value, str_len);
+    
+    if(!msg->binary) {
+        if(msg->bin_pos + len > msg->bin_end) {
+            msg->truncated = 1;
+            
+            return;
+        }
+        
+        msg->bin_pos = put_field(msg->bin_pos, layout, value, str, str_len);
+        
+        return;
+    }
+    
+    if(!msg_room(msg, len)) {
+        if(msg->dropped || layout != 's' || msg->pos == msg->end) {
+            return;
+        }
+        
+        str_len = msg->end - msg->pos - 1;
+    }
+    
+    msg->pos = put_field(msg->pos, layout, value, str, str_len);
+}
+
+/**
+ * int msg_begin(msg_t *msg, client_t *client, int opcode, int req_ack)
+ * 
+ * Starts message with given opcode for client, its name (or opcode
+ * if client uses binary protocol) is written right away. Message is built
+ * directly in buffer of packet which will be sent, or appended to the last
+ * datagram queued for client if he accepts coalesced messages and datagram
+ * wasn't sent yet. Every started message has to be finished by msg_send.
+ * Returns 0 if message is dropped (client's queue is full).
+ */
+int msg_begin(msg_t *msg, client_t *client, int opcode, int req_ack) {
+    const char *name = msg_name(opcode);
+    packet_t *queued;
+    
+    msg->client = client;
+    msg->packet = NULL;
+    msg->queued = NULL;
+    msg->opcode = opcode;
+    msg->binary = 0;
+    msg->layout = msg_layout(opcode);
+    msg->bin_start = msg->bin_pos = msg->bin_end = NULL;
+    msg->text_len = 0;
+    msg->req_ack = req_ack;
+    msg->truncated = 0;
+    msg->dropped = 0;
+    msg->start = msg->pos = msg->end = NULL;
+    
+    if(client == NULL) {
+        msg->dropped = 1;
+        
+        return 0;
+    }
+    
+    msg->binary = client->binary;
+    
+    /* Append to datagram which wasn't sent yet */
+    if(client->coalesce && ring_size(&client->dgram_queue)) {
+        queued = ring_at(&client->dgram_queue, ring_size(&client->dgram_queue) - 1);
+        
+        if(!queued->state && queued->req_ack == req_ack) {
+            msg->queued = queued;
+            msg->queued_len = queued->len;
+            /* Text separator is written by msg_send, binary messages
+             * just follow each other
+             */
+            msg->start = queued->msg + queued->len + !msg->binary;
+            msg->end = queued->msg + MAX_COALESCED_LEN;
+        }
+    }
+    
+    if(!msg->queued && !msg_new_packet(msg)) {
+        return 0;
+    }
+    
+    msg->pos = msg->start;
+    
+    if(msg->binary) {
+        msg->text_len = strlen(name);
+        
+        if(msg_room(msg, 1)) {
+            *msg->pos++ = (char) opcode;
+        }
+    }
+    else {
+        msg_write(msg, name, strlen(name));
+    }
+    
+    return !msg->dropped;
+}
+
+/**
+ * void msg_begin_buff(msg_t *msg, char *buff, int size, int opcode)
+ * 
+ * Starts message in caller's buffer (message sent to multiple clients).
+ * Message is built in both protocols at once, text form in first half
+ * of buffer and binary form in the second one. It is finished by msg_end.
+ */
+void msg_begin_buff(msg_t *msg, char *buff, int size, int opcode) {
+    const char *name = msg_name(opcode);
+    
+    msg->client = NULL;
+    msg->packet = NULL;
+    msg->queued = NULL;
+    msg->opcode = opcode;
+    msg->binary = 0;
+    msg->layout = msg_layout(opcode);
+    msg->text_len = 0;
+    msg->req_ack = 0;
+    msg->truncated = 0;
+    msg->dropped = 0;
+    msg->start = msg->pos = buff;
+    /* Leave room for terminating zero */
+    msg->end = buff + size / 2 - 1;
+    msg->bin_start = msg->bin_pos = buff + size / 2;
+    msg->bin_end = buff + size;
+    
+    msg_write(msg, name, strlen(name));
+    *msg->bin_pos++ = (char) opcode;
+}
+
+/**
+ * void msg_str(msg_t *msg, const char *str)
+ * 
+ * Appends string argument to message.
+ */
+void msg_str(msg_t *msg, const char *str) {
+    int len = strlen(str);
+    
+    if(msg->binary) {
+        msg->text_len += len + 1;
+    }
+    else {
+        msg_write(msg, ";", 1);
+        msg_write(msg, str, len);
+    }
+    
+    msg_field(msg, 0, str, len);
+}
+
+/**
+ * void msg_uint(msg_t *msg, unsigned int value)
+ * 
+ * Appends unsigned numeric argument to message.
+ */
+void msg_uint(msg_t *msg, unsigned int value) {
+    if(msg->binary) {
+        msg->text_len += uint_len(value) + 1;
+    }
+    else if(msg_room(msg, uint_len(value) + 1)) {
+        *msg->pos++ = ';';
+        msg->pos = fmt_uint(msg->pos, value);
+    }
+    
+    msg_field(msg, value, NULL, 0);
+}
+
+/**
+ * void msg_int(msg_t *msg, int value)
+ * 
+ * Appends signed numeric argument to message, binary protocol carries
+ * it in two's complement.
+ */
+void msg_int(msg_t *msg, int value) {
+    if(value >= 0) {
+        msg_uint(msg, value);
+        
+        return;
+    }
+    
+    if(msg->binary) {
+        msg->text_len += uint_len(- (unsigned int) value) + 2;
+    }
+    else if(msg_room(msg, uint_len(- (unsigned int) value) + 2)) {
+        *msg->pos++ = ';';
+        *msg->pos++ = '-';
+        msg->pos = fmt_uint(msg->pos, - (unsigned int) value);
+    }
+    
+    msg_field(msg, (unsigned int) value, NULL, 0);
+}
+
+/**
+ * void msg_end(msg_t *msg)
+ * 
+ * Finishes message, fields left out are sent as zeros in binary protocol
+ * and text is terminated.
+ */
+void msg_end(msg_t *msg) {
+    while(*msg->layout && (msg->binary || msg->bin_start)) {
+        msg_field(msg, 0, "", 0);
+    }
+    
+    if(!msg->binary) {
+        *msg->pos = 0;
+    }
+    
+    if(msg->truncated) {
+        LOG_LINE(LOG_WARN, "Outgoing message is too long, truncating.");
+    }
+}
 
-/* Logger buffer */
-char log_buffer[LOG_BUFFER_SIZE];
+/**
+ * int msg_send(msg_t *msg)
+ * 
+ * Finishes message started by msg_begin and inserts its datagram to
+ * client's queue. Datagram may or may not need an ACK packet. If client's
+ * send window isn't full, datagram is send immediately without waiting for
+ * sender pass to pick him up. Returns 0 if message was dropped.
+ * 
+ * New datagrams of client accepting coalesced messages are left to sender
+ * pass, so they can collect messages of the whole pass (or for
+ * coalesce_delay_usec).
+ */
+int msg_send(msg_t *msg) {
+    client_t *client = msg->client;
+    int len;
+    
+    if(msg->dropped || client == NULL) {
+        return 0;
+    }
+    
+    msg_end(msg);
+    
+    len = msg->pos - msg->start;
+    
+    LOG_TEXT(LOG_DEBUG,
+            "Enqueueing packet with message: %s",
+            (msg->binary ? msg_name(msg->opcode) : msg->start)
+            );
+    
+    LOG_EVENT(LOG_DEBUG, EV_ENQUEUE, client->client_index, -1, 0,
+            msg->opcode, len, msg->queued != NULL, 0);
+    
+    if(msg->binary) {
+        /* Stats, text message would need separator when coalesced */
+        STAT_ADD(binary_bytes_saved, msg->text_len + (msg->queued != NULL) - len);
+    }
+    
+    if(msg->queued) {
+        /* Join message with the ones already in datagram */
+        if(!msg->binary) {
+            msg->queued->msg[msg->queued_len] = MSG_SEPARATOR;
+        }
+        
+        msg->queued->len = msg->pos - msg->queued->msg;
+        
+        /* Stats */
+        STAT_ADD(coalesced_msgs, 1);
+        
+        return 1;
+    }
+    
+    msg->packet->len = len;
+    
+    /* Add packet to client's dgram queue */
+    ring_push(&client->dgram_queue, msg->packet);
+    
+    if(client->coalesce) {
+        /* Start of hold window */
+        gettimeofday(&msg->packet->timestamp, NULL);
+    }
+    else {
+        /* Send it if window allows */
+        send_queued_packets(client, NULL);
+    }
+    
+    return 1;
+}
+
+/**
+ * int enqueue_dgram(client_t *client, int opcode, int req_ack)
+ * 
+ * Inserts new datagram with message without arguments to given client,
+ * see msg_send. Returns 0 if client's queue is full, datagram is dropped
+ * then.
+ */
+int enqueue_dgram(client_t *client, int opcode, int req_ack) {
+    msg_t out;
+    
+    msg_begin(&out, client, opcode, req_ack);
+    
+    return msg_send(&out);
+}
 
 /**
- * void enqueue_dgram(client_t *client, char *msg, int req_ack)
+ * int enqueue_msg(client_t *client, msg_t *built, int req_ack)
  * 
- * Inserts new datagram with message passed as argument to given client.
- * Datagram may or may not need an ACK packet. If client's outgoing queue
- * is empty, datagram is send immediately without waiting for sender thread
- * to pick him up.
+ * Inserts message built in caller's buffer (and finished by msg_end)
+ * to given client in protocol he uses, see msg_send. Returns 0 if message
+ * was dropped.
  */
-void enqueue_dgram(client_t *client, char *msg, int req_ack) {
-    packet_t *packet;
-    int sent_immediately = 0;
+int enqueue_msg(client_t *client, msg_t *built, int req_ack) {
+    msg_t out;
+    int name_len = strlen(msg_name(built->opcode));
     
-    if(client != NULL) {
-        sprintf(log_buffer,
-                "Enqueueing packet with message: %s",
-                msg
-                );
-        
-        log_line(log_buffer, LOG_DEBUG);
-        
-        packet = (packet_t *) malloc(sizeof(packet_t));
-        
-        /* Set packet's state to new */
-        packet->state = 0;
-        /* Set packet's destination */
-        packet->addr = client->addr;
-        /* Set packet's req ACK flag */
-        packet->req_ack = req_ack;
-        
-        /* Make copy of message */
-        packet->msg = (char *) malloc(strlen(msg) + 1);
-        strcpy(packet->msg, msg);
-                
-        /* Check if outgoing queue is empty, if so, send packet immediately */
-        if(queue_size(client->dgram_queue) == 0) {            
-            send_packet(packet, client);
-            sent_immediately = 1;
-        }
-        
-        if(sent_immediately && !req_ack) {
-            free(packet->msg);
-            free(packet->payload);
-            free(packet);
+    if(msg_begin(&out, client, built->opcode, req_ack)) {
+        /* Arguments follow name (or opcode) */
+        if(out.binary) {
+            msg_write(&out, built->bin_start + 1, built->bin_pos - built->bin_start - 1);
+            out.text_len += built->pos - built->start - name_len;
         }
         else {
-            /* Add packet to client's dgram queue */
-            queue_push(client->dgram_queue, (void *) packet);
+            msg_write(&out, built->start + name_len, built->pos - built->start - name_len);
         }
+        
+        /* All fields are written */
+        out.layout = built->layout;
     }
+    
+    return msg_send(&out);
 }
 
 /*
- * void build_packet_payload(packet_t *pkt)
+ * void build_packet_payload(packet_t *pkt, int ack_id)
  * 
  * Builds packet payload using structure:
  * APP_TOKEN;SEQ_ID;MESSAGE
+ * or, if packet carries ACK of client's packet with ACK_ID (ack_id > 0):
+ * APP_TOKEN;SEQ_ID:ACK_ID;MESSAGE
+ * Header is written right in front of the message in packet's buffer,
+ * packet of binary protocol gets binary header there.
  */
-void build_packet_payload(packet_t *pkt) {
-    char *payload;
-    char seq_id_buff[11];
-    int len;
-
-    sprintf(seq_id_buff, "%u", pkt->seq_id);
-    len = strlen(STRINGIFY(APP_TOKEN)) + strlen(seq_id_buff)
-            + strlen(pkt->msg) + 4;
-
-    payload = (char *) malloc(len);
+void build_packet_payload(packet_t *pkt, int ack_id) {
+    char *pos;
+    int len = APP_TOKEN_LEN + uint_len(pkt->seq_id) + 1;
     
-    sprintf(payload,
-            "%s;%u;%s",
-            STRINGIFY(APP_TOKEN),
-            pkt->seq_id,
-            pkt->msg
-            );
+    if(ack_id > 0) {
+        len += uint_len(ack_id) + 1;
+    }
+    
+    if(pkt->binary) {
+        pkt->payload = put_dgram_header(pkt->msg, pkt->seq_id, ack_id);
+        
+        /* Stats */
+        STAT_ADD(binary_bytes_saved, len - (pkt->msg - pkt->payload));
+        
+        return;
+    }
+    
+    pkt->payload = pkt->msg - len;
+    memcpy(pkt->payload, app_token, APP_TOKEN_LEN);
+    pos = fmt_uint(pkt->payload + APP_TOKEN_LEN, pkt->seq_id);
+    
+    if(ack_id > 0) {
+        *pos++ = ':';
+        pos = fmt_uint(pos, ack_id);
+    }
+    
+    *pos = ';';
+}
 
-    pkt->payload = payload;
+/**
+ * const char *packet_text(packet_t *pkt)
+ * 
+ * Returns packet's payload for logging, name of its (first) message
+ * if packet uses binary protocol.
+ */
+static const char *packet_text(packet_t *pkt) {
+    return (pkt->binary ? msg_name(pkt->opcode) : pkt->payload);
 }
 
 /*
@@ -134,17 +863,39 @@ void build_packet_payload(packet_t *pkt) {
  * Sends packet immediately to destination
  */
 void send_packet(packet_t *pkt, client_t *client) {
+    char addr_str[INET_ADDRSTRLEN];
+    int len;
+    
     if(!pkt->state) {
+        /* ACK keeps going out in front of data, before data packet takes
+         * its SEQ_ID, so headers of both stay in order
+         */
+        if(!client->piggyback_acks) {
+            send_pending_ack(client);
+        }
+        
         pkt->seq_id = client->pkt_send_seq_id;
+        
+        /* If packet will be ACKd, increment send id */
+        if(pkt->req_ack) {
+            client->pkt_send_seq_id++;
+        }
+        
+        /* Held ACK rides in header of packet */
+        if(client->ack_pending) {
+            build_packet_payload(pkt, client->ack_pending);
+            
+            client->ack_pending = 0;
+            
+            /* Stats */
+            STAT_ADD(acks_piggybacked, 1);
+        }
+        else {
+            build_packet_payload(pkt, 0);
+        }
     }
-    
-    /* If packet will be ACKd, increment send id */
-    if(!pkt->state && pkt->req_ack) {
-        client->pkt_send_seq_id++;
-    }
-    
-    if(!pkt->state) {
-        build_packet_payload(pkt);
+    else {
+        pkt->retries++;
     }
     
     /* Mark packet as waiting for ACK */
@@ -152,69 +903,141 @@ void send_packet(packet_t *pkt, client_t *client) {
     /* Set packet timestamp */
     gettimeofday(&pkt->timestamp, NULL);
     
-    sendto(server_sockfd, pkt->payload, strlen(pkt->payload), 0, (struct sockaddr*) pkt->addr, sizeof(*pkt->addr));
+    len = (pkt->msg - pkt->payload) + pkt->len;
     
-    sprintf(log_buffer,
-            "DATA_OUT: %s ---> %s:%d",
-            pkt->payload,
-	    client->addr_str,
-	    htons(client->addr->sin_port)
-            );
+    recorder_add(&client->recorder, RECORDER_OUT, pkt->seq_id, pkt->payload, len, &pkt->timestamp);
     
-    log_line(log_buffer, LOG_DEBUG);
+    send_dgram(pkt->payload, len, pkt->addr);
     
-    /* Stats */
-    sent_bytes += strlen(pkt->payload);
-    sent_dgrams++;
+    if(pkt->binary) {
+        /* Stats */
+        STAT_ADD(binary_dgrams_out, 1);
+    }
+    
+    if(LOG_TEXT_ENABLED(LOG_DEBUG)) {
+        inet_ntop(AF_INET, &client->addr->sin_addr, addr_str, INET_ADDRSTRLEN);
+        
+        LOG_FMT(LOG_DEBUG,
+                "DATA_OUT: %s ---> %s:%d",
+                packet_text(pkt),
+                addr_str,
+                htons(client->addr->sin_port)
+                );
+    }
+    
+    LOG_EVENT(LOG_DEBUG, EV_DATA_OUT, client->client_index, -1, pkt->seq_id,
+            pkt->opcode, len, client->addr->sin_addr.s_addr, ntohs(client->addr->sin_port));
 }
 
 /**
- * int packet_timestamp_old(packet_t pkt, int *wait)
+ * int packet_timestamp_old(packet_t *pkt, int rto_usec, int *wait)
  * 
- * Checks if timestamp of given packet is older than maximum allowed time
- * for packet marked as sent and requiring ACK before timeout. 
+ * Checks if packet marked as sent and requiring ACK waits for ACK longer
+ * than given retransmission timeout.
  * 
  * If packet isn't timeouted yet and wait isn't NULL, compares value of wait
- * and current timeout. If current timeout is lower than wait, updates wait.
+ * and current timeout. If current timeout is lower than wait or wait is
+ * negative (no timeout known yet), updates wait.
  */
-int packet_timestamp_old(packet_t pkt, int *wait) {
-    int cur_wait = 0;
+int packet_timestamp_old(packet_t *pkt, int rto_usec, int *wait) {
+    long cur_wait;
     struct timeval cur_tv;
     gettimeofday(&cur_tv, NULL);
 
-    /* Longer than second */
-    if(cur_tv.tv_sec - pkt.timestamp.tv_sec >= 1) {
-        sprintf(log_buffer,
-                "Packet with payload %s timeouted",
-                pkt.payload
-                );
-        
-        log_line(log_buffer, LOG_DEBUG);
-        
-        return 1;
-    }
-
-    cur_wait = MAX_PACKET_AGE_USEC - (cur_tv.tv_usec - pkt.timestamp.tv_usec);
+    cur_wait = rto_usec - ((cur_tv.tv_sec - pkt->timestamp.tv_sec) * 1000000L
+            + (cur_tv.tv_usec - pkt->timestamp.tv_usec));
 
     /* If current difference is smaller */
-    if(cur_wait > 0 && cur_wait < (*wait)) {
-        (*wait) = cur_wait;
+    if(wait && cur_wait > 0 && ((*wait) < 0 || cur_wait < (*wait))) {
+        (*wait) = (int) cur_wait;
     }
     
     /* Debug */
     if(cur_wait <= 0) {
-        sprintf(log_buffer,
+        LOG_TEXT(LOG_DEBUG,
                 "Packet with payload %s and SEQ_ID %d timeouted",
-                pkt.payload,
-                pkt.seq_id
+                packet_text(pkt),
+                pkt->seq_id
                 );
         
-        log_line(log_buffer, LOG_DEBUG);
+        LOG_EVENT(LOG_DEBUG, EV_TIMEOUT, -1, -1, pkt->seq_id,
+                pkt->opcode, pkt->retries, 0, 0);
     }
 
     return (cur_wait <= 0);
 }
 
+/**
+ * void update_client_rtt(client_t *client, packet_t *pkt)
+ * 
+ * Takes RTT sample from just ACKd packet and updates client's smoothed RTT,
+ * RTT variance and retransmission timeout (Jacobson/Karels). Following
+ * Karn's rule, retransmitted packets are ignored since it's unknown which
+ * transmission the ACK belongs to.
+ */
+void update_client_rtt(client_t *client, packet_t *pkt) {
+    struct timeval cur_tv;
+    long rtt;
+    long rto;
+    
+    if(pkt->retries) {
+        return;
+    }
+    
+    gettimeofday(&cur_tv, NULL);
+    
+    rtt = (cur_tv.tv_sec - pkt->timestamp.tv_sec) * 1000000L
+            + (cur_tv.tv_usec - pkt->timestamp.tv_usec);
+    
+    if(rtt < 0) {
+        return;
+    }
+    
+    /* First sample */
+    if(client->srtt_usec == 0) {
+        client->srtt_usec = rtt > 0 ? (int) rtt : 1;
+        client->rttvar_usec = (int) (rtt / 2);
+    }
+    else {
+        /* RTTVAR = 3/4 RTTVAR + 1/4 |SRTT - RTT|, SRTT = 7/8 SRTT + 1/8 RTT */
+        client->rttvar_usec += (int) ((labs(client->srtt_usec - rtt) - client->rttvar_usec) / 4);
+        client->srtt_usec += (int) ((rtt - client->srtt_usec) / 8);
+        
+        if(client->srtt_usec <= 0) {
+            client->srtt_usec = 1;
+        }
+    }
+    
+    rto = client->srtt_usec + 4L * client->rttvar_usec;
+    
+    if(rto < MIN_RTO_USEC) {
+        rto = MIN_RTO_USEC;
+    }
+    else if(rto > MAX_RTO_USEC) {
+        rto = MAX_RTO_USEC;
+    }
+    
+    client->rto_usec = (int) rto;
+}
+
+/**
+ * int coalesce_hold_wait(packet_t *pkt)
+ * 
+ * Returns number of microseconds new packet can still wait for more
+ * coalesced messages, 0 if it should be sent now.
+ */
+int coalesce_hold_wait(packet_t *pkt) {
+    struct timeval cur_tv;
+    long wait;
+    
+    gettimeofday(&cur_tv, NULL);
+    
+    wait = coalesce_delay_usec - ((cur_tv.tv_sec - pkt->timestamp.tv_sec) * 1000000L
+            + (cur_tv.tv_usec - pkt->timestamp.tv_usec));
+    
+    return (wait > 0 ? (int) wait : 0);
+}
+
 /**
  * int client_timestamp_timeout(client_t *client)
  * 
@@ -235,54 +1058,204 @@ int client_timestamp_remove(client_t *client) {
     return ( ( cur_tv.tv_sec - (client)->timestamp.tv_sec > MAX_CLIENT_TIMEOUT_SEC ) );
 }
 
+/**
+ * int client_timestamp_wait(client_t *client)
+ * 
+ * Returns number of microseconds before client_timestamp_timeout (active
+ * client) or client_timestamp_remove (inactive client) becomes true.
+ */
+int client_timestamp_wait(client_t *client) {
+    struct timeval cur_tv;
+    int max_sec = client->state ? MAX_CLIENT_NORESPONSE_SEC : MAX_CLIENT_TIMEOUT_SEC;
+    long wait;
+    
+    gettimeofday(&cur_tv, NULL);
+    
+    wait = (client->timestamp.tv_sec + max_sec + 1 - cur_tv.tv_sec) * 1000000L
+            - cur_tv.tv_usec;
+    
+    return (wait > 0 ? (int) wait : 0);
+}
 
 /**
- * void send_ack(client_t *client, int seq_id, int resend)
+ * void send_queued_packets(client_t *client, int *wait)
  * 
- * Sends ACK packet to client. If resend is 0, increases client's
- * RECV_SEQ_ID
+ * Walks client's send window (first send_window packets requiring ACK
+ * in his queue) and sends packets which are new or waited for ACK for too
+ * long (client's retransmission timeout, doubled after every pass
+ * which resent something). Packets already selectively ACKd by client are
+ * never resent. Last new datagram of client accepting coalesced messages
+ * waits until its hold window passes.
+ * Packets not requiring ACK are sent once and removed as soon as
+ * they get to the front of the queue. If wait isn't NULL, it is lowered
+ * to time before the earliest waiting packet timeouts.
  */
-void send_ack(client_t *client, int seq_id, int resend) {
-    char *buff;
-    int len;
+void send_queued_packets(client_t *client, int *wait) {
+    packet_t *packet;
+    /* Packets requiring ACK within window */
+    unsigned int in_flight = 0;
+    /* Some packet was resent */
+    int resent = 0;
+    /* Time before datagram collecting messages is sent */
+    int hold;
+    unsigned int i;
     
-    if(client != NULL) {
-        buff = (char *) malloc(11);
+    for(i = 0; i < ring_size(&client->dgram_queue) && in_flight < client->send_window; i++) {
+        packet = ring_at(&client->dgram_queue, i);
         
-        sprintf(buff, "%d", seq_id);
-        len = strlen(buff);
-        sprintf(buff, "%d", client->pkt_send_seq_id);
-        len += strlen(buff);
+        /* Last new datagram may still collect coalesced messages */
+        if(packet->state == 0 && client->coalesce &&
+                i == ring_size(&client->dgram_queue) - 1 && (hold = coalesce_hold_wait(packet)) > 0) {
+            
+            if(wait && ((*wait) < 0 || hold < (*wait))) {
+                (*wait) = hold;
+            }
+            
+            break;
+        }
         
-        free(buff);
+        if(!packet->req_ack) {
+            if(packet->state == 0) {
+                send_packet(packet, client);
+            }
+            
+            continue;
+        }
         
+        /* Send new packet */
+        if(packet->state == 0) {
+            send_packet(packet, client);
+        }
+        /* Resend packet which is timeouted, back off once per pass */
+        else if(packet->state == 1 && packet_timestamp_old(packet, client->rto_usec, NULL)) {
+            if(!resent) {
+                client->rto_usec = client->rto_usec * 2 > MAX_RTO_USEC ?
+                        MAX_RTO_USEC : client->rto_usec * 2;
+                
+                resent = 1;
+            }
+            
+            send_packet(packet, client);
+        }
         
-        buff = (char *) malloc((7 + len + strlen(STRINGIFY(APP_TOKEN))));
+        /* Remember when the waiting packet timeouts */
+        if(packet->state == 1) {
+            packet_timestamp_old(packet, client->rto_usec, wait);
+        }
         
-        sprintf(buff,
-                "%s;%d;ACK;%d",
-                STRINGIFY(APP_TOKEN),
-                client->pkt_send_seq_id,
-                seq_id
-                );
+        in_flight++;
+    }
+    
+    /* Sent packets which don't need ACK */
+    while((packet = ring_front(&client->dgram_queue)) != NULL && packet->state && !packet->req_ack) {
+        ring_pop(&client->dgram_queue);
+        
+        free_packet(packet);
+    }
+}
+
+/**
+ * void send_ack_dgram(client_t *client, int seq_id)
+ * 
+ * Sends standalone ACK packet to client. Packets held in client's reorder
+ * buffer are acknowledged by SACK bitmap (ACK;SEQ_ID;BITMAP).
+ */
+static void send_ack_dgram(client_t *client, int seq_id) {
+    char buff[PACKET_HEADER_ROOM + 32];
+    char addr_str[INET_ADDRSTRLEN];
+    /* Packets held in reorder buffer */
+    unsigned int sack_bits = reorder_sack_bits(client, seq_id);
+    
+    char *start = buff;
+    char *pos;
+    
+    if(client->binary) {
+        /* Header is written in front of message, bitmap is always sent */
+        pos = buff + PACKET_HEADER_ROOM;
+        *pos++ = (char) MSG_ACK;
+        pos = put_field(pos, 'v', seq_id, NULL, 0);
+        pos = put_field(pos, 'x', sack_bits, NULL, 0);
+        start = put_dgram_header(buff + PACKET_HEADER_ROOM, client->pkt_send_seq_id, 0);
+        
+        /* Stats */
+        STAT_ADD(binary_dgrams_out, 1);
+    }
+    else {
+        memcpy(buff, app_token, APP_TOKEN_LEN);
+        pos = fmt_uint(buff + APP_TOKEN_LEN, client->pkt_send_seq_id);
+        memcpy(pos, ";ACK;", 5);
+        pos = fmt_uint(pos + 5, seq_id);
+        
+        /* Selectively ACK them, client doesn't have to resend them */
+        if(sack_bits) {
+            *pos++ = ';';
+            pos = fmt_hex(pos, sack_bits);
+        }
         
-        sendto(
-                server_sockfd,
-                buff,
-                strlen(buff),
-                0,
-                (struct sockaddr *) client->addr,
-                sizeof(*client->addr)
-        );
+        *pos = 0;
+    }
+    
+    recorder_add(&client->recorder, RECORDER_OUT, client->pkt_send_seq_id, start, pos - start, NULL);
+    
+    send_dgram(start, pos - start, client->addr);
+    
+    if(LOG_TEXT_ENABLED(LOG_DEBUG)) {
+        inet_ntop(AF_INET, &client->addr->sin_addr, addr_str, INET_ADDRSTRLEN);
         
-        sprintf(log_buffer,
+        LOG_FMT(LOG_DEBUG,
                 "DATA_OUT: %s ---> %s:%d",
-                buff,
-		client->addr_str,
-		htons(client->addr->sin_port)
+                (client->binary ? "ACK" : buff),
+                addr_str,
+                htons(client->addr->sin_port)
                 );
-        
-        log_line(log_buffer, LOG_DEBUG);
+    }
+    
+    LOG_EVENT(LOG_DEBUG, EV_ACK_OUT, client->client_index, -1, client->pkt_send_seq_id,
+            seq_id, sack_bits, client->addr->sin_addr.s_addr, ntohs(client->addr->sin_port));
+}
+
+/**
+ * int hold_ack(client_t *client, int seq_id)
+ * 
+ * Holds ACK in client's record, it is sent by sender pass once it waited
+ * for ack_delay_usec, unless packet sent to client meanwhile carries it.
+ * ACKs held together are merged into one cumulative ACK. Returns 0 if ACK
+ * can't be held (calling thread isn't collecting datagrams in send batch).
+ */
+static int hold_ack(client_t *client, int seq_id) {
+    if(!send_batch.depth) {
+        return 0;
+    }
+    
+    if(client->ack_pending) {
+        /* Stats */
+        STAT_ADD(acks_coalesced, 1);
+    }
+    else {
+        gettimeofday(&client->ack_timestamp, NULL);
+    }
+    
+    /* ACKs are cumulative, newest one covers the held one */
+    if(seq_id > client->ack_pending) {
+        client->ack_pending = seq_id;
+    }
+    
+    return 1;
+}
+
+/**
+ * void send_ack(client_t *client, int seq_id, int resend)
+ * 
+ * ACKs client's packet. ACK is held and sent together with ACKs of
+ * following client's packets, or carried by packet sent to client if
+ * he accepts piggybacked ACKs. If resend is 0, increases client's
+ * RECV_SEQ_ID
+ */
+void send_ack(client_t *client, int seq_id, int resend) {
+    if(client != NULL) {
+        if(!hold_ack(client, seq_id)) {
+            send_ack_dgram(client, seq_id);
+        }
         
         if(!resend) {
             client->pkt_recv_seq_id++;
@@ -290,176 +1263,226 @@ void send_ack(client_t *client, int seq_id, int resend) {
         
         /* Update client's timestamp */
         update_client_timestamp(client);
-        
-        /* Stats */
-        sent_bytes += strlen(buff);
-        sent_dgrams++;
-        
-        free(buff);
     }
 }
 
+/**
+ * void send_dup_ack(client_t *client)
+ * 
+ * Sends duplicate ACK of the last packet client sent in order right away,
+ * its SACK bitmap tells client which packets are held and which are
+ * missing. It isn't held like other ACKs, it has to get to client even if
+ * the very first packet is missing (duplicate ACK of SEQ_ID 0). ACK held
+ * for client is covered by it.
+ */
+void send_dup_ack(client_t *client) {
+    send_ack_dgram(client, client->pkt_recv_seq_id - 1);
+    
+    client->ack_pending = 0;
+    
+    /* Update client's timestamp */
+    update_client_timestamp(client);
+}
+
+/**
+ * int pending_ack_wait(client_t *client)
+ * 
+ * Returns number of microseconds before ACK held for client has to be sent,
+ * 0 if it should be sent now.
+ */
+int pending_ack_wait(client_t *client) {
+    struct timeval cur_tv;
+    long wait;
+    
+    gettimeofday(&cur_tv, NULL);
+    
+    wait = ack_delay_usec - ((cur_tv.tv_sec - client->ack_timestamp.tv_sec) * 1000000L
+            + (cur_tv.tv_usec - client->ack_timestamp.tv_usec));
+    
+    return (wait > 0 ? (int) wait : 0);
+}
+
+/**
+ * void send_pending_ack(client_t *client)
+ * 
+ * Sends ACK held for client as standalone packet, if there is any.
+ */
+void send_pending_ack(client_t *client) {
+    if(client->ack_pending) {
+        send_ack_dgram(client, client->ack_pending);
+        
+        client->ack_pending = 0;
+    }
+}
 
 /**
- * void recv_ack(client_t *client, int seq_id)
+ * void recv_ack(client_t *client, int seq_id, unsigned int sack_bits)
  * 
- * Processes incoming ACK packet. Checks if client's packet at front of
- * his outgoing queue has matching SEQ_ID, if so, removes packet from queue and
- * checks if there are any more packets waiting. If there are, notifies the
- * sender thread to wake up.
+ * Processes incoming ACK packet. ACKs are cumulative, all sent packets at
+ * front of client's outgoing queue with SEQ_ID up to the given one are
+ * removed. Bit i of sack_bits selectively acknowledges packet with SEQ_ID
+ * seq_id + 1 + i, such packet is marked and won't be resent, only the gaps
+ * in front of it are. Window moves forward, so following packets are sent
+ * right away, their timeout is planned by following sender pass.
  */
-void recv_ack(client_t *client, int seq_id) {
+void recv_ack(client_t *client, int seq_id, unsigned int sack_bits) {
     packet_t *packet;
+    int acked = 0;
+    unsigned int i;
+    unsigned int bit;
     
     if(client != NULL) {
-        if(queue_size(client->dgram_queue) > 0) {
-            packet = queue_front(client->dgram_queue);
+        /* Mark selectively ACKd packets */
+        for(i = 0; sack_bits && i < ring_size(&client->dgram_queue); i++) {
+            packet = ring_at(&client->dgram_queue, i);
+            
+            if(packet->state != 1 || !packet->req_ack || packet->seq_id <= seq_id) {
+                continue;
+            }
+            
+            bit = (unsigned int) (packet->seq_id - seq_id - 1);
             
-            if(packet->seq_id == seq_id) {            
+            if(bit < SACK_BITMAP_BITS && (sack_bits & (1U << bit))) {
                 /* Log */
-                sprintf(log_buffer,
-                        "ACK waiting packet with payload %s and SEQ_ID %d",
-                        packet->payload,
+                LOG_TEXT(LOG_DEBUG,
+                        "SACK waiting packet with payload %s and SEQ_ID %d",
+                        packet_text(packet),
                         packet->seq_id
                         );
                 
-                log_line(log_buffer, LOG_DEBUG);
+                LOG_EVENT(LOG_DEBUG, EV_ACKED, client->client_index, -1, packet->seq_id,
+                        packet->opcode, 1, 0, 0);
                 
-                queue_pop(client->dgram_queue, 0);
-                
-                free(packet->payload);
-                free(packet->msg);
-                free(packet);
-                
-                /* If client has any more queued packets, signal
-                 * sender thread
-                 */
-                if(queue_size(client->dgram_queue) > 0) {
-                    pthread_cond_signal(&cond_packet_change);
-                }
+                packet->state = 2;
+            }
+        }
+        
+        while((packet = ring_front(&client->dgram_queue)) != NULL && packet->state &&
+                (!packet->req_ack || packet->seq_id <= seq_id || packet->state == 2)) {
+            
+            /* Packet which the ACK was sent for gives RTT sample */
+            if(packet->req_ack && packet->seq_id == seq_id) {
+                update_client_rtt(client, packet);
+            }
+            
+            /* Log */
+            LOG_TEXT(LOG_DEBUG,
+                    "ACK waiting packet with payload %s and SEQ_ID %d",
+                    packet_text(packet),
+                    packet->seq_id
+                    );
+            
+            if(packet->state != 2) {
+                LOG_EVENT(LOG_DEBUG, EV_ACKED, client->client_index, -1, packet->seq_id,
+                        packet->opcode, 0, 0, 0);
             }
+            
+            ring_pop(&client->dgram_queue);
+            
+            free_packet(packet);
+            
+            acked = 1;
+        }
+        
+        /* If client has any more queued packets, send them */
+        if(acked && ring_size(&client->dgram_queue) > 0) {
+            send_queued_packets(client, NULL);
         }
     }
 }
 
 /**
- * void inform_server_full(struct sockaddr_in *addr)
+ * void inform_server_full(struct sockaddr_in *addr, int binary)
  * 
  * Notifies client with given address that server is currently full.
  */
-void inform_server_full(struct sockaddr_in *addr) {
-    char *buff = (char *) malloc(strlen(STRINGIFY(APP_TOKEN)) + 15);
+void inform_server_full(struct sockaddr_in *addr, int binary) {
+    static char full[] = STRINGIFY(APP_TOKEN) ";1;SERVER_FULL";
+    static char ack[] = STRINGIFY(APP_TOKEN) ";1;ACK;1";
     char addr_str[INET_ADDRSTRLEN];
-
-    inet_ntop(AF_INET, &addr->sin_addr, addr_str, INET_ADDRSTRLEN);
-    
-    sprintf(buff,
-            "%s;1;SERVER_FULL",
-            STRINGIFY(APP_TOKEN)
-            );
-    
-    sendto(
-            server_sockfd,
-            buff,
-            strlen(buff),
-            0,
-            (struct sockaddr *) addr,
-            sizeof(*addr)
-    );
     
-    /* Log */
-    sprintf(log_buffer,
-            "DATA_OUT: %s ---> %s:%d",
-            buff,
-	    addr_str,
-	    htons(addr->sin_port)
-            );
-    
-    log_line(log_buffer, LOG_DEBUG);
-    
-    /* Stats */
-    sent_bytes += strlen(buff);
-    sent_dgrams++;
-    
-    sprintf(buff,
-            "%s;1;ACK;1",
-            STRINGIFY(APP_TOKEN)
-            );
-    
-    sendto(
-            server_sockfd,
-            buff,
-            strlen(buff),
-            0,
-            (struct sockaddr *) addr,
-            sizeof(*addr)
-    );
+    send_client_dgram(full, sizeof(full) - 1, addr, binary);
+    send_client_dgram(ack, sizeof(ack) - 1, addr, binary);
     
     /* Log */
-    sprintf(log_buffer, 
-            "DATA_OUT: %s ---> %s:%d",
-            buff,
-            addr_str,
-	    htons(addr->sin_port)
-            );
-    
-    log_line(log_buffer, LOG_DEBUG);
-    
-    /* Stats */
-    sent_bytes += strlen(buff);
-    sent_dgrams++;
+    if(LOG_TEXT_ENABLED(LOG_DEBUG)) {
+        inet_ntop(AF_INET, &addr->sin_addr, addr_str, INET_ADDRSTRLEN);
+        
+        LOG_FMT(LOG_DEBUG,
+                "DATA_OUT: %s ---> %s:%d",
+                full,
+                addr_str,
+                htons(addr->sin_port)
+                );
+        
+        LOG_FMT(LOG_DEBUG,
+                "DATA_OUT: %s ---> %s:%d",
+                ack,
+                addr_str,
+                htons(addr->sin_port)
+                );
+    }
     
-    free(buff);
+    LOG_EVENT(LOG_DEBUG, EV_SERVER_FULL, -1, -1, 1, 0, 0, addr->sin_addr.s_addr, ntohs(addr->sin_port));
 }
 
 /**
  * void broadcast_clients(char *msg)
  * 
- * Sends message to all connected clients
+ * Sends message to all clients of current shard
  */
 void broadcast_clients(char *msg, int req_ack) {
     int i = 0;
     client_t *client;
-    char *buff = (char *) malloc(strlen(msg) + strlen(STRINGIFY(APP_TOKEN)) + 13);
+    char addr_str[INET_ADDRSTRLEN];
+    char buff[PACKET_HEADER_ROOM + MAX_DGRAM_SIZE + 1];
+    char *pos;
+    int len = strlen(msg);
+    
+    if(len > MAX_COALESCED_LEN) {
+        len = MAX_COALESCED_LEN;
+    }
+    
+    /* Header starts the same for all clients */
+    memcpy(buff, app_token, APP_TOKEN_LEN);
+    
+    /* Send to all clients at once */
+    begin_send_batch();
     
-    for(i = 0; i < MAX_CONCURRENT_CLIENTS; i++) {
+    for(i = 0; i < cur_shard->clients.capacity; i++) {
         client = get_client_by_index(i);
         
         if(client) {
-            sprintf(buff,
-                    "%s;%d;%s",
-                    STRINGIFY(APP_TOKEN),
-                    client->pkt_send_seq_id,
-                    msg
-                    );
+            pos = fmt_uint(buff + APP_TOKEN_LEN, client->pkt_send_seq_id);
+            *pos++ = ';';
+            memcpy(pos, msg, len);
+            pos += len;
+            *pos = 0;
+            
+            recorder_add(&client->recorder, RECORDER_OUT, client->pkt_send_seq_id, buff, pos - buff, NULL);
 
 	    if(req_ack) {
 		client->pkt_send_seq_id++;
             }
             
-            sendto(
-                    server_sockfd,
-                    buff,
-                    strlen(buff),
-                    0,
-                    (struct sockaddr *) client->addr,
-                    sizeof(*(client->addr))
-            );
+            send_client_dgram(buff, pos - buff, client->addr, client->binary);
             
             /* Log */
-            sprintf(log_buffer,
-                    "DATA_OUT: %s ---> %s:%d",
-                    buff,
-		    client->addr_str,
-		    htons(client->addr->sin_port)
-                    );
-            
-            log_line(log_buffer, LOG_DEBUG);
+            if(LOG_TEXT_ENABLED(LOG_DEBUG)) {
+                inet_ntop(AF_INET, &client->addr->sin_addr, addr_str, INET_ADDRSTRLEN);
+                
+                LOG_FMT(LOG_DEBUG,
+                        "DATA_OUT: %s ---> %s:%d",
+                        buff,
+                        addr_str,
+                        htons(client->addr->sin_port)
+                        );
+            }
             
-            /* Release client */
-            release_client(client);
+            LOG_EVENT(LOG_DEBUG, EV_DATA_OUT, client->client_index, -1, client->pkt_send_seq_id - (req_ack != 0),
+                    msg_opcode(msg), pos - buff, client->addr->sin_addr.s_addr, ntohs(client->addr->sin_port));
         }
     }
     
-    free(buff);
+    flush_send_batch();
 }
@@ -39,36 +39,143 @@ extern unsigned int recv_bytes;
 extern unsigned int recv_dgrams;
 /* Number of client connections (total) */
 extern unsigned int num_connections;
+/* Number of sending calls (sendto/sendmmsg) */
+extern unsigned int send_calls;
+/* Number of datagrams dropped because client's queue was full */
+extern unsigned int queue_overflows;
+/* Number of ACKs covered by later cumulative ACK */
+extern unsigned int acks_coalesced;
+/* Number of ACKs carried in header of data packet */
+extern unsigned int acks_piggybacked;
+/* Number of client packets held until packets in front of them arrived */
+extern unsigned int reorder_buffered;
+/* Number of client packets ahead of expected one which couldn't be held */
+extern unsigned int reorder_dropped;
 
-typedef struct {
+/* Number of messages appended to datagram of previous message */
+extern unsigned int coalesced_msgs;
+/* Number of received datagrams of binary protocol */
+extern unsigned int binary_dgrams_in;
+/* Number of sent datagrams of binary protocol */
+extern unsigned int binary_dgrams_out;
+/* Number of bytes saved by sending binary datagrams instead of text (ACKs aside) */
+extern unsigned int binary_bytes_saved;
+
+/* Maximum time ACK is held waiting for more packets (microseconds) */
+extern unsigned int ack_delay_usec;
+/* Maximum time new datagram waits for more messages (microseconds) */
+extern unsigned int coalesce_delay_usec;
+
+/* Room in front of message for payload header (APP_TOKEN;SEQ_ID[:ACK_ID];) */
+#define PACKET_HEADER_ROOM 40
+/* Separator of messages coalesced into one datagram */
+#define MSG_SEPARATOR '\n'
+/* Maximum length of coalesced messages, whole datagram fits MAX_DGRAM_SIZE */
+#define MAX_COALESCED_LEN (MAX_DGRAM_SIZE - PACKET_HEADER_ROOM)
+/* Size of caller's buffer for message sent to multiple clients (text form
+ * followed by binary form)
+ */
+#define MSG_BUFF_SIZE (2 * (MAX_COALESCED_LEN + 1))
+
+typedef struct packet {
     /* Packet sequential ID */
     int seq_id;
-    /* Packet's payload */
+    /* Packet's payload (header written in front of message in buffer) */
     char *payload;
-    /* Raw message */
+    /* Raw message (in buffer) */
     char *msg;
+    /* Length of message(s) */
+    int len;
     /* Destination address */
     struct sockaddr_in *addr;
-    /* Last communication timestamp */
+    /* Last communication timestamp (enqueue time of new packet) */
     struct timeval timestamp;
-    /* State - 0 new, 1 waiting for ACK */
+    /* State - 0 new, 1 waiting for ACK, 2 selectively ACKd */
     unsigned short state;
     /* Flag indicating if packet requires ACK */
     unsigned short req_ack;
+    /* Number of retransmissions */
+    unsigned short retries;
+    /* Flag indicating if packet uses binary protocol */
+    unsigned short binary;
+    /* Opcode of (first) message */
+    unsigned short opcode;
+    
+    /* Next free packet in pool */
+    struct packet *next;
+    /* Header room followed by message */
+    char buffer[PACKET_HEADER_ROOM + MAX_DGRAM_SIZE + 1];
     
 } packet_t;
 
+/* Outgoing message written directly into its packet (or caller's buffer) */
+typedef struct {
+    /* Client message is sent to, NULL if built in caller's buffer */
+    client_t *client;
+    /* New packet holding message */
+    packet_t *packet;
+    /* Queued datagram message is appended to, NULL if it has its own */
+    packet_t *queued;
+    /* Length of queued datagram's messages before appending */
+    int queued_len;
+    /* Start of message */
+    char *start;
+    /* Current write position */
+    char *pos;
+    /* End of room for message */
+    char *end;
+    /* Opcode of message */
+    int opcode;
+    /* Message is written in binary protocol */
+    int binary;
+    /* Layout of fields which weren't written yet */
+    const char *layout;
+    /* Binary form of message built in caller's buffer, NULL otherwise */
+    char *bin_start;
+    /* Current write position of binary form */
+    char *bin_pos;
+    /* End of room for binary form */
+    char *bin_end;
+    /* Length message would have in text protocol (binary protocol only) */
+    int text_len;
+    /* Message requires ACK */
+    int req_ack;
+    /* Message didn't fit and was truncated */
+    int truncated;
+    /* Message was dropped (client's queue is full) */
+    int dropped;
+} msg_t;
+
 /* Function prototypes */
-void enqueue_dgram(client_t *client, char *msg, int req_ack);
-void build_packet_payload(packet_t *pkt);
+void begin_send_batch();
+void flush_send_batch();
+void send_dgram(char *buff, int len, struct sockaddr_in *addr);
+void send_client_dgram(char *buff, int len, struct sockaddr_in *addr, int binary);
+int msg_begin(msg_t *msg, client_t *client, int opcode, int req_ack);
+void msg_begin_buff(msg_t *msg, char *buff, int size, int opcode);
+void msg_str(msg_t *msg, const char *str);
+void msg_uint(msg_t *msg, unsigned int value);
+void msg_int(msg_t *msg, int value);
+void msg_end(msg_t *msg);
+int msg_send(msg_t *msg);
+int enqueue_dgram(client_t *client, int opcode, int req_ack);
+int enqueue_msg(client_t *client, msg_t *built, int req_ack);
+void build_packet_payload(packet_t *pkt, int ack_id);
 void send_packet(packet_t *pkt, client_t *client);
-int packet_timestamp_old(packet_t pkt, int *wait);
+int packet_timestamp_old(packet_t *pkt, int rto_usec, int *wait);
+int coalesce_hold_wait(packet_t *pkt);
+void update_client_rtt(client_t *client, packet_t *pkt);
 int client_timestamp_timeout(client_t *client);
 int client_timestamp_remove(client_t *client);
+int client_timestamp_wait(client_t *client);
+void send_queued_packets(client_t *client, int *wait);
 void send_ack(client_t *client, int seq_id, int resend);
-void recv_ack(client_t *client, int seq_id);
-void inform_server_full(struct sockaddr_in *addr);
-void broadcast_clients(char *msg, int oeq_ack);
+void send_dup_ack(client_t *client);
+int pending_ack_wait(client_t *client);
+void send_pending_ack(client_t *client);
+void recv_ack(client_t *client, int seq_id, unsigned int sack_bits);
+void inform_server_full(struct sockaddr_in *addr, int binary);
+void broadcast_clients(char *msg, int req_ack);
 
 #endif	/* COM_H */
 
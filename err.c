@@ -37,5 +37,8 @@ void raise_error(char *msg) {
         fprintf(stderr, "Error: %s\n", msg);
     }
     
+    /* Write out what logger thread didn't write yet */
+    stop_logger();
+    
     exit(EXIT_FAILURE);
 }
@@ -0,0 +1,187 @@
+/** 
+ * -----------------------------------------------------------------------------
+ * Clovece nezlob se (Server) - simple board game
+ * 
+ * Server for board game Clovece nezlob se using UDP datagrams for communication
+ * with clients and SEND-AND-WAIT method to ensure that all packets arrive
+ * and that they arrive in correct order. 
+ * 
+ * Semestral work for "Uvod do pocitacovich siti" KIV/UPS at
+ * University of West Bohemia.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * File: event.c
+ * Description: Event loop helpers (epoll, eventfd and timerfd) used by
+ *              server threads to sleep until there is something to do.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * @author: Martin Kucera, 2014
+ * @version: 1.02
+ * 
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#include "err.h"
+#include "event.h"
+
+/* Signalled once when server is shutting down, never cleared */
+int shutdown_event = -1;
+
+/**
+ * void init_events()
+ * 
+ * Creates eventfds shared by server threads. Has to be called before any
+ * thread is started.
+ */
+void init_events() {
+    shutdown_event = create_event();
+}
+
+/**
+ * void close_events()
+ * 
+ * Closes eventfds shared by server threads, after all threads finished.
+ */
+void close_events() {
+    close(shutdown_event);
+}
+
+/**
+ * int create_event()
+ * 
+ * Creates non-blocking eventfd used to wake up a thread.
+ */
+int create_event() {
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    
+    if(fd < 0) {
+        raise_error("Error creating eventfd.");
+    }
+    
+    return fd;
+}
+
+/**
+ * int create_event_loop(int *fds, int fd_num)
+ * 
+ * Creates epoll instance watching given descriptors for input.
+ */
+int create_event_loop(int *fds, int fd_num) {
+    struct epoll_event ev;
+    int epfd;
+    int i;
+    
+    if((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        raise_error("Error creating epoll instance.");
+    }
+    
+    for(i = 0; i < fd_num; i++) {
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = fds[i];
+        
+        if(epoll_ctl(epfd, EPOLL_CTL_ADD, fds[i], &ev) < 0) {
+            raise_error("Error adding descriptor to epoll instance.");
+        }
+    }
+    
+    return epfd;
+}
+
+/**
+ * int wait_events(int epfd, int *ready, int ready_max)
+ * 
+ * Sleeps until any descriptor watched by epfd becomes readable. Stores ready
+ * descriptors in ready (up to ready_max) and returns their number. Eventfds
+ * and timers have to be cleared by caller with clear_event.
+ */
+int wait_events(int epfd, int *ready, int ready_max) {
+    struct epoll_event evs[MAX_LOOP_FDS];
+    int n, i;
+    
+    if(ready_max > MAX_LOOP_FDS) {
+        ready_max = MAX_LOOP_FDS;
+    }
+    
+    do {
+        n = epoll_wait(epfd, evs, ready_max, -1);
+    } while(n < 0 && errno == EINTR);
+    
+    for(i = 0; i < n; i++) {
+        ready[i] = evs[i].data.fd;
+    }
+    
+    return (n > 0 ? n : 0);
+}
+
+/**
+ * void signal_event(int fd)
+ * 
+ * Wakes up thread waiting for given eventfd.
+ */
+void signal_event(int fd) {
+    uint64_t val = 1;
+    
+    /* Fails only if counter is already signalled, which is fine */
+    write(fd, &val, sizeof(val));
+}
+
+/**
+ * void clear_event(int fd)
+ * 
+ * Clears signalled eventfd or expired timer.
+ */
+void clear_event(int fd) {
+    uint64_t val;
+    
+    /* Fails only if it wasn't signalled, which is fine */
+    read(fd, &val, sizeof(val));
+}
+
+/**
+ * int create_timer()
+ * 
+ * Creates disarmed timer which can be watched by event loop.
+ */
+int create_timer() {
+    int timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    
+    if(timer < 0) {
+        raise_error("Error creating timerfd.");
+    }
+    
+    return timer;
+}
+
+/**
+ * void set_timer(int timer, long usec)
+ * 
+ * Arms timer to expire once after given number of microseconds. Negative
+ * value disarms timer, so the thread is only woken by other events.
+ */
+void set_timer(int timer, long usec) {
+    struct itimerspec its;
+    
+    memset(&its, 0, sizeof(its));
+    
+    if(usec >= 0) {
+        its.it_value.tv_sec = usec / 1000000;
+        its.it_value.tv_nsec = (usec % 1000000) * 1000;
+        
+        /* Zero would disarm the timer, expire as soon as possible instead */
+        if(its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0) {
+            its.it_value.tv_nsec = 1;
+        }
+    }
+    
+    timerfd_settime(timer, 0, &its, NULL);
+}
@@ -0,0 +1,46 @@
+/** 
+ * -----------------------------------------------------------------------------
+ * Clovece nezlob se (Server) - simple board game
+ * 
+ * Server for board game Clovece nezlob se using UDP datagrams for communication
+ * with clients and SEND-AND-WAIT method to ensure that all packets arrive
+ * and that they arrive in correct order. 
+ * 
+ * Semestral work for "Uvod do pocitacovich siti" KIV/UPS at
+ * University of West Bohemia.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * File: event.c
+ * Description: Event loop helpers (epoll, eventfd and timerfd) used by
+ *              server threads to sleep until there is something to do.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * @author: Martin Kucera, 2014
+ * @version: 1.02
+ * 
+ */
+
+#ifndef EVENT_H
+#define	EVENT_H
+
+/* Maximum number of descriptors watched by one event loop */
+#define MAX_LOOP_FDS 8
+
+/* Signalled once when server is shutting down, never cleared */
+extern int shutdown_event;
+
+/* Function prototypes */
+void init_events();
+void close_events();
+int create_event();
+int create_event_loop(int *fds, int fd_num);
+int wait_events(int epfd, int *ready, int ready_max);
+void signal_event(int fd);
+void clear_event(int fd);
+int create_timer();
+void set_timer(int timer, long usec);
+
+#endif	/* EVENT_H */
+
@@ -0,0 +1,420 @@
+/** 
+ * -----------------------------------------------------------------------------
+ * Clovece nezlob se (Server) - simple board game
+ * 
+ * Server for board game Clovece nezlob se using UDP datagrams for communication
+ * with clients and SEND-AND-WAIT method to ensure that all packets arrive
+ * and that they arrive in correct order.
+ * 
+ * Semestral work for "Uvod do pocitacovich siti" KIV/UPS at
+ * University of West Bohemia.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * File: evlog.c
+ * Description: Event records of binary log format, their encoding
+ *              and formatting to text.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * @author: Martin Kucera, 2014
+ * @version: 1.02
+ * 
+ */
+
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "proto.h"
+#include "evlog.h"
+
+#define EVLOG_FORMAT(name, format) format,
+
+/* Number of 32 bit fields of record, in order of their EVLOG_F_* bits */
+#define EVLOG_INT_FIELDS 7
+/* 32 bit field of record with given index */
+#define EVLOG_FIELD(rec, i) ((int32_t *) ((char *) (rec) + evlog_fields[i]))
+
+/* Signed numbers are written zigzag encoded, so small negative ones
+ * stay short
+ */
+#define ZIGZAG(n) (((uint64_t) (int64_t) (n) << 1) ^ (uint64_t) ((int64_t) (n) >> 63))
+#define UNZIGZAG(v) ((int64_t) ((v) >> 1) ^ -(int64_t) ((v) & 1))
+
+/* Formats of events indexed by event ID */
+static const char *evlog_formats[EV_COUNT] = {
+    EVLOG_TABLE(EVLOG_FORMAT)
+};
+
+/* Offsets of 32 bit fields of record */
+static const size_t evlog_fields[EVLOG_INT_FIELDS] = {
+    offsetof(evlog_record_t, seq),
+    offsetof(evlog_record_t, args[0]),
+    offsetof(evlog_record_t, args[1]),
+    offsetof(evlog_record_t, client),
+    offsetof(evlog_record_t, game),
+    offsetof(evlog_record_t, args[2]),
+    offsetof(evlog_record_t, args[3])
+};
+
+/**
+ * int put_varint(unsigned char *out, uint64_t value)
+ * 
+ * Writes value as varint, returns number of written bytes.
+ */
+static int put_varint(unsigned char *out, uint64_t value) {
+    int len = 0;
+    
+    while(value >= 0x80) {
+        out[len++] = (unsigned char) (value | 0x80);
+        value >>= 7;
+    }
+    
+    out[len++] = (unsigned char) value;
+    
+    return len;
+}
+
+/**
+ * int read_varint(FILE *file, uint64_t *value)
+ * 
+ * Reads varint from file. Returns 0 if file ends or varint is too long.
+ */
+static int read_varint(FILE *file, uint64_t *value) {
+    int shift = 0;
+    int c;
+    
+    *value = 0;
+    
+    for(;;) {
+        if(shift > 63 || (c = getc(file)) == EOF) {
+            return 0;
+        }
+        
+        *value |= (uint64_t) (c & 0x7F) << shift;
+        
+        if(!(c & 0x80)) {
+            return 1;
+        }
+        
+        shift += 7;
+    }
+}
+
+/**
+ * void evlog_init_header(evlog_header_t *header)
+ * 
+ * Fills header written at the start of binary log file.
+ */
+void evlog_init_header(evlog_header_t *header) {
+    memset(header, 0, sizeof(evlog_header_t));
+    
+    memcpy(header->magic, EVLOG_MAGIC, sizeof(header->magic));
+    header->version = EVLOG_VERSION;
+}
+
+/**
+ * int evlog_check_header(evlog_header_t *header)
+ * 
+ * Checks if header was written by compatible server (same version).
+ * Returns 1 if file can be read.
+ */
+int evlog_check_header(evlog_header_t *header) {
+    return (memcmp(header->magic, EVLOG_MAGIC, sizeof(header->magic)) == 0 &&
+            header->version == EVLOG_VERSION);
+}
+
+/**
+ * void evlog_init_state(evlog_state_t *state)
+ * 
+ * Resets state before the first record of logging session, the record
+ * gets absolute timestamp and all its fields.
+ */
+void evlog_init_state(evlog_state_t *state) {
+    memset(state, 0, sizeof(evlog_state_t));
+}
+
+/**
+ * int evlog_encode(evlog_state_t *state, evlog_record_t *rec, char *out)
+ * 
+ * Encodes record to out (at most EVLOG_MAX_RECORD bytes), only fields
+ * which differ from previous record of the same event are written.
+ * Returns length of encoded record.
+ */
+int evlog_encode(evlog_state_t *state, evlog_record_t *rec, char *out) {
+    evlog_record_t *prev = &state->prev[rec->event];
+    unsigned char *pos = (unsigned char *) out;
+    unsigned int mask = 0;
+    int i;
+    
+    for(i = 0; i < EVLOG_INT_FIELDS; i++) {
+        if(*EVLOG_FIELD(rec, i) != *EVLOG_FIELD(prev, i)) {
+            mask |= 1 << i;
+        }
+    }
+    
+    if(rec->shard != prev->shard) {
+        mask |= EVLOG_F_SHARD;
+    }
+    
+    if(rec->severity != prev->severity) {
+        mask |= EVLOG_F_SEVERITY;
+    }
+    
+    if(!state->usec) {
+        mask |= EVLOG_F_ABS_TIME;
+    }
+    
+    pos += put_varint(pos, rec->event);
+    pos += put_varint(pos, mask);
+    
+    /* Records of different threads can come slightly out of order */
+    if(mask & EVLOG_F_ABS_TIME) {
+        pos += put_varint(pos, rec->usec);
+    }
+    else {
+        pos += put_varint(pos, ZIGZAG(rec->usec - state->usec));
+    }
+    
+    for(i = 0; i < EVLOG_INT_FIELDS; i++) {
+        if(mask & (1 << i)) {
+            pos += put_varint(pos, ZIGZAG(*EVLOG_FIELD(rec, i)));
+        }
+    }
+    
+    if(mask & EVLOG_F_SHARD) {
+        pos += put_varint(pos, rec->shard);
+    }
+    
+    if(mask & EVLOG_F_SEVERITY) {
+        pos += put_varint(pos, ZIGZAG(rec->severity));
+    }
+    
+    state->usec = rec->usec;
+    *prev = *rec;
+    
+    return (char *) pos - out;
+}
+
+/**
+ * int evlog_read(FILE *file, evlog_state_t *state, evlog_record_t *rec, char *text, int text_size)
+ * 
+ * Reads next encoded record from file, text of EV_TEXT record is read
+ * to text. Record with absolute timestamp starts new session, state
+ * is reset before it. Returns 1 if record was read, 0 at the end of file
+ * and -1 if file is truncated or corrupted.
+ */
+int evlog_read(FILE *file, evlog_state_t *state, evlog_record_t *rec, char *text, int text_size) {
+    uint64_t event, mask, value;
+    int c;
+    int i;
+    
+    if((c = getc(file)) == EOF) {
+        return 0;
+    }
+    
+    ungetc(c, file);
+    
+    if(!read_varint(file, &event) || event >= EV_COUNT || !read_varint(file, &mask) ||
+            !read_varint(file, &value)) {
+        return -1;
+    }
+    
+    /* New logging session appended to file */
+    if(mask & EVLOG_F_ABS_TIME) {
+        evlog_init_state(state);
+    }
+    
+    *rec = state->prev[event];
+    rec->event = (uint16_t) event;
+    
+    if(mask & EVLOG_F_ABS_TIME) {
+        rec->usec = value;
+    }
+    else {
+        rec->usec = state->usec + UNZIGZAG(value);
+    }
+    
+    for(i = 0; i < EVLOG_INT_FIELDS; i++) {
+        if(mask & (1 << i)) {
+            if(!read_varint(file, &value)) {
+                return -1;
+            }
+            
+            *EVLOG_FIELD(rec, i) = (int32_t) UNZIGZAG(value);
+        }
+    }
+    
+    if(mask & EVLOG_F_SHARD) {
+        if(!read_varint(file, &value)) {
+            return -1;
+        }
+        
+        rec->shard = (uint8_t) value;
+    }
+    
+    if(mask & EVLOG_F_SEVERITY) {
+        if(!read_varint(file, &value)) {
+            return -1;
+        }
+        
+        rec->severity = (int8_t) UNZIGZAG(value);
+    }
+    
+    state->usec = rec->usec;
+    state->prev[event] = *rec;
+    
+    /* Text of line follows its record */
+    if(rec->event == EV_TEXT) {
+        if(rec->args[0] < 0 || rec->args[0] >= text_size ||
+                fread(text, 1, rec->args[0], file) != (size_t) rec->args[0]) {
+            return -1;
+        }
+    }
+    
+    return 1;
+}
+
+/**
+ * int evlog_pack_code(const char *code)
+ * 
+ * Packs game code into event argument, letter by letter from the lowest
+ * bits. Returns -1 if there is no code, if it is longer than EVLOG_CODE_LEN
+ * or has other characters than uppercase letters.
+ */
+int evlog_pack_code(const char *code) {
+    int packed = 0;
+    int i;
+    
+    if(!code) {
+        return -1;
+    }
+    
+    for(i = 0; code[i]; i++) {
+        if(i >= EVLOG_CODE_LEN || code[i] < 'A' || code[i] > 'Z') {
+            return -1;
+        }
+        
+        packed |= (code[i] - 'A' + 1) << (i * EVLOG_CODE_BITS);
+    }
+    
+    return packed;
+}
+
+/**
+ * void unpack_code(int packed, char *code)
+ * 
+ * Unpacks game code packed by evlog_pack_code, code has to have space
+ * for EVLOG_CODE_LEN letters and null character.
+ */
+static void unpack_code(int packed, char *code) {
+    int i;
+    
+    for(i = 0; i < EVLOG_CODE_LEN && packed > 0; i++) {
+        code[i] = (char) ('A' - 1 + (packed & ((1 << EVLOG_CODE_BITS) - 1)));
+        packed >>= EVLOG_CODE_BITS;
+    }
+    
+    code[i] = 0;
+}
+
+/**
+ * int evlog_format(evlog_record_t *rec, const char *text, char *out, int size)
+ * 
+ * Formats event record to text line (without timestamp) using format
+ * of its event. Text of EV_TEXT record is passed separately. Returns
+ * length of the line.
+ */
+int evlog_format(evlog_record_t *rec, const char *text, char *out, int size) {
+    const char *f;
+    const char *name;
+    char addr_str[INET_ADDRSTRLEN];
+    char code[EVLOG_CODE_LEN + 1];
+    struct in_addr addr;
+    int len = 0;
+    int n;
+    
+    if(size <= 0) {
+        return 0;
+    }
+    
+    out[0] = 0;
+    
+    if(rec->event == EV_TEXT) {
+        return snprintf(out, size, "%.*s", rec->args[0], text);
+    }
+    
+    if(rec->event >= EV_COUNT) {
+        return snprintf(out, size, "Unknown event %d", rec->event);
+    }
+    
+    for(f = evlog_formats[rec->event]; *f && len < size - 1; f++) {
+        if(*f != '%' || !f[1]) {
+            out[len++] = *f;
+            continue;
+        }
+        
+        switch(*++f) {
+            case 's':
+                n = snprintf(out + len, size - len, "%d", rec->shard);
+                break;
+            case 'c':
+                n = snprintf(out + len, size - len, "%d", rec->client);
+                break;
+            case 'g':
+                n = snprintf(out + len, size - len, "%d", rec->game);
+                break;
+            case 'q':
+                n = snprintf(out + len, size - len, "%d", rec->seq);
+                break;
+            case '0':
+            case '1':
+            case '2':
+            case '3':
+                n = snprintf(out + len, size - len, "%d", rec->args[*f - '0']);
+                break;
+            case 'h':
+                n = snprintf(out + len, size - len, "%x", (unsigned int) rec->args[1]);
+                break;
+            case 'C':
+                name = (rec->args[0] > CMD_UNKNOWN && rec->args[0] < CMD_COUNT ?
+                        cmd_defs[rec->args[0]].name : "UNKNOWN");
+                n = snprintf(out + len, size - len, "%s", name);
+                break;
+            case 'M':
+                name = msg_name(rec->args[0]);
+                n = snprintf(out + len, size - len, "%s", name ? name : "UNKNOWN");
+                break;
+            case 'a':
+                addr.s_addr = (uint32_t) rec->args[2];
+                inet_ntop(AF_INET, &addr, addr_str, INET_ADDRSTRLEN);
+                n = snprintf(out + len, size - len, "%s:%d", addr_str, rec->args[3]);
+                break;
+            case 'i':
+                addr.s_addr = (uint32_t) rec->args[2];
+                inet_ntop(AF_INET, &addr, addr_str, INET_ADDRSTRLEN);
+                n = snprintf(out + len, size - len, "%s", addr_str);
+                break;
+            case 'K':
+                unpack_code(rec->args[0], code);
+                n = snprintf(out + len, size - len, "%s", code);
+                break;
+            default:
+                out[len] = *f;
+                n = 1;
+        }
+        
+        len += n;
+    }
+    
+    if(len > size - 1) {
+        len = size - 1;
+    }
+    
+    out[len] = 0;
+    
+    return len;
+}
+
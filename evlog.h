@@ -0,0 +1,156 @@
+/** 
+ * -----------------------------------------------------------------------------
+ * Clovece nezlob se (Server) - simple board game
+ * 
+ * Server for board game Clovece nezlob se using UDP datagrams for communication
+ * with clients and SEND-AND-WAIT method to ensure that all packets arrive
+ * and that they arrive in correct order.
+ * 
+ * Semestral work for "Uvod do pocitacovich siti" KIV/UPS at
+ * University of West Bohemia.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * File: evlog.c
+ * Description: Event records of binary log format, their encoding
+ *              and formatting to text.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * @author: Martin Kucera, 2014
+ * @version: 1.02
+ * 
+ */
+
+#ifndef EVLOG_H
+#define	EVLOG_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* Binary log file starts with evlog_header_t, encoded records follow it */
+#define EVLOG_MAGIC "CNSEVLOG"
+#define EVLOG_VERSION 2
+
+/* Encoded record is event ID, field mask and timestamp (varints) followed
+ * by fields set in the mask (zigzag varints), text of EV_TEXT record
+ * follows it. Field missing in the mask has the same value as in previous
+ * record of the same event. Timestamp is difference from previous record
+ * unless EVLOG_F_ABS_TIME is set.
+ */
+#define EVLOG_F_SEQ 0x001
+#define EVLOG_F_ARG0 0x002
+#define EVLOG_F_ARG1 0x004
+#define EVLOG_F_CLIENT 0x008
+#define EVLOG_F_GAME 0x010
+#define EVLOG_F_ARG2 0x020
+#define EVLOG_F_ARG3 0x040
+#define EVLOG_F_SHARD 0x080
+#define EVLOG_F_SEVERITY 0x100
+#define EVLOG_F_ABS_TIME 0x200
+
+/* Maximum length of encoded record (without text) */
+#define EVLOG_MAX_RECORD 64
+
+/* Game codes of up to EVLOG_CODE_LEN uppercase letters fit into one
+ * argument, EVLOG_CODE_BITS per letter
+ */
+#define EVLOG_CODE_LEN 6
+#define EVLOG_CODE_BITS 5
+
+/* Log events, X(NAME, format). Format is expanded by evlog_format:
+ *   %s shard, %c client, %g game, %q SEQ_ID, %0 - %3 arguments,
+ *   %h argument 1 in hex, %C command named by argument 0,
+ *   %M server message named by argument 0,
+ *   %a address (argument 2 IPv4 address in network order, argument 3 port),
+ *   %i IPv4 address in argument 2 alone, %K game code packed in argument 0
+ *   (see evlog_pack_code)
+ * Position in table is the event ID written to file, so new events have
+ * to be appended.
+ */
+#define EVLOG_TABLE(X) \
+    X(TEXT, "") \
+    X(DATA_IN, "DATA_IN: %C (SEQ_ID %q, %1 B) <--- %a") \
+    X(DATA_OUT, "DATA_OUT: %M (SEQ_ID %q, %1 B) ---> %a") \
+    X(ACK_OUT, "DATA_OUT: ACK;%0 (SACK %h) ---> %a") \
+    X(SERVER_FULL, "DATA_OUT: SERVER_FULL ---> %a") \
+    X(ENQUEUE, "Enqueueing packet with message: %M (client %s/%c, %1 B, coalesced %2)") \
+    X(ACKED, "ACK waiting packet with message %M and SEQ_ID %q (client %s/%c, selective %1)") \
+    X(TIMEOUT, "Packet with message %M and SEQ_ID %q timeouted (retries %1)") \
+    X(CLIENT_ADDED, "Added new client with IP address: %i and port %3") \
+    X(CLIENT_FULL, "New client tried to connec but server is full") \
+    X(CLIENT_RECONNECTED, "Reconnected client IP address: %i and port %3") \
+    X(CLIENT_REMOVED, "Removing client with IP address: %i and port %3") \
+    X(CLIENT_MIGRATED, "Migrating client with index %c to shard %1 to join game with code %K") \
+    X(GAME_CREATED, "Created new game with code %K and index %g") \
+    X(GAME_REMOVED, "Removing game with code %K and index %g") \
+    X(GAME_JOINED, "Player with index %c joined game with code %K and index %g") \
+    X(JOIN_FULL, "Client with index %c tried to join game with code %K and index %g, but game was full") \
+    X(JOIN_RUNNING, "Client with index %c tried to join game with code %K and index %g, but game was already running") \
+    X(JOIN_NONEXISTENT, "Client with index %c tried to join game with code %K, but game DOESNT EXIST") \
+    X(GAME_LEFT, "Client with index %c is leaving game with code %K and index %g") \
+    X(GAME_CLIENT_TIMEOUT, "Client with index %c timeouted from game with code %K and index %g, can reconnect") \
+    X(GAME_STARTED, "Client with index %c started game with code %K and index %g") \
+    X(DIE_ROLLED, "Client with index %c rolled number %1") \
+    X(FIGURE_MOVED, "Client with index %c moved figure to field %1") \
+    X(PLAYER_FINISHED, "Client with index %c in game with code %K and index %g finished at pos %1") \
+    X(GAME_FINISHED, "All players in game with code %K and index %g finished") \
+    X(GAME_TIMEOUT, "Game with code %K and index %g TIMEOUT")
+
+#define EVLOG_ENUM(name, format) EV_##name,
+
+/* Event IDs */
+enum {
+    EVLOG_TABLE(EVLOG_ENUM)
+    EV_COUNT
+};
+
+typedef struct {
+    /* "CNSEVLOG" */
+    char magic[8];
+    /* EVLOG_VERSION */
+    uint8_t version;
+    /* Unused, zero */
+    uint8_t reserved[7];
+} evlog_header_t;
+
+typedef struct {
+    /* Time of event in microseconds since epoch */
+    uint64_t usec;
+    /* Event ID */
+    uint16_t event;
+    /* Log severity */
+    int8_t severity;
+    /* Shard which logged the event */
+    uint8_t shard;
+    /* Client index in shard, -1 if none */
+    int32_t client;
+    /* Game index in shard, -1 if none */
+    int32_t game;
+    /* SEQ_ID of datagram, 0 if none */
+    int32_t seq;
+    /* Event arguments (length of text in EV_TEXT record) */
+    int32_t args[4];
+} evlog_record_t;
+
+/* State shared by records of one logging session, writer and reader
+ * of the file keep the same one
+ */
+typedef struct {
+    /* Time of previous record, 0 before the first one */
+    uint64_t usec;
+    /* Previous record of each event */
+    evlog_record_t prev[EV_COUNT];
+} evlog_state_t;
+
+/* Function prototypes */
+void evlog_init_header(evlog_header_t *header);
+int evlog_check_header(evlog_header_t *header);
+void evlog_init_state(evlog_state_t *state);
+int evlog_pack_code(const char *code);
+int evlog_encode(evlog_state_t *state, evlog_record_t *rec, char *out);
+int evlog_read(FILE *file, evlog_state_t *state, evlog_record_t *rec, char *text, int text_size);
+int evlog_format(evlog_record_t *rec, const char *text, char *out, int size);
+
+#endif	/* EVLOG_H */
+
@@ -29,22 +29,19 @@
 #include "client.h"
 #include "global.h"
 #include "com.h"
+#include "proto.h"
+#include "shard.h"
 #include "logger.h"
+#include "err.h"
 
-/* Logger buffer */
-char log_buffer[LOG_BUFFER_SIZE];
 /* If set to value between 1 and 6, all rolls will be this value */
 int force_roll = -1;
 
-/* Array with all created games */
-game_t *games[MAX_CONCURRENT_CLIENTS];
-/* Number of created games */
-unsigned int game_num = 0;
-
 /**
  * void generate_game_code(char *code, unsigned int iteration)
  * 
- * Generates unique game code with length specified by GAME_CODE_LEN
+ * Generates unique game code with length specified by GAME_CODE_LEN. First
+ * letter of the code identifies current shard.
  */
 void generate_game_code(char *code, unsigned int iteration) {
     game_t* existing_game;
@@ -57,69 +54,36 @@ void generate_game_code(char *code, unsigned int iteration) {
     }
     
     gen_random(code, GAME_CODE_LEN);
+    code[0] = SHARD_CODE_CHAR(cur_shard->index);
     existing_game = get_game_by_code(code);
     
     if(existing_game) {
-        release_game(existing_game);
-        generate_game_code(code, iteration++);
+        generate_game_code(code, iteration + 1);
     }
 }
 
 /**
  * game_t* get_game_by_code(char *code)
  * 
- * Attempts to find a game with given code. If game is found,
- * it's mutex will be locked in order to prevent any changes by other threads,
- * but has to be released manually in order to prevent a deadlock.
+ * Looks up game with given code in index of current shard. Games are owned
+ * by their shard's thread, so no locking is needed.
  */
 game_t* get_game_by_code(char *code) {
-    int i;
-    
-    for(i = 0; i < MAX_CONCURRENT_CLIENTS; i++) {
-        if(games[i]) {
-            pthread_mutex_lock(&games[i]->mtx_game);
-
-            if(strncmp(code, games[i]->code, GAME_CODE_LEN) == 0) {
-                return games[i];
-            }
-
-            pthread_mutex_unlock(&games[i]->mtx_game);
-        }
+    if(!code) {
+        return NULL;
     }
     
-    return NULL;
+    return get_game_by_index(index_map_get(&cur_shard->game_map, code_key(code, GAME_CODE_LEN)));
 }
 
 /**
  * game_t* get_game_by_index(unsigned int index)
  * 
- * Checks if game at given index exists, if so, returns a pointer to that game
- * with locked mutex. Mutex has to be released manually.
+ * Checks if game at given index exists in current shard, if so, returns
+ * a pointer to that game.
  */
 game_t* get_game_by_index(unsigned int index) {
-    if(index>= 0 && MAX_CONCURRENT_CLIENTS > index) {
-        if(games[index]) {
-            pthread_mutex_lock(&games[index]->mtx_game);
-
-            return games[index];
-        }
-    }
-    
-    return NULL;
-}
-
-/**
- * void release_game(game_t *game)
- * 
- * Checks if the mutex of given game is locked, if so, unlocks it.
- */
-void release_game(game_t *game) {
-    if(game && pthread_mutex_trylock(&game->mtx_game) != 0) {
-        pthread_mutex_unlock(&game->mtx_game);
-    }
-    else {
-        log_line("Tried to release non-locked game", LOG_WARN);
-    }
+    return (game_t *) slab_get(&cur_shard->games, (int) index);
 }
 
 /**
@@ -134,21 +98,19 @@ void release_game(game_t *game) {
  * clients and each client can be present only in one game.
  */
 void create_game(client_t *client) {
-    char *message;
-    char buff[11];
-    unsigned int message_len;
+    msg_t msg;
     int i = 0;
+    game_t record;
     
     if(client->game_index == -1) {
-        game_t *game = (game_t *) malloc(sizeof(game_t));
+        /* Record is copied to current shard's slab once it has code */
+        game_t *game = &record;
 
         /* Update game timestamp */
         gettimeofday(&game->timestamp, NULL);
         game->state = 0;
         game->player_num = 1;
 
-        pthread_mutex_init(&game->mtx_game, NULL);
-
         memset(game->player_index, -1, sizeof(int) * 4);
         game->player_index[0] = client->client_index;
 
@@ -156,17 +118,17 @@ void create_game(client_t *client) {
         generate_game_code(game->code, 0);
 
         if(game->code[0] != 0) {        
-            /* Find empty game index */
-            for(i = 0; i < MAX_CONCURRENT_CLIENTS; i++) {
-                if(games[i] == NULL) {
-                    games[i] = game;
-                    game->game_index = i;
-
-                    break;
-                }
+            /* Take free game index */
+            i = slab_alloc(&cur_shard->games);
+            
+            if(i < 0) {
+                raise_error("Error allocating game record.");
             }
-
-            game_num++;
+            
+            game->game_index = i;
+            game = (game_t *) memcpy(slab_get(&cur_shard->games, i), game, sizeof(game_t));
+            
+            index_map_put(&cur_shard->game_map, code_key(game->code, GAME_CODE_LEN), i);
 
             /* Place figures at their starting position */
             for(i = 0; i < 16; i++) {
@@ -185,31 +147,27 @@ void create_game(client_t *client) {
             /* Set invalid next playing on purpose */
             game->game_state.playing = 100;
 
-            /* Prepare message for client */
-            sprintf(buff, "%d", ( GAME_MAX_LOBBY_TIME_SEC - 1));
-            message_len = strlen(buff) + GAME_CODE_LEN + 14 + 1;
-            message = (char *) malloc(message_len);
-
-            sprintf(message, "GAME_CREATED;%s;%d", game->code, GAME_MAX_LOBBY_TIME_SEC - 1);
-
-            enqueue_dgram(client, message, 1);
+            /* Inform client */
+            msg_begin(&msg, client, MSG_GAME_CREATED, 1);
+            msg_str(&msg, game->code);
+            msg_int(&msg, GAME_MAX_LOBBY_TIME_SEC - 1);
+            msg_send(&msg);
 
             /* Log */
-            sprintf(log_buffer,
+            LOG_TEXT(LOG_DEBUG,
                     "Created new game with code %s and index %d",
                     game->code,
                     game->game_index
                     );
-
-            log_line(log_buffer, LOG_DEBUG);
+            
+            LOG_EVENT(LOG_DEBUG, EV_GAME_CREATED, client->client_index, game->game_index, 0,
+                    evlog_pack_code(game->code), 0, 0, 0);
 
             /* Set clients game index */
             client->game_index = game->game_index;
 
 	    /* Set clients game player index */
 	    client->game_player_index = 0;
-
-            free(message);
         }
     }
 }
@@ -226,8 +184,7 @@ void create_game(client_t *client) {
  * but is not currently supported.
  */
 void send_game_state(client_t *client, game_t *game) {
-    char *buff;
-    unsigned short release = 0;
+    msg_t msg;
     unsigned short player[4] = {0};
     unsigned int i;
     int client_game_index;
@@ -236,18 +193,11 @@ void send_game_state(client_t *client, game_t *game) {
     if(client != NULL) {
         if(game == NULL) {
             game = get_game_by_index(client->game_index);
-            
-            release = 1;
         }
         
         if(game) {
             /* If client is in that game */
             if(game->game_index == client->game_index) {
-                /* Buffer is set to maximum possible size, but the actual message
-                 * is terminated by 0 so client can get the actual length
-                 */
-                buff = (char *) malloc(105 + GAME_CODE_LEN + 11);
-
                 /* Get players that are playing */
                 for(i = 0; i < 4; i++) {
                     if(game->player_index[i] != -1) {
@@ -269,56 +219,34 @@ void send_game_state(client_t *client, game_t *game) {
                                 else {
                                     player[i] = 2;
                                 }
-
-                                /* Release client */
-                                release_client(cur_client);
                             }
                         }
                     }
                 }
 
                 /* game code, game state, 4x player connected, 16x figure position,
-                 * index of currently playing client, game index of connecting player
-                 * and timeout before next state change (lobby timeout, playing timeout)
+                 * index of currently playing client, game index of connecting player,
+                 * timeout before next state change (lobby timeout, playing timeout),
+                 * rolled number and client's smoothed RTT in milliseconds
                  */
-                sprintf(buff,
-                        "GAME_STATE;%s;%u;%u;%u;%u;%u;%u;%u;%u;%u;%u;%u;%u;%u;%u;%u;%u;%u;%u;%u;%u;%u;%u;%u;%d;%d",
-                        game->code,
-                        game->state, 
-                        player[0],
-                        player[1],
-                        player[2],
-                        player[3],
-                        game->game_state.figures[0],
-                        game->game_state.figures[1],
-                        game->game_state.figures[2],
-                        game->game_state.figures[3],
-                        game->game_state.figures[4],
-                        game->game_state.figures[5],
-                        game->game_state.figures[6],
-                        game->game_state.figures[7],
-                        game->game_state.figures[8],
-                        game->game_state.figures[9],
-                        game->game_state.figures[10],
-                        game->game_state.figures[11],
-                        game->game_state.figures[12],
-                        game->game_state.figures[13],
-                        game->game_state.figures[14],
-                        game->game_state.figures[15],
-                        game->game_state.playing,
-                        client_game_index,
-                        game_time_before_timeout(game),
-                        game->game_state.playing_rolled
-                        );
+                msg_begin(&msg, client, MSG_GAME_STATE, 1);
+                msg_str(&msg, game->code);
+                msg_uint(&msg, game->state);
 
-                enqueue_dgram(client, buff, 1);
+                for(i = 0; i < 4; i++) {
+                    msg_uint(&msg, player[i]);
+                }
 
-                free(buff);
-            }
-            
-            if(release) {
-                /* Release game */
-                release_game(game);
+                for(i = 0; i < 16; i++) {
+                    msg_uint(&msg, game->game_state.figures[i]);
+                }
+                
+                msg_uint(&msg, game->game_state.playing);
+                msg_uint(&msg, client_game_index);
+                msg_uint(&msg, game_time_before_timeout(game));
+                msg_int(&msg, game->game_state.playing_rolled);
+                msg_int(&msg, client->srtt_usec / 1000);
+                msg_send(&msg);
             }
         }
     }
@@ -335,13 +263,14 @@ void remove_game(game_t **game, client_t *skip) {
     
     if(game != NULL) {
         /* Log */
-        sprintf(log_buffer,
+        LOG_TEXT(LOG_DEBUG,
                 "Removing game with code %s and index %d",
                 (*game)->code,
                 (*game)->game_index
                 );
         
-        log_line(log_buffer, LOG_DEBUG);
+        LOG_EVENT(LOG_DEBUG, EV_GAME_REMOVED, -1, (*game)->game_index, 0,
+                evlog_pack_code((*game)->code), 0, 0, 0);
         
         /* Set all player's game index to - 1 */
         for(i = 0; i < 4; i++) {
@@ -352,40 +281,34 @@ void remove_game(game_t **game, client_t *skip) {
                 
                 if(cur) {
                     cur->game_index = -1;
-                    
-                    /* Release client */
-                    release_client(cur);
                 }
             }
         }
         
+        index_map_remove(&cur_shard->game_map, code_key((*game)->code, GAME_CODE_LEN), (*game)->game_index);
         free((*game)->code);
         
-        games[(*game)->game_index] = NULL;
-        game_num--;
-        
-        release_game((*game));
-        
-        free((*game));
+        slab_free(&cur_shard->games, (*game)->game_index);
     }
     
     *game = NULL;
 }
 
 /**
- * void broadcast_game(game_t *game, char *msg, client_t *skip, int send_skip)
+ * void broadcast_game(game_t *game, msg_t *msg, client_t *skip, int send_skip)
  * 
- * Sends message to all clients (players) connected to a game.
+ * Finishes message built in caller's buffer and sends it to all clients
+ * (players) connected to a game.
  */
-void broadcast_game(game_t *game, char *msg, client_t *skip, int send_skip) {
+void broadcast_game(game_t *game, msg_t *msg, client_t *skip, int send_skip) {
     int i;
     client_t *client;
-    int release;
+    
+    msg_end(msg);
     
     if(game != NULL) {        
         for(i = 0; i < 4; i++) {
             client = NULL;
-            release = 1;
             
             /* Player exists */
             if(game->player_index[i] != -1) {                
@@ -395,17 +318,11 @@ void broadcast_game(game_t *game, char *msg, client_t *skip, int send_skip) {
                 }
                 else if(skip && send_skip) {
                     client = skip;
-                    release = 0;
                 }
                 
                 if(client != NULL) {
                     if(client->state) {
-                        enqueue_dgram(client, msg, 1);
-                    }
-                    
-                    if(release) {
-                        /* Release client */
-                        release_client(client);
+                        enqueue_msg(client, msg, 1);
                     }
                 }
                 
@@ -421,8 +338,8 @@ void broadcast_game(game_t *game, char *msg, client_t *skip, int send_skip) {
 */
 void broadcast_message(client_t *client, char* message) {
     game_t *game;
-    char *buff;
-    unsigned len;
+    char buff[MSG_BUFF_SIZE];
+    msg_t msg;
 
     if(!message) {
 	return;
@@ -432,27 +349,20 @@ void broadcast_message(client_t *client, char* message) {
 
     if(game) {
 	if(game->player_num > 1) {
-	    len = strlen(message) + 10 + 1;
-	    buff = (char *) malloc(len);
-	    sprintf(buff, "MESSAGE;%d;%s", client->game_player_index, message);
+	    msg_begin_buff(&msg, buff, sizeof(buff), MSG_MESSAGE);
+	    msg_int(&msg, client->game_player_index);
+	    msg_str(&msg, message);
 
 	    /* Send message to other clients */
-	    broadcast_game(game, buff, client, 0);
-	    
-	    /* Free buffer */
-	    free(buff);
+	    broadcast_game(game, &msg, client, 0);
 
 	    /* Log */
-	    sprintf(log_buffer,
+	    LOG_FMT(LOG_INFO,
 		    "Player with index %d sent message: %s",
 		    client->client_index,
 		    message
    		    );
-
-	   log_line(log_buffer, LOG_INFO);
 	}
-
-	release_game(game);
     }
 }
 
@@ -460,15 +370,27 @@ void broadcast_message(client_t *client, char* message) {
  * void join_game(client_t *client, char* game_code)
  * 
  * Tries to join a game with given code, if unsuccessful informs
- * client what was the problem.
+ * client what was the problem. If game belongs to another shard, client
+ * is migrated there and joins the game in that shard.
  */
 void join_game(client_t *client, char* game_code) {
     int i;
-    game_t *game;
-    char buff[21];
+    int shard;
+    int code;
+    game_t *game = NULL;
+    char buff[MSG_BUFF_SIZE];
+    msg_t msg;
     
     /* Check if client is already in a game */
     if(client->game_index == -1) {
+        shard = shard_by_code(game_code);
+        
+        if(shard >= 0 && shard != cur_shard->index) {
+            migrate_client(client, shard, game_code);
+            
+            return;
+        }
+        
         game = get_game_by_code(game_code);
     }
     
@@ -487,9 +409,8 @@ void join_game(client_t *client, char* game_code) {
                 }
 
                 /* Prepare message */
-                strcpy(buff, "CLIENT_JOINED_GAME;");
-                buff[19] = (char) (((int) '0') + i);
-                buff[20] = 0;
+                msg_begin_buff(&msg, buff, sizeof(buff), MSG_CLIENT_JOINED_GAME);
+                msg_int(&msg, i);
 
                 /* Set clients game index reference to this game */
                 client->game_index = game->game_index;
@@ -501,66 +422,70 @@ void join_game(client_t *client, char* game_code) {
                 send_game_state(client, game);
 
                 /* Broadcast game, skipping current client */
-                broadcast_game(game, buff, client, 1);
+                broadcast_game(game, &msg, client, 1);
 
                 game->player_num++;
                 
                 /* Log */
-                sprintf(log_buffer,
+                LOG_TEXT(LOG_DEBUG,
                         "Player with index %d joined game with code %s and index %d",
                         client->client_index,
                         game->code,
                         game->game_index
                         );
                 
-                log_line(log_buffer, LOG_DEBUG);
+                LOG_EVENT(LOG_DEBUG, EV_GAME_JOINED, client->client_index, game->game_index, 0,
+                        evlog_pack_code(game->code), 0, 0, 0);
 
             }
             /* Game is full */
             else {
                 /* Log */
-                sprintf(log_buffer,
+                LOG_TEXT(LOG_DEBUG,
                         "Client with index %d tried to join game with code %s and index %d, but game was full",
                         client->client_index,
                         game->code,
                         game->game_index
                         );
                 
-                log_line(log_buffer, LOG_DEBUG);
+                LOG_EVENT(LOG_DEBUG, EV_JOIN_FULL, client->client_index, game->game_index, 0,
+                        evlog_pack_code(game->code), 0, 0, 0);
                 
-                enqueue_dgram(client, "GAME_FULL", 1);
+                enqueue_dgram(client, MSG_GAME_FULL, 1);
             }
         }
         /* Game is already running */
         else {
             /* Log */
-            sprintf(log_buffer,
+            LOG_TEXT(LOG_DEBUG,
                     "Client with index %d tried to join game with code %s and index %d, but game was already running",
                     client->client_index,
                     game->code,
                     game->game_index
                     );
-
-            log_line(log_buffer, LOG_DEBUG);
             
-            enqueue_dgram(client, "GAME_RUNNING", 1);
+            LOG_EVENT(LOG_DEBUG, EV_JOIN_RUNNING, client->client_index, game->game_index, 0,
+                    evlog_pack_code(game->code), 0, 0, 0);
+            
+            enqueue_dgram(client, MSG_GAME_RUNNING, 1);
         }
-        
-        /* Release game */
-        release_game(game);
     }
     /* Non existent game, inform user */
     else {
-        /* Log */
-        sprintf(log_buffer,
-                "Client with index %d tried to join game with code %s, but game DOESNT EXIST",
-                client->client_index,
-                game_code
-                );
-
-        log_line(log_buffer, LOG_DEBUG);
+        /* Log, code sent by client is kept as text if it can't be packed */
+        if(LOG_EVENT_ENABLED(LOG_DEBUG) && (code = evlog_pack_code(game_code)) >= 0) {
+            log_event(LOG_DEBUG, EV_JOIN_NONEXISTENT, client->client_index, -1, 0,
+                    code, 0, 0, 0);
+        }
+        else {
+            LOG_FMT(LOG_DEBUG,
+                    "Client with index %d tried to join game with code %s, but game DOESNT EXIST",
+                    client->client_index,
+                    game_code
+                    );
+        }
         
-        enqueue_dgram(client, "GAME_NONEXISTENT", 1);
+        enqueue_dgram(client, MSG_GAME_NONEXISTENT, 1);
     }
 }
 
@@ -573,22 +498,23 @@ void join_game(client_t *client, char* game_code) {
 void leave_game(client_t *client) {
     game_t *game;
     int i, n;
-    int len;
-    char *buff;
+    char buff[MSG_BUFF_SIZE];
+    msg_t msg;
     
     if(client != NULL) {
         game = get_game_by_index(client->game_index);
         
         if(game) {
             /* Log */
-            sprintf(log_buffer,
+            LOG_TEXT(LOG_DEBUG,
                     "Client with index %d is leaving game with code %s and index %d",
                     client->client_index,
                     game->code,
                     game->game_index
                     );
             
-            log_line(log_buffer, LOG_DEBUG);
+            LOG_EVENT(LOG_DEBUG, EV_GAME_LEFT, client->client_index, game->game_index, 0,
+                    evlog_pack_code(game->code), 0, 0, 0);
             
             if(game->player_num == 1) {
                 
@@ -623,32 +549,20 @@ void leave_game(client_t *client) {
                     }
                 }
                 
-                len = 30 + 11;
-                buff = (char *) malloc(len);
-                                
                 /* @TODO: if he wasnt playing do something else */
                 /* Notify other players that one left */
-                sprintf(buff, 
-                        "CLIENT_LEFT_GAME;%d;%d;%d", 
-                        i, 
-                        game->game_state.playing,
-                        GAME_MAX_PLAY_TIME_SEC - 1
-                        );
-                
-                broadcast_game(game, buff, NULL, 0);
+                msg_begin_buff(&msg, buff, sizeof(buff), MSG_CLIENT_LEFT_GAME);
+                msg_int(&msg, i);
+                msg_int(&msg, game->game_state.playing);
+                msg_int(&msg, GAME_MAX_PLAY_TIME_SEC - 1);
                 
-                free(buff);
+                broadcast_game(game, &msg, NULL, 0);
             }
             
             /* Reset client's game code */
             client->game_index = -1;
             
-            enqueue_dgram(client, "GAME_LEFT", 1);
-            
-            if(game) {
-                /* Release game */
-                release_game(game);
-            }
+            enqueue_dgram(client, MSG_GAME_LEFT, 1);
         }
     }
 }
@@ -661,20 +575,25 @@ void leave_game(client_t *client) {
  */
 int timeout_game(client_t *client) {
     int i;
-    char buff[40];
+    char buff[MSG_BUFF_SIZE];
+    msg_t msg;
     game_t *game = get_game_by_index(client->game_index);
     
+    /* What client sent and received before he went silent */
+    dump_client_recorder(client, LOG_WARN, "client timeouted");
+    
     if(game) {
         if(game->state) {
             /* Log */
-            sprintf(log_buffer,
+            LOG_TEXT(LOG_DEBUG,
                     "Client with index %d timeouted from game with code %s and index %d, can reconnect",
                     client->client_index,
                     game->code,
                     game->game_index
                     );
-
-            log_line(log_buffer, LOG_DEBUG);
+            
+            LOG_EVENT(LOG_DEBUG, EV_GAME_CLIENT_TIMEOUT, client->client_index, game->game_index, 0,
+                    evlog_pack_code(game->code), 0, 0, 0);
 
             /* Wont wait for timeouted player if he is alone in game */
             if(game->player_num > 1) {
@@ -688,20 +607,15 @@ int timeout_game(client_t *client) {
                     set_game_playing(game);
                 }
                 
-                sprintf(buff, 
-                        "CLIENT_TIMEOUT;%d;%d;%d", 
-                        i, 
-                        game->game_state.playing,
-                        GAME_MAX_PLAY_TIME_SEC - 1
-                        );
+                msg_begin_buff(&msg, buff, sizeof(buff), MSG_CLIENT_TIMEOUT);
+                msg_int(&msg, i);
+                msg_int(&msg, game->game_state.playing);
+                msg_int(&msg, GAME_MAX_PLAY_TIME_SEC - 1);
                 
-                broadcast_game(game, buff, client, 0);
+                broadcast_game(game, &msg, client, 0);
                                 
                 /* Update clients timestamp (starts countdown for max timeout time) */
                 update_client_timestamp(client);
-
-                /* Release game */
-                release_game(game);
                 
                 return 1;
             }
@@ -709,11 +623,6 @@ int timeout_game(client_t *client) {
                 remove_game(&game, client);
             }
         }
-        
-        if(game) {
-            /* Release game */
-            release_game(game);
-        }
     }
     
     return 0;
@@ -727,7 +636,8 @@ int timeout_game(client_t *client) {
  */
 void start_game(client_t *client) {
     game_t *game = NULL;
-    char *buff;
+    char buff[MSG_BUFF_SIZE];
+    msg_t msg;
     int i;
     
     if(client->game_index != -1) {
@@ -736,14 +646,15 @@ void start_game(client_t *client) {
         if(game) {                
             if(!game->state && game->player_num > 0 && !all_players_finished(game)) {  
                 /* Log */
-                sprintf(log_buffer,
+                LOG_TEXT(LOG_DEBUG,
                         "Client with index %d started game with code %s and index %d",
                         client->client_index,
                         game->code,
                         game->game_index
                         );
-
-                log_line(log_buffer, LOG_DEBUG);
+                
+                LOG_EVENT(LOG_DEBUG, EV_GAME_STARTED, client->client_index, game->game_index, 0,
+                        evlog_pack_code(game->code), 0, 0, 0);
 
                 game->state = 1;
 
@@ -761,17 +672,11 @@ void start_game(client_t *client) {
 
                 /* Broadcast clients */
                 /* GAME_MAX_LOBBY_TIME_SEC is expected to be bigger */
-                buff = (char *) malloc(16 + 11);
-                sprintf(buff, 
-                        "GAME_STARTED;%d;%d", 
-                        game->game_state.playing,
-                        GAME_MAX_PLAY_TIME_SEC
-                        );
-
-                broadcast_game(game, buff, client, 1);
+                msg_begin_buff(&msg, buff, sizeof(buff), MSG_GAME_STARTED);
+                msg_int(&msg, game->game_state.playing);
+                msg_int(&msg, GAME_MAX_PLAY_TIME_SEC);
 
-                /* Free buffer */
-                free(buff);          
+                broadcast_game(game, &msg, client, 1);
 
                 /* Update game timestamp */
                 gettimeofday(&game->timestamp, NULL);
@@ -779,9 +684,6 @@ void start_game(client_t *client) {
                 gettimeofday(&game->game_state.timestamp, NULL);
 
             }
-        
-        /* Release game */
-        release_game(game);
         }
     }
 }
@@ -814,14 +716,8 @@ void set_game_playing(game_t *game) {
                     if(client->state) {
                         game->game_state.playing = (cur + i ) % 4;
                         
-                        /* Release client */
-                        release_client(client);
-                        
                         break;
                     }
-                    
-                    /* Release client */
-                    release_client(client);
                 }
                         
             }
@@ -894,6 +790,25 @@ int game_time_before_timeout(game_t *game) {
     }
 }
 
+/**
+ * long game_timeout_wait(game_t *game)
+ * 
+ * Returns how many microseconds are left before game_time_before_timeout
+ * turns negative
+ */
+long game_timeout_wait(game_t *game) {
+    struct timeval cur_tv;
+    long max_sec = game->state ? GAME_MAX_PLAY_TIME_SEC : GAME_MAX_LOBBY_TIME_SEC;
+    long wait;
+    
+    gettimeofday(&cur_tv, NULL);
+    
+    wait = (game->timestamp.tv_sec + max_sec + 1 - cur_tv.tv_sec) * 1000000L
+            - cur_tv.tv_usec;
+    
+    return (wait > 0 ? wait : 0);
+}
+
 /**
  * void roll_die(client_t *client)
  * 
@@ -905,7 +820,8 @@ int game_time_before_timeout(game_t *game) {
 void roll_die(client_t *client) {
     int rolled;
     game_t *game = get_game_by_index(client->game_index);
-    char buff[13];
+    char buff[MSG_BUFF_SIZE];
+    msg_t msg;
     
     if(game) {
         /* Game is running and client is playing */
@@ -924,17 +840,19 @@ void roll_die(client_t *client) {
             game->game_state.playing_rolled_times++;
             
             /* Send client which number he rolled */
-            sprintf(buff, "ROLLED_DIE;%d", rolled);
-            broadcast_game(game, buff, client, 1);
+            msg_begin_buff(&msg, buff, sizeof(buff), MSG_ROLLED_DIE);
+            msg_int(&msg, rolled);
+            broadcast_game(game, &msg, client, 1);
             
             /* Log */
-            sprintf(log_buffer,
+            LOG_TEXT(LOG_DEBUG,
                     "Client with index %d rolled number %d",
                     client->client_index,
                     rolled
                     );
             
-            log_line(log_buffer, LOG_DEBUG);
+            LOG_EVENT(LOG_DEBUG, EV_DIE_ROLLED, client->client_index, game->game_index, 0,
+                    0, rolled, 0, 0);
             
             /* Player hs no figures that can move */
             if(!can_player_play(game, game->game_state.playing)) {
@@ -961,9 +879,6 @@ void roll_die(client_t *client) {
         else {
             send_game_state(client, game);
         }
-        
-        /* Release game */
-        release_game(game);
     }
 }
 
@@ -973,34 +888,14 @@ void roll_die(client_t *client) {
  * Notifies all players in given game which player will be playing next
  */
 void broadcast_game_playing_index(game_t *game, client_t *skip) {
-    char *buff = get_playing_index_message(game);
-    
-    broadcast_game(game, buff, skip, 1);
-    
-    free(buff);
-}
-
-/**
- * char* get_playing_index_message(game_t *game)
- * 
- * Creates message which informs players, who is playing
- */
-char* get_playing_index_message(game_t *game) {
-    char *buff, play_time_buff[11];
-    int len;
-    
-    sprintf(play_time_buff, "%u", GAME_MAX_PLAY_TIME_SEC);
+    char buff[MSG_BUFF_SIZE];
+    msg_t msg;
     
-    len = (17 + strlen(play_time_buff));
-    buff = (char *) malloc(len);
+    msg_begin_buff(&msg, buff, sizeof(buff), MSG_PLAYING_INDEX);
+    msg_int(&msg, game->game_state.playing);
+    msg_uint(&msg, GAME_MAX_PLAY_TIME_SEC);
     
-    sprintf(buff,
-            "PLAYING_INDEX;%d;%d",
-            game->game_state.playing,
-            GAME_MAX_PLAY_TIME_SEC
-            );
-    
-    return buff;
+    broadcast_game(game, &msg, skip, 1);
 }
 
 /**
@@ -1233,8 +1128,10 @@ void move_figure(client_t *client, unsigned int figure_index) {
     game_t *game;
     unsigned int dest_index;
     int removed_figure;
+    int moved = 0;
     int i;
-    char *buff;
+    char buff[MSG_BUFF_SIZE];
+    msg_t msg;
     
     if(client && client->game_index != -1) {
         game = get_game_by_index(client->game_index);
@@ -1253,8 +1150,6 @@ void move_figure(client_t *client, unsigned int figure_index) {
                         /* Check if figure can move by given number */
                         if(can_figure_move(game, figure_index, &dest_index)) {
                             
-                            buff = (char *) malloc(19);
-                            
                             /* Update positions */
                             if(game->game_state.fields[dest_index] != -1) {
                                 /* Get index of removed figure */
@@ -1265,47 +1160,43 @@ void move_figure(client_t *client, unsigned int figure_index) {
                                 /* Link back from field to figure */
                                 game->game_state.fields[game->game_state.figures[removed_figure]] = removed_figure;
                                 
-                                sprintf(buff,
-                                        "FIGURE_MOVED;%d;%d",
-                                        removed_figure,
-                                        game->game_state.figures[removed_figure]
-                                        );
+                                msg_begin_buff(&msg, buff, sizeof(buff), MSG_FIGURE_MOVED);
+                                msg_int(&msg, removed_figure);
+                                msg_int(&msg, game->game_state.figures[removed_figure]);
 
                                 /* Broadcast game */
-                                broadcast_game(game, buff, client, 1);
+                                broadcast_game(game, &msg, client, 1);
                             }
                             
                             game->game_state.fields[game->game_state.figures[figure_index]] = -1;
                             game->game_state.figures[figure_index] = dest_index;
                             game->game_state.fields[dest_index] = figure_index;
+                            moved = 1;
                                                         
-                            /* Prepare buffer */
-                            sprintf(buff, 
-                                    "FIGURE_MOVED;%u;%u",
-                                    figure_index,
-                                    dest_index
-                                    );
+                            /* Prepare message */
+                            msg_begin_buff(&msg, buff, sizeof(buff), MSG_FIGURE_MOVED);
+                            msg_uint(&msg, figure_index);
+                            msg_uint(&msg, dest_index);
 
                             /* Broadcast game */
-                            broadcast_game(game, buff, client, 1);
-                            
-                            free(buff);
+                            broadcast_game(game, &msg, client, 1);
                             
                             /* Log */
-                            sprintf(log_buffer,
+                            LOG_TEXT(LOG_DEBUG,
                                     "Client with index %d moved figure to field %d",
                                     client->client_index,
                                     dest_index
                                     );
                             
-                            log_line(log_buffer, LOG_DEBUG);
+                            LOG_EVENT(LOG_DEBUG, EV_FIGURE_MOVED, client->client_index, game->game_index, 0,
+                                    0, dest_index, 0, 0);
                             
                             /* Check if player finished */
                             if(dest_index >= 40 && has_all_figures_at_home(game, game->game_state.playing)) {
                                 for(i = 0; i < 4; i++) {
                                     if(game->game_state.finished[i] == -1) {
                                         /* Log */
-                                        sprintf(log_buffer,
+                                        LOG_TEXT(LOG_DEBUG,
                                                 "Client with index %d in game with code %s and index %d finished at pos %d",
                                                 client->client_index,
                                                 game->code,
@@ -1313,7 +1204,8 @@ void move_figure(client_t *client, unsigned int figure_index) {
                                                 i
                                                 );
                                         
-                                        log_line(log_buffer, LOG_DEBUG);
+                                        LOG_EVENT(LOG_DEBUG, EV_PLAYER_FINISHED, client->client_index, game->game_index, 0,
+                                                evlog_pack_code(game->code), i, 0, 0);
                                         
                                         game->game_state.finished[i] = game->game_state.playing;
                                         
@@ -1325,13 +1217,14 @@ void move_figure(client_t *client, unsigned int figure_index) {
                             /* Game is over */
                             if(dest_index >= 40 && all_players_finished(game)) {      
                                 /* Log */
-                                sprintf(log_buffer,
+                                LOG_TEXT(LOG_DEBUG,
                                         "All players in game with code %s and index %d finished",
                                         game->code,
                                         game->game_index
                                         );
                                 
-                                log_line(log_buffer, LOG_DEBUG);
+                                LOG_EVENT(LOG_DEBUG, EV_GAME_FINISHED, -1, game->game_index, 0,
+                                        evlog_pack_code(game->code), 0, 0, 0);
                                 
                                 broadcast_game_finish(game, client);
                                 
@@ -1351,12 +1244,8 @@ void move_figure(client_t *client, unsigned int figure_index) {
 
                                 }
 
-                                buff = get_playing_index_message(game);
-
                                 /* Broadcast game */
-                                broadcast_game(game, buff, client, 1);
-
-                                free(buff);
+                                broadcast_game_playing_index(game, client);
 
                                 /* Reset rolled number */
                                 game->game_state.playing_rolled = -1;
@@ -1377,11 +1266,13 @@ void move_figure(client_t *client, unsigned int figure_index) {
                 /* @TODO: send game_state */
             }
             /* @TODO: send game_state */
-            
-            /* Release game */
-            release_game(game);
         }
     }
+    
+    /* Move was rejected, client's view of the game may be out of sync */
+    if(client && !moved) {
+        dump_client_recorder(client, LOG_WARN, "invalid figure move");
+    }
 }
 
 /**
@@ -1476,17 +1367,31 @@ int has_all_figures_at_home(game_t *game, int player_index) {
  * standings for each player.
  */
 void broadcast_game_finish(game_t *game, client_t *skip) {
-    char msg[22];
+    char buff[MSG_BUFF_SIZE];
+    msg_t msg;
+    int i;
+    
+    msg_begin_buff(&msg, buff, sizeof(buff), MSG_GAME_FINISHED);
+    
+    for(i = 0; i < 4; i++) {
+        msg_int(&msg, game->game_state.finished[i]);
+    }
+    
+    broadcast_game(game, &msg, skip, 1);
+}
+
+/**
+ * void broadcast_game_left(game_t *game)
+ * 
+ * Informs all players in game that they left it (game timeouted).
+ */
+void broadcast_game_left(game_t *game) {
+    char buff[MSG_BUFF_SIZE];
+    msg_t msg;
     
-    sprintf(msg,
-            "GAME_FINISHED;%d;%d;%d;%d",
-            game->game_state.finished[0],
-            game->game_state.finished[1],
-            game->game_state.finished[2],
-            game->game_state.finished[3]
-            );
+    msg_begin_buff(&msg, buff, sizeof(buff), MSG_GAME_LEFT);
     
-    broadcast_game(game, msg, skip, 1);
+    broadcast_game(game, &msg, NULL, 0);
 }
 
 /**
@@ -1498,15 +1403,14 @@ void clear_all_games() {
     int i = 0;
     game_t *game;
     
-    for(i = 0; i < MAX_CONCURRENT_CLIENTS; i++) {
+    for(i = 0; i < cur_shard->games.capacity; i++) {
         game = get_game_by_index(i);
         
         if(game) {
-            games[i] = NULL;
+            index_map_remove(&cur_shard->game_map, code_key(game->code, GAME_CODE_LEN), i);
             free(game->code);
             
-            pthread_mutex_unlock(&game->mtx_game);
-            free(game);
+            slab_free(&cur_shard->games, i);
         }
     }
 }
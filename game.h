@@ -28,8 +28,8 @@
 #include <sys/time.h>
 
 #include "client.h"
+#include "com.h"
 
-extern unsigned int game_num;
 extern int force_roll;
 
 typedef struct {
@@ -64,9 +64,7 @@ typedef struct {
 } game_state_t;
 
 typedef struct {
-    /* Game mutex */
-    pthread_mutex_t mtx_game;
-    /* Game index */
+    /* Game index (in owning shard) */
     unsigned int game_index;
     
     /* Game state - 1 running, 0 waiting */
@@ -92,11 +90,10 @@ typedef struct {
 void generate_game_code(char *code, unsigned int iteration);
 game_t* get_game_by_code(char *code);
 game_t* get_game_by_index(unsigned int index);
-void release_game(game_t *game);
 void create_game(client_t *client);
 void send_game_state(client_t *client, game_t *game);
 void remove_game(game_t **game, client_t *client);
-void broadcast_game(game_t *game, char *msg, client_t *skip, int send_skip);
+void broadcast_game(game_t *game, msg_t *msg, client_t *skip, int send_skip);
 void broadcast_message(client_t *client, char *message);
 void join_game(client_t *client, char* game_code);
 void leave_game(client_t *client);
@@ -106,9 +103,9 @@ void set_game_playing(game_t *game);
 int player_has_figures_on_field(game_t *game, unsigned int player_index);
 int game_time_play_state_timeout(game_t *game);
 int game_time_before_timeout(game_t *game);
+long game_timeout_wait(game_t *game);
 void roll_die(client_t *client);
 void broadcast_game_playing_index(game_t *game, client_t *skip);
-char* get_playing_index_message(game_t *game);
 int can_player_play(game_t *game, unsigned int player_index);
 int can_figure_move(game_t *game, unsigned int figure_index, unsigned int *d_index);
 void move_figure(client_t *client, unsigned int figure_index);
@@ -117,6 +114,7 @@ int get_player_finish_pos(game_t *game, int index);
 int all_players_finished(game_t *game);
 int has_all_figures_at_home(game_t *game, int player_index);
 void broadcast_game_finish(game_t *game, client_t *skip);
+void broadcast_game_left(game_t *game);
 void clear_all_games();
 
 #endif	/* GAME_H */
@@ -27,108 +27,110 @@
 
 #include "game.h"
 #include "global.h"
+#include "com.h"
 #include "logger.h"
-
-/* Logger buffer */
-char log_buffer[LOG_BUFFER_SIZE];
+#include "shard.h"
 
 /**
- * void *start_watchdog(void *arg)
+ * long watchdog_pass()
  * 
- * Entry point for watchdog thread. Watchdog keeps looping and checking all
- * created games if any of them timeouted untill he is signalled by main thread
- * that he should finish.
+ * Checks all games of current shard if any of them timeouted. Returns time
+ * in microseconds before the earliest game timeout, or -1 if there are no
+ * games.
  */
-void *start_watchdog(void *arg) {
-    pthread_mutex_t *mtx = (pthread_mutex_t *) arg;
-    unsigned int got_games;
+long watchdog_pass() {
+    unsigned int got_games = 0;
+    /* Games can be removed during the pass */
+    unsigned int shard_games = cur_shard->games.count;
     int i;
     game_t *game;
+    /* Lowest time from all games before they timeout */
+    long wait = -1;
+    long game_wait;
     
-    while(!stop_thread(mtx)) {
-        got_games = 0;
+    for(i = 0; i < cur_shard->games.capacity && got_games < shard_games; i++) {
+        game = get_game_by_index(i);
         
-        for(i = 0; i < MAX_CONCURRENT_CLIENTS && got_games <= game_num; i++) {
-            game = get_game_by_index(i);
+        if(game) {
+            got_games++;
             
-            if(game) {
-                got_games++;
-                
-                /* Game is running */
-                if(game->state) {
-                    /* If player pick timeouted */
-                    if(game_time_before_timeout(game) < 0) {
-                        /* Check if there is another player that can play */
-                        if(game->player_num > 1) {
-                            /* If game stayed in active state without anyone
-                             *  playing for way too long 
-                             */
-                            if(game_time_play_state_timeout(game)) {
-                                /* Log */
-                                sprintf(log_buffer,
-                                        "Game with code %s and index %i TIMEOUT",
-                                        game->code,
-                                        game->game_index
-                                        );
-                                
-                                log_line(log_buffer, LOG_DEBUG);
-                                
-                                broadcast_game(game, "GAME_LEFT", NULL, 0);
-                                
-                                remove_game(&game, NULL);
-                            }
-                            else {
-                                set_game_playing(game);
-                                
-                                broadcast_game_playing_index(game, NULL);
-                            }
-                        }
-                        /* Only one player, remove game */
-                        else {
+            /* Game is running */
+            if(game->state) {
+                /* If player pick timeouted */
+                if(game_time_before_timeout(game) < 0) {
+                    /* Check if there is another player that can play */
+                    if(game->player_num > 1) {
+                        /* If game stayed in active state without anyone
+                         *  playing for way too long 
+                         */
+                        if(game_time_play_state_timeout(game)) {
                             /* Log */
-                            sprintf(log_buffer,
+                            LOG_TEXT(LOG_DEBUG,
                                     "Game with code %s and index %i TIMEOUT",
                                     game->code,
                                     game->game_index
                                     );
-
-                            log_line(log_buffer, LOG_DEBUG);
                             
-                            broadcast_game(game, "GAME_LEFT", NULL, 0);
+                            LOG_EVENT(LOG_DEBUG, EV_GAME_TIMEOUT, -1, game->game_index, 0,
+                                    evlog_pack_code(game->code), 0, 0, 0);
+                            
+                            broadcast_game_left(game);
                             
                             remove_game(&game, NULL);
                         }
+                        else {
+                            set_game_playing(game);
+                            
+                            broadcast_game_playing_index(game, NULL);
+                        }
                     }
-                }
-                /* Game is in lobby */
-                else {
-                    if(game_time_before_timeout(game) < 0) {
+                    /* Only one player, remove game */
+                    else {
                         /* Log */
-                        sprintf(log_buffer,
+                        LOG_TEXT(LOG_DEBUG,
                                 "Game with code %s and index %i TIMEOUT",
                                 game->code,
                                 game->game_index
                                 );
-
-                        log_line(log_buffer, LOG_DEBUG);
                         
-                        broadcast_game(game, "GAME_LEFT", NULL, 0);
+                        LOG_EVENT(LOG_DEBUG, EV_GAME_TIMEOUT, -1, game->game_index, 0,
+                                evlog_pack_code(game->code), 0, 0, 0);
+                        
+                        broadcast_game_left(game);
                         
                         remove_game(&game, NULL);
                     }
                 }
+            }
+            /* Game is in lobby */
+            else {
+                if(game_time_before_timeout(game) < 0) {
+                    /* Log */
+                    LOG_TEXT(LOG_DEBUG,
+                            "Game with code %s and index %i TIMEOUT",
+                            game->code,
+                            game->game_index
+                            );
+                    
+                    LOG_EVENT(LOG_DEBUG, EV_GAME_TIMEOUT, -1, game->game_index, 0,
+                            evlog_pack_code(game->code), 0, 0, 0);
+                    
+                    broadcast_game_left(game);
+                    
+                    remove_game(&game, NULL);
+                }
+            }
+            
+            if(game) {
+                /* Wake up when game timeouts */
+                game_wait = game_timeout_wait(game);
                 
-                if(game) {
-                    /* Release game */
-                    release_game(game);
+                if(wait < 0 || game_wait < wait) {
+                    wait = game_wait;
                 }
             }
         }
-        
-        /* Not much precision needed here, just sleep for a second */
-        sleep(1);
     }
     
-    log_line("SERV: Watchdog thread terminated.", LOG_ALWAYS);
-    pthread_exit(NULL);
+    return wait;
 }
@@ -25,7 +25,7 @@
 #define	GAME_WATCHDOG_H
 
 /* Function prototypes */
-void *start_watchdog(void *arg);
+long watchdog_pass();
 
 #endif	/* GAME_WATCHDOG_H */
 
@@ -36,9 +36,6 @@
 #include "logger.h"
 #include "server.h"
 
-/* Logger buffer */
-char log_buffer[LOG_BUFFER_SIZE];
-
 /**
  * void gen_random(char *s, const int len)
  * 
@@ -130,11 +127,10 @@ void display_uptime() {
     gettimeofday(&temp_tv, NULL);
 
     /* Elapsed time */
-    sprintf(log_buffer,
+    LOG_FMT(LOG_ALWAYS,
             "Server uptime: %01.0fh:%02.0fm:%02.0fs",
             floor( (temp_tv.tv_sec - ts_start.tv_sec) / 3600.),
             floor(fmod((temp_tv.tv_sec - ts_start.tv_sec), 3600.0) / 60.0),
             fmod((temp_tv.tv_sec - ts_start.tv_sec), 60.0)
             );
-    log_line(log_buffer, LOG_ALWAYS);
 }
@@ -29,12 +29,45 @@
 
 /* Application token identifying packets */
 #define APP_TOKEN A12B0698P
-/* Number of maximum concurrent clients (should be divisible by 4) */
+/* Default number of maximum concurrent clients (can be changed with -c) */
 #define MAX_CONCURRENT_CLIENTS 100
 /* Largest possible received dgram, indicates buffer size */
 #define MAX_DGRAM_SIZE 512
-/* Maximum number of microseconds tolerable before resending packet */
-#define MAX_PACKET_AGE_USEC 500000
+/* Default number of datagrams pulled from socket by one receiving call */
+#define DEFAULT_RECV_BATCH_SIZE 16
+/* Upper limit of datagrams pulled from socket by one receiving call */
+#define MAX_RECV_BATCH_SIZE 64
+/* Maximum number of outgoing datagrams flushed by one sending call */
+#define MAX_SEND_BATCH_SIZE 64
+/* Maximum number of shard threads (each with its own socket), shard
+ * is identified by one letter of game and reconnect codes
+ */
+#define MAX_SHARDS 26
+/* Capacity of client's outgoing datagram queue (power of two) */
+#define DGRAM_QUEUE_SIZE 64
+/* Maximum send window (packets waiting for ACK at once) a client can request,
+ * at most DGRAM_QUEUE_SIZE
+ */
+#define MAX_SEND_WINDOW 32
+/* Number of packets following ACK's base SEQ_ID covered by its SACK bitmap */
+#define SACK_BITMAP_BITS 32
+/* Number of client's packets ahead of expected one which are held until
+ * the gap is filled, at most SACK_BITMAP_BITS
+ */
+#define REORDER_WINDOW 8
+/* Maximum number of client packets held for reordering by one shard */
+#define MAX_REORDER_HELD 1024
+/* Retransmission timeout before first RTT sample of client (microseconds) */
+#define INIT_RTO_USEC 500000
+/* Maximum configurable delay of held ACKs (microseconds) */
+#define MAX_ACK_DELAY_USEC 200000
+/* Maximum configurable hold of datagram collecting coalesced messages
+ * (microseconds)
+ */
+#define MAX_COALESCE_DELAY_USEC 200000
+/* Bounds of adaptive retransmission timeout (microseconds) */
+#define MIN_RTO_USEC 20000
+#define MAX_RTO_USEC 4000000
 /* Maximum number of seconds with no response from client before changing his state */
 #define MAX_CLIENT_NORESPONSE_SEC 30
 /* Maximum number of seconds client can be marked as inactive before removing */
@@ -53,6 +86,9 @@
 #define _STRINGIFY(s) #s
 #define STRINGIFY(s) _STRINGIFY(s)
 
+/* Statistics are updated by several threads at once */
+#define STAT_ADD(var, n) __sync_fetch_and_add(&(var), (n))
+
 
 /* Function prototypes */
 void gen_random(char *s, const int len);
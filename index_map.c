@@ -0,0 +1,233 @@
+/** 
+ * -----------------------------------------------------------------------------
+ * Clovece nezlob se (Server) - simple board game
+ * 
+ * Server for board game Clovece nezlob se using UDP datagrams for communication
+ * with clients and SEND-AND-WAIT method to ensure that all packets arrive
+ * and that they arrive in correct order. 
+ * 
+ * Semestral work for "Uvod do pocitacovich siti" KIV/UPS at
+ * University of West Bohemia.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * File: index_map.c
+ * Description: Growable open-addressing hash table mapping keys (client's
+ *              address, reconnect or game code) to table indexes.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * @author: Martin Kucera, 2014
+ * @version: 1.02
+ * 
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <netinet/in.h>
+
+#include "index_map.h"
+
+/**
+ * unsigned int index_hash(uint64_t key, unsigned int size)
+ * 
+ * Returns home slot of given key in table of given size.
+ */
+static unsigned int index_hash(uint64_t key, unsigned int size) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    
+    return (unsigned int) key & (size - 1);
+}
+
+/**
+ * int index_map_find(index_map_t *map, uint64_t key)
+ * 
+ * Returns slot holding given key or -1 if key isn't present.
+ */
+static int index_map_find(index_map_t *map, uint64_t key) {
+    unsigned int slot = index_hash(key, map->size);
+    
+    /* Probe until first empty slot, table is never full */
+    while(map->entries[slot].used) {
+        if(map->entries[slot].key == key) {
+            return slot;
+        }
+        
+        slot = (slot + 1) & (map->size - 1);
+    }
+    
+    return -1;
+}
+
+/**
+ * void index_map_insert(index_entry_t *entries, unsigned int size, uint64_t key, int value)
+ * 
+ * Places key (known not to be present) to the first free slot of its run.
+ */
+static void index_map_insert(index_entry_t *entries, unsigned int size, uint64_t key, int value) {
+    unsigned int slot = index_hash(key, size);
+    
+    while(entries[slot].used) {
+        slot = (slot + 1) & (size - 1);
+    }
+    
+    entries[slot].key = key;
+    entries[slot].value = value;
+    entries[slot].used = 1;
+}
+
+/**
+ * int index_map_grow(index_map_t *map)
+ * 
+ * Doubles number of slots and rehashes all entries. Returns 0 if memory
+ * couldn't be allocated.
+ */
+static int index_map_grow(index_map_t *map) {
+    index_entry_t *entries;
+    unsigned int i;
+    
+    entries = (index_entry_t *) calloc(map->size * 2, sizeof(index_entry_t));
+    
+    if(!entries) {
+        return 0;
+    }
+    
+    for(i = 0; i < map->size; i++) {
+        if(map->entries[i].used) {
+            index_map_insert(entries, map->size * 2, map->entries[i].key, map->entries[i].value);
+        }
+    }
+    
+    free(map->entries);
+    
+    map->entries = entries;
+    map->size *= 2;
+    
+    return 1;
+}
+
+/**
+ * void index_map_init(index_map_t *map)
+ * 
+ * Allocates empty table.
+ */
+void index_map_init(index_map_t *map) {
+    map->entries = (index_entry_t *) calloc(INDEX_MAP_MIN_SIZE, sizeof(index_entry_t));
+    map->size = INDEX_MAP_MIN_SIZE;
+    map->count = 0;
+}
+
+/**
+ * void index_map_destroy(index_map_t *map)
+ * 
+ * Frees table's slots.
+ */
+void index_map_destroy(index_map_t *map) {
+    free(map->entries);
+    
+    map->entries = NULL;
+    map->size = 0;
+    map->count = 0;
+}
+
+/**
+ * int index_map_get(index_map_t *map, uint64_t key)
+ * 
+ * Returns index mapped to given key or -1 if there is none.
+ */
+int index_map_get(index_map_t *map, uint64_t key) {
+    int slot = index_map_find(map, key);
+    
+    return slot < 0 ? -1 : map->entries[slot].value;
+}
+
+/**
+ * int index_map_put(index_map_t *map, uint64_t key, int value)
+ * 
+ * Maps given key to index, replacing previous one. Returns 0 if table
+ * needed to grow but memory couldn't be allocated.
+ */
+int index_map_put(index_map_t *map, uint64_t key, int value) {
+    int found = index_map_find(map, key);
+    
+    if(found >= 0) {
+        map->entries[found].value = value;
+        
+        return 1;
+    }
+    
+    /* Keep load factor at most one half */
+    if((map->count + 1) * 2 > map->size && !index_map_grow(map)) {
+        return 0;
+    }
+    
+    index_map_insert(map->entries, map->size, key, value);
+    map->count++;
+    
+    return 1;
+}
+
+/**
+ * int index_map_remove(index_map_t *map, uint64_t key, int value)
+ * 
+ * Removes given key if it's mapped to index (negative value removes
+ * key regardless of its index). Following entries of the probe run are
+ * shifted back, so no tombstones are needed. Returns 1 if entry was removed.
+ */
+int index_map_remove(index_map_t *map, uint64_t key, int value) {
+    int slot = index_map_find(map, key);
+    unsigned int mask = map->size - 1;
+    unsigned int hole, next, home;
+    
+    if(slot < 0 || (value >= 0 && map->entries[slot].value != value)) {
+        return 0;
+    }
+    
+    hole = slot;
+    next = (hole + 1) & mask;
+    
+    while(map->entries[next].used) {
+        home = index_hash(map->entries[next].key, map->size);
+        
+        /* Entry can fill the hole if its home slot isn't between hole and entry */
+        if(((next - home) & mask) >= ((next - hole) & mask)) {
+            map->entries[hole] = map->entries[next];
+            hole = next;
+        }
+        
+        next = (next + 1) & mask;
+    }
+    
+    map->entries[hole].used = 0;
+    map->count--;
+    
+    return 1;
+}
+
+/**
+ * uint64_t addr_key(struct sockaddr_in *addr)
+ * 
+ * Makes key from client's IP address and port.
+ */
+uint64_t addr_key(struct sockaddr_in *addr) {
+    return (uint64_t) addr->sin_addr.s_addr << 16 | addr->sin_port;
+}
+
+/**
+ * uint64_t code_key(const char *code, int len)
+ * 
+ * Makes key from (at most 8 first) characters of reconnect or game code.
+ */
+uint64_t code_key(const char *code, int len) {
+    uint64_t key = 0;
+    int i;
+    
+    for(i = 0; i < len && i < 8 && code[i]; i++) {
+        key = key << 8 | (unsigned char) code[i];
+    }
+    
+    return key;
+}
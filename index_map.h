@@ -0,0 +1,62 @@
+/** 
+ * -----------------------------------------------------------------------------
+ * Clovece nezlob se (Server) - simple board game
+ * 
+ * Server for board game Clovece nezlob se using UDP datagrams for communication
+ * with clients and SEND-AND-WAIT method to ensure that all packets arrive
+ * and that they arrive in correct order. 
+ * 
+ * Semestral work for "Uvod do pocitacovich siti" KIV/UPS at
+ * University of West Bohemia.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * File: index_map.c
+ * Description: Growable open-addressing hash table mapping keys (client's
+ *              address, reconnect or game code) to table indexes.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * @author: Martin Kucera, 2014
+ * @version: 1.02
+ * 
+ */
+
+#ifndef INDEX_MAP_H
+#define	INDEX_MAP_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+/* Initial number of slots (power of two), table doubles when half full */
+#define INDEX_MAP_MIN_SIZE 256
+
+typedef struct {
+    /* Key */
+    uint64_t key;
+    /* Mapped index */
+    int value;
+    /* Slot is used */
+    unsigned short used;
+} index_entry_t;
+
+typedef struct {
+    /* Slots, linear probing */
+    index_entry_t *entries;
+    /* Number of slots */
+    unsigned int size;
+    /* Number of used slots */
+    unsigned int count;
+} index_map_t;
+
+/* Function prototypes */
+void index_map_init(index_map_t *map);
+void index_map_destroy(index_map_t *map);
+int index_map_get(index_map_t *map, uint64_t key);
+int index_map_put(index_map_t *map, uint64_t key, int value);
+int index_map_remove(index_map_t *map, uint64_t key, int value);
+uint64_t addr_key(struct sockaddr_in *addr);
+uint64_t code_key(const char *code, int len);
+
+#endif	/* INDEX_MAP_H */
+
@@ -0,0 +1,183 @@
+/** 
+ * -----------------------------------------------------------------------------
+ * Clovece nezlob se (Server) - simple board game
+ * 
+ * Server for board game Clovece nezlob se using UDP datagrams for communication
+ * with clients and SEND-AND-WAIT method to ensure that all packets arrive
+ * and that they arrive in correct order.
+ * 
+ * Semestral work for "Uvod do pocitacovich siti" KIV/UPS at
+ * University of West Bohemia.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * File: logdump.c
+ * Description: cns_logdump - converts binary log of the server to text
+ *              log format or CSV.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * @author: Martin Kucera, 2014
+ * @version: 1.02
+ * 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "err.h"
+#include "logger.h"
+#include "evlog.h"
+
+/* Output formats */
+#define DUMP_TEXT 0
+#define DUMP_CSV 1
+
+#define EVLOG_NAME(name, format) #name,
+
+/* Names of events indexed by event ID */
+static const char *event_names[EV_COUNT] = {
+    EVLOG_TABLE(EVLOG_NAME)
+};
+
+/**
+ * void help()
+ * 
+ * Prints brief help, basic program usage.
+ */
+void help() {
+    printf("NAME:\n");
+    printf("\t\t cns_logdump - Converts binary log of cns_server\n");
+    
+    printf("--------------------------------------------------\n");
+    printf("USAGE:\n");
+    printf("\t\t cns_logdump [-c] <logfile>\n");
+    
+    printf("--------------------------------------------------\n");
+    printf("OPTIONS:\n");
+    printf("\t\t -c - Output CSV instead of text log format.\n");
+    
+    printf("\n\n");
+}
+
+/**
+ * void dump_text(evlog_record_t *rec, char *line, int len)
+ * 
+ * Prints line formatted from record in text log format.
+ */
+void dump_text(evlog_record_t *rec, char *line, int len) {
+    time_t sec = (time_t) (rec->usec / 1000000);
+    char timestamp[25];
+    
+    strftime(timestamp, 25, "%d.%m.%y, %H:%M:%S: ", localtime(&sec));
+    
+    fputs(timestamp, stdout);
+    fwrite(line, 1, len, stdout);
+    fputc('\n', stdout);
+}
+
+/**
+ * void dump_csv(evlog_record_t *rec, char *line, int len)
+ * 
+ * Prints record and line formatted from it as CSV row.
+ */
+void dump_csv(evlog_record_t *rec, char *line, int len) {
+    int i;
+    
+    printf("%llu.%06u,%s,%d,%u,%d,%d,%d,%d,%d,%d,%d,\"",
+            (unsigned long long) (rec->usec / 1000000),
+            (unsigned int) (rec->usec % 1000000),
+            rec->event < EV_COUNT ? event_names[rec->event] : "UNKNOWN",
+            rec->severity,
+            rec->shard,
+            rec->client,
+            rec->game,
+            rec->seq,
+            rec->args[0],
+            rec->args[1],
+            rec->args[2],
+            rec->args[3]
+            );
+    
+    for(i = 0; i < len; i++) {
+        if(line[i] == '"') {
+            fputc('"', stdout);
+        }
+        
+        fputc(line[i], stdout);
+    }
+    
+    fputs("\"\n", stdout);
+}
+
+/**
+ * int main(int argc, char **argv)
+ * 
+ * Reads binary log file record by record and prints them.
+ */
+int main(int argc, char **argv) {
+    FILE *file;
+    evlog_header_t header;
+    evlog_state_t state;
+    evlog_record_t rec;
+    char text[LOG_BUFFER_SIZE];
+    char line[LOG_BUFFER_SIZE];
+    int format = DUMP_TEXT;
+    int status;
+    int len;
+    int opt;
+    
+    while((opt = getopt(argc, argv, "c")) != -1) {
+        switch(opt) {
+            case 'c':
+                format = DUMP_CSV;
+                break;
+            
+            default:
+                help();
+                raise_error("Invalid arguments.\n");
+        }
+    }
+    
+    if(optind >= argc) {
+        help();
+        raise_error("Missing log file.\n");
+    }
+    
+    if((file = fopen(argv[optind], "rb")) == NULL) {
+        raise_error("Error opening log file.\n");
+    }
+    
+    if(fread(&header, sizeof(header), 1, file) != 1 || !evlog_check_header(&header)) {
+        raise_error("File isn't a binary log of compatible server.\n");
+    }
+    
+    if(format == DUMP_CSV) {
+        printf("time,event,severity,shard,client,game,seq,arg0,arg1,arg2,arg3,text\n");
+    }
+    
+    evlog_init_state(&state);
+    
+    while((status = evlog_read(file, &state, &rec, text, LOG_BUFFER_SIZE)) > 0) {
+        len = evlog_format(&rec, text, line, LOG_BUFFER_SIZE);
+        
+        if(format == DUMP_CSV) {
+            dump_csv(&rec, line, len);
+        }
+        else {
+            dump_text(&rec, line, len);
+        }
+    }
+    
+    fclose(file);
+    
+    if(status < 0) {
+        raise_error("Log file is truncated or corrupted.\n");
+    }
+    
+    return (EXIT_SUCCESS);
+}
+
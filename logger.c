@@ -12,7 +12,9 @@
  * -----------------------------------------------------------------------------
  * 
  * File: logger.c
- * Description: Handles all logging.
+ * Description: Handles all logging. Log lines and events are pushed to
+ *              lock-free ring and written to file and console by logger
+ *              thread. Log file is either text or binary (event records).
  * 
  * -----------------------------------------------------------------------------
  * 
@@ -26,49 +28,345 @@
 #include <time.h>
 #include <pthread.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
 
 #include "global.h"
 #include "err.h"
+#include "event.h"
 #include "logger.h"
 
+/* Record goes to log file */
+#define LOG_TO_FILE 1
+/* Record goes to console */
+#define LOG_TO_CONSOLE 2
+
+typedef struct {
+    /* Ring position record is ready for (written when record is published
+     * and when it is consumed)
+     */
+    unsigned int seq;
+    /* Where record goes (LOG_TO_FILE, LOG_TO_CONSOLE) */
+    int dest;
+    /* Record is an event, it has no message */
+    int is_event;
+    /* Time when line was logged */
+    time_t time;
+    /* Event, in binary log it is also header of logged line */
+    evlog_record_t event;
+    /* Length of message */
+    int len;
+    /* Message */
+    char msg[LOG_BUFFER_SIZE];
+} log_record_t;
+
 /* Current log level, can be changed during runtime */
 int log_level = LOG_WARN;
 /* Current verbose level, can be changed during runtime  */
 int verbose_level = LOG_INFO;
+/* Number of records dropped because logger's ring was full */
+unsigned int log_dropped = 0;
+/* Format of log file */
+int log_format = LOG_FORMAT_TEXT;
+
+/* Logger buffer */
+__thread char log_buffer[LOG_BUFFER_SIZE];
+/* Shard of calling thread written to its events */
+__thread int log_shard = 0;
 
 /* Output logfile */
 FILE *logfile = NULL;
 
-/* Timer used for timestamp */
-time_t timer;
-/* Tm info */
-struct tm *tm_info;
+/* Records waiting for logger thread (multiple producers, one consumer) */
+static log_record_t log_ring[LOG_RING_SIZE];
+/* Next position taken by producer */
+static unsigned int log_ring_tail = 0;
+/* Next position consumed by logger thread */
+static unsigned int log_ring_head = 0;
+
+/* Logger thread */
+static pthread_t log_thread;
+/* Logger thread is running */
+static int log_thread_running = 0;
+/* Logger thread sleeps waiting for records */
+static int log_thread_idle = 0;
+/* Logger thread should finish */
+static int log_thread_stop = 0;
+/* Wakes up logger thread */
+static int log_thread_event = -1;
+
+/* Cached timestamp of the last written record */
+static time_t timestamp_time = -1;
+static char timestamp[25];
+/* Text of event written by logger thread */
+static char event_line[LOG_BUFFER_SIZE];
+/* Encoding state of binary log file */
+static evlog_state_t evlog_state;
+/* Encoded record written by logger thread */
+static char evlog_buffer[EVLOG_MAX_RECORD];
+
+/**
+ * int write_records()
+ * 
+ * Writes all published records to log file and console. Timestamp is
+ * formatted once per second. Returns number of written records. Only
+ * logger thread (or init_logger and stop_logger while it isn't running)
+ * can consume records.
+ */
+static int write_records() {
+    log_record_t *rec;
+    int written = 0;
+    int len;
+    
+    for(;;) {
+        rec = &log_ring[log_ring_head & (LOG_RING_SIZE - 1)];
+        
+        if(__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) != log_ring_head + 1) {
+            break;
+        }
+        
+        if(rec->time != timestamp_time) {
+            timestamp_time = rec->time;
+            strftime(timestamp, 25, "%d.%m.%y, %H:%M:%S: ", localtime(&timestamp_time));
+        }
+        
+        /* Events are formatted only if they are written as text */
+        if(rec->is_event && (log_format == LOG_FORMAT_TEXT || (rec->dest & LOG_TO_CONSOLE))) {
+            rec->len = evlog_format(&rec->event, NULL, event_line, LOG_BUFFER_SIZE);
+        }
+        
+        /* Write to log file */
+        if((rec->dest & LOG_TO_FILE) && log_format == LOG_FORMAT_BINARY) {
+            len = evlog_encode(&evlog_state, &rec->event, evlog_buffer);
+            fwrite(evlog_buffer, 1, len, logfile);
+            
+            if(!rec->is_event) {
+                fwrite(rec->msg, 1, rec->len, logfile);
+            }
+        }
+        else if(rec->dest & LOG_TO_FILE) {
+            fputs(timestamp, logfile);
+            fwrite(rec->is_event ? event_line : rec->msg, 1, rec->len, logfile);
+            fputc('\n', logfile);
+        }
+        
+        /* Write to console */
+        if(rec->dest & LOG_TO_CONSOLE) {
+            fputs(timestamp, stdout);
+            fwrite(rec->is_event ? event_line : rec->msg, 1, rec->len, stdout);
+            fputc('\n', stdout);
+        }
+        
+        /* Release slot to producers */
+        __atomic_store_n(&rec->seq, log_ring_head + LOG_RING_SIZE, __ATOMIC_RELEASE);
+        log_ring_head++;
+        written++;
+    }
+    
+    return written;
+}
+
+/**
+ * void *run_logger(void *arg)
+ * 
+ * Logger thread, writes records in batches as long as there are any.
+ * Outputs are flushed once ring is empty, then the thread sleeps until
+ * some producer wakes it up.
+ */
+static void *run_logger(void *arg) {
+    int loop = create_event_loop(&log_thread_event, 1);
+    int ready;
+    
+    for(;;) {
+        if(write_records()) {
+            continue;
+        }
+        
+        fflush(logfile);
+        fflush(stdout);
+        
+        if(__atomic_load_n(&log_thread_stop, __ATOMIC_SEQ_CST)) {
+            break;
+        }
+        
+        /* Records published after this are followed by wake up */
+        __atomic_store_n(&log_thread_idle, 1, __ATOMIC_SEQ_CST);
+        
+        if(__atomic_load_n(&log_ring[log_ring_head & (LOG_RING_SIZE - 1)].seq, __ATOMIC_SEQ_CST) != log_ring_head + 1 &&
+                !__atomic_load_n(&log_thread_stop, __ATOMIC_SEQ_CST)) {
+            wait_events(loop, &ready, 1);
+            clear_event(log_thread_event);
+        }
+        
+        __atomic_store_n(&log_thread_idle, 0, __ATOMIC_SEQ_CST);
+    }
+    
+    close(loop);
+    
+    return NULL;
+}
+
+/**
+ * void open_binary_log()
+ * 
+ * Writes header of binary log file to new file, existing file has to be
+ * binary log written by compatible server.
+ */
+static void open_binary_log() {
+    evlog_header_t header;
+    
+    /* First record of session has absolute timestamp */
+    evlog_init_state(&evlog_state);
+    
+    fseek(logfile, 0, SEEK_END);
+    
+    if(ftell(logfile) == 0) {
+        evlog_init_header(&header);
+        fwrite(&header, sizeof(header), 1, logfile);
+        
+        return;
+    }
+    
+    rewind(logfile);
+    
+    if(fread(&header, sizeof(header), 1, logfile) != 1 || !evlog_check_header(&header)) {
+        fclose(logfile);
+        logfile = NULL;
+        
+        raise_error("Logging file isn't a compatible binary log\n");
+    }
+    
+    fseek(logfile, 0, SEEK_END);
+}
 
 /**
  * void init_logger(char *filename)
  * 
- * Opens file with filename in append mode and writes info about new logging
- * session.
+ * Opens file with filename in append mode, writes info about new logging
+ * session and starts logger thread.
  */
 void init_logger(char *filename) {
-    char *buff;
+    unsigned int i;
+    
+    for(i = 0; i < LOG_RING_SIZE; i++) {
+        log_ring[i].seq = i;
+    }
     
     if((logfile = fopen(filename, "a+")) == NULL) {
         raise_error("Error opening logging file\n");
     }
     
-    buff = (char *) malloc(strlen(filename) + 19);
+    setvbuf(logfile, NULL, _IOFBF, LOG_FILE_BUFFER_SIZE);
+    
+    if(log_format == LOG_FORMAT_BINARY) {
+        open_binary_log();
+    }
     
-    sprintf(buff,
-            "Logging to file: %s",
+    sprintf(log_buffer,
+            "Logging to file: %.*s",
+            LOG_BUFFER_SIZE - 20,
             filename
             );
     
-    log_line(buff, LOG_ALWAYS);
+    log_line(log_buffer, LOG_ALWAYS);
+    
+    /* Logger thread isn't running yet */
+    write_records();
+    
+    if(log_format == LOG_FORMAT_TEXT) {
+        fprintf(logfile, "\n--------------------------------------------------------\n");
+    }
     
-    free(buff);
-    fprintf(logfile, "\n--------------------------------------------------------\n");
     log_line("Logger started", LOG_ALWAYS);
+    
+    log_thread_event = create_event();
+    
+    if(pthread_create(&log_thread, NULL, run_logger, NULL) != 0) {
+        raise_error("Error creating logger thread\n");
+    }
+    
+    log_thread_running = 1;
+}
+
+/**
+ * log_record_t *claim_record(int severity, unsigned int *pos)
+ * 
+ * Takes free record in logger's ring for message of given severity and
+ * fills its destination and time. Returns NULL if message isn't logged
+ * anywhere or if ring is full (message is dropped and counted in
+ * log_dropped then).
+ */
+static log_record_t *claim_record(int severity, unsigned int *pos) {
+    log_record_t *rec;
+    struct timeval tv;
+    int diff;
+    int dest = 0;
+    
+    if(!logfile) {
+        return NULL;
+    }
+    
+    if(severity <= log_level) {
+        dest |= LOG_TO_FILE;
+    }
+    
+    if(severity <= verbose_level) {
+        dest |= LOG_TO_CONSOLE;
+    }
+    
+    if(!dest) {
+        return NULL;
+    }
+    
+    /* Take free slot */
+    *pos = __atomic_load_n(&log_ring_tail, __ATOMIC_RELAXED);
+    
+    for(;;) {
+        rec = &log_ring[*pos & (LOG_RING_SIZE - 1)];
+        diff = (int) (__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) - *pos);
+        
+        if(diff == 0) {
+            if(__atomic_compare_exchange_n(&log_ring_tail, pos, *pos + 1, 1,
+                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        }
+        /* Logger thread didn't consume this slot yet, ring is full */
+        else if(diff < 0) {
+            __sync_fetch_and_add(&log_dropped, 1);
+            
+            return NULL;
+        }
+        /* Other producer took the slot */
+        else {
+            *pos = __atomic_load_n(&log_ring_tail, __ATOMIC_RELAXED);
+        }
+    }
+    
+    gettimeofday(&tv, NULL);
+    
+    rec->dest = dest;
+    rec->time = tv.tv_sec;
+    rec->event.usec = (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+    rec->event.severity = severity;
+    rec->event.shard = log_shard;
+    
+    return rec;
+}
+
+/**
+ * void publish_record(log_record_t *rec, unsigned int pos)
+ * 
+ * Hands filled record over to logger thread, wakes it up if it sleeps.
+ */
+static void publish_record(log_record_t *rec, unsigned int pos) {
+    __atomic_store_n(&rec->seq, pos + 1, __ATOMIC_SEQ_CST);
+    
+    /* Only one producer wakes up sleeping logger thread */
+    if(__atomic_load_n(&log_thread_idle, __ATOMIC_SEQ_CST) &&
+            __sync_bool_compare_and_swap(&log_thread_idle, 1, 0)) {
+        signal_event(log_thread_event);
+    }
 }
 
 /**
@@ -76,51 +374,101 @@ void init_logger(char *filename) {
  * 
  * Logs given message. If severity is below or equal to log_level, message
  * is written to log file. If severity is below or equal to verbose_level, message
- * is written to console. Both can happen
+ * is written to console. Both can happen.
+ * 
+ * Message is copied to logger's ring and written later by logger thread,
+ * calling thread never waits for it. If ring is full, message is dropped
+ * and counted in log_dropped.
  */
 int log_line(char *msg, int severity) {
-    char timestamp[25];
-    char *buff;
+    log_record_t *rec;
+    unsigned int pos;
     
-    if(logfile && (severity <= log_level || severity <= verbose_level)) {
-        time(&timer);
-        tm_info = localtime(&timer);
-
-        strftime(timestamp, 25, "%d.%m.%y, %H:%M:%S: ", tm_info);
-
-        buff = (char *) malloc(strlen(msg) + 27);
-
-        sprintf(buff,
-                "%s%s\n",
-                timestamp,
-                msg
-                );
+    if((rec = claim_record(severity, &pos)) == NULL) {
+        return 0;
+    }
+    
+    rec->is_event = 0;
+    rec->len = strlen(msg);
+    
+    if(rec->len >= LOG_BUFFER_SIZE) {
+        rec->len = LOG_BUFFER_SIZE - 1;
+    }
+    
+    memcpy(rec->msg, msg, rec->len);
+    
+    /* Line in binary log */
+    rec->event.event = EV_TEXT;
+    rec->event.client = -1;
+    rec->event.game = -1;
+    rec->event.seq = 0;
+    rec->event.args[0] = rec->len;
+    rec->event.args[1] = rec->event.args[2] = rec->event.args[3] = 0;
+    
+    publish_record(rec, pos);
+    
+    return 1;
+}
 
-        /* Write to log file */
-        if(severity <= log_level) {
-            fputs(buff, logfile);
-	    fflush(logfile);
-        }
-        
-        /* Write to console */
-        if(severity <= verbose_level) {
-            fputs(buff, stdout);
-        }
-        
-        free(buff);
-        
-        return 1;
+/**
+ * int log_event(int severity, int event, int client, int game, int seq, int arg0, int arg1, int arg2, int arg3)
+ * 
+ * Logs event with given numeric fields (see EVLOG_TABLE for meaning of
+ * arguments). Nothing is formatted by calling thread, binary log file gets
+ * the record as it is and logger thread formats it only for console
+ * or text log file. Severity is handled the same way as in log_line.
+ */
+int log_event(int severity, int event, int client, int game, int seq, int arg0, int arg1, int arg2, int arg3) {
+    log_record_t *rec;
+    unsigned int pos;
+    
+    if((rec = claim_record(severity, &pos)) == NULL) {
+        return 0;
     }
     
-    return 0;
+    rec->is_event = 1;
+    rec->event.event = event;
+    rec->event.client = client;
+    rec->event.game = game;
+    rec->event.seq = seq;
+    rec->event.args[0] = arg0;
+    rec->event.args[1] = arg1;
+    rec->event.args[2] = arg2;
+    rec->event.args[3] = arg3;
+    
+    publish_record(rec, pos);
+    
+    return 1;
 }
 
 /**
  * void stop_logger()
  * 
- * Logs message indicating that logger is stopping and closes logfile
+ * Logs message indicating that logger is stopping, waits until logger
+ * thread writes all records and closes logfile
  */
 void stop_logger() {
+    if(!logfile) {
+        return;
+    }
+    
     log_line("Stopping logger", LOG_ALWAYS);
+    
+    if(log_thread_running) {
+        __atomic_store_n(&log_thread_stop, 1, __ATOMIC_SEQ_CST);
+        signal_event(log_thread_event);
+        
+        pthread_join(log_thread, NULL);
+        
+        log_thread_running = 0;
+        close(log_thread_event);
+    }
+    
+    /* Records published while thread was finishing */
+    write_records();
+    
     fclose(logfile);
+    fflush(stdout);
+    
+    logfile = NULL;
 }
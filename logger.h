@@ -24,6 +24,10 @@
 #ifndef LOGGER_H
 #define	LOGGER_H
 
+#include <stdio.h>
+
+#include "evlog.h"
+
 /* Log levels */
 #define LOG_ALWAYS -1
 #define LOG_NONE 0
@@ -35,14 +39,95 @@
 
 #define DEFAULT_LOGFILE ups_servlog.log
 
+/* Log file formats */
+#define LOG_FORMAT_TEXT 0
+#define LOG_FORMAT_BINARY 1
+
 #define LOG_BUFFER_SIZE 1024
+/* Number of records in logger's ring (power of 2) */
+#define LOG_RING_SIZE 1024
+/* Size of logfile's stdio buffer */
+#define LOG_FILE_BUFFER_SIZE 65536
 
 extern int log_level;
 extern int verbose_level;
+/* Number of records dropped because logger's ring was full */
+extern unsigned int log_dropped;
+/* Format of log file (LOG_FORMAT_TEXT, LOG_FORMAT_BINARY) */
+extern int log_format;
+
+/* Each thread formats its log lines into its own buffer */
+extern __thread char log_buffer[LOG_BUFFER_SIZE];
+/* Shard of calling thread written to its events */
+extern __thread int log_shard;
+
+/* Highest severity compiled in, log calls of higher severities are removed
+ * by compiler (make LOG_FLOOR=3 builds server without debug logging)
+ */
+#ifndef LOG_FLOOR
+#define LOG_FLOOR LOG_ALL
+#endif
+
+/* Checks if message of given severity would be logged, before anything
+ * is formatted
+ */
+#define LOG_ENABLED(severity) \
+    ((severity) <= LOG_FLOOR && ((severity) <= log_level || (severity) <= verbose_level))
+
+/* Checks if text line of given severity should be formatted, call sites
+ * logging the same thing as event skip their text in binary log
+ */
+#define LOG_TEXT_ENABLED(severity) \
+    (log_format == LOG_FORMAT_TEXT && LOG_ENABLED(severity))
+
+/* Checks if event of given severity would be logged */
+#define LOG_EVENT_ENABLED(severity) \
+    (log_format == LOG_FORMAT_BINARY && LOG_ENABLED(severity))
+
+/* Formats message into calling thread's log_buffer and logs it, arguments
+ * aren't evaluated at all if severity isn't logged
+ */
+#define LOG_FMT(severity, ...) \
+    do { \
+        if(LOG_ENABLED(severity)) { \
+            snprintf(log_buffer, LOG_BUFFER_SIZE, __VA_ARGS__); \
+            log_line(log_buffer, (severity)); \
+        } \
+    } while(0)
+
+/* Same as LOG_FMT, but only in text log (call site logs the same thing
+ * as event in binary log)
+ */
+#define LOG_TEXT(severity, ...) \
+    do { \
+        if(LOG_TEXT_ENABLED(severity)) { \
+            snprintf(log_buffer, LOG_BUFFER_SIZE, __VA_ARGS__); \
+            log_line(log_buffer, (severity)); \
+        } \
+    } while(0)
+
+/* Logs constant message */
+#define LOG_LINE(severity, msg) \
+    do { \
+        if(LOG_ENABLED(severity)) { \
+            log_line((msg), (severity)); \
+        } \
+    } while(0)
+
+/* Logs event (see log_event) in binary log, arguments aren't evaluated
+ * at all if severity isn't logged
+ */
+#define LOG_EVENT(severity, ...) \
+    do { \
+        if(LOG_EVENT_ENABLED(severity)) { \
+            log_event((severity), __VA_ARGS__); \
+        } \
+    } while(0)
 
 /* Function prototypes */
 void init_logger(char *filename);
 int log_line(char *msg, int severity);
+int log_event(int severity, int event, int client, int game, int seq, int arg0, int arg1, int arg2, int arg3);
 void stop_logger();
 
 #endif	/* LOGGER_H */
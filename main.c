@@ -25,34 +25,28 @@
 #include <stdlib.h>
 #include <pthread.h>
 #include <string.h>
+#include <unistd.h>
+#include <time.h>
 #include <arpa/inet.h>
 
 #include "server.h"
 #include "err.h"
 #include "receiver.h"
-#include "sender.h"
 #include "game.h"
-#include "game_watchdog.h"
+#include "shard.h"
 #include "com.h"
+#include "event.h"
+#include "uring.h"
 #include "logger.h"
 #include "global.h"
+#include "proto.h"
+#include "capture.h"
 
-/* Receiver thread */
-pthread_t thr_receiver; 
-/* Sender thread */
-pthread_t thr_sender; 
-/* Watchdog thread */
-pthread_t thr_watchdog;
+/* Shard threads */
+pthread_t thr_shard[MAX_SHARDS]; 
 
-/* Receiver mutex (if unclocked, receiver thread stops) */
-pthread_mutex_t mtx_thr_receiver; 
-/* Sender mutex (if unclocked, sender thread stops) */
-pthread_mutex_t mtx_thr_sender; 
-/* Watchdog mutex (if unclocked, Watchdog thread stops) */
-pthread_mutex_t mtx_thr_watchdog;
-
-/* Logger buffer */
-char log_buffer[LOG_BUFFER_SIZE];
+/* Shard mutexes (if unclocked, shard thread stops) */
+pthread_mutex_t mtx_thr_shard[MAX_SHARDS]; 
 
 /**
 * void help()
@@ -65,7 +59,7 @@ void help() {
     
     printf("--------------------------------------------------\n");
     printf("USAGE:\n");
-    printf("\t\t server_cns <ip> <port> [logfile] [log_severity] [verbose_severity]\n");
+    printf("\t\t server_cns [options] <ip> <port> [logfile] [log_severity] [verbose_severity]\n");
     
     printf("--------------------------------------------------\n");
     printf("EXAMPLE:\n");
@@ -73,6 +67,11 @@ void help() {
     printf("\t\t server_cns 0.0.0.0 1337 debug_log.log\n");
     printf("\t\t server_cns 0.0.0.0 1337 debug_log.log 4\n");
     printf("\t\t server_cns 0.0.0.0 1337 debug_log.log 4 3\n");
+    printf("\t\t server_cns -i uring 0.0.0.0 1337\n");
+    printf("\t\t server_cns -s 4 0.0.0.0 1337\n");
+    printf("\t\t server_cns -c 100000 0.0.0.0 1337\n");
+    printf("\t\t server_cns -f binary 0.0.0.0 1337 debug_log.bin 4\n");
+    printf("\t\t server_cns -w capture.pcap 0.0.0.0 1337\n");
     
     printf("--------------------------------------------------\n");
     printf("ARGUMENT DESC:\n");
@@ -82,6 +81,16 @@ void help() {
     printf("\t\t [log_severity] - Log severity for log file (includes all lower levels).\n");
     printf("\t\t [verbose_severity] - Which logs will be shown in command line (includes all lower levels).\n");
     
+    printf("--------------------------------------------------\n");
+    printf("OPTIONS:\n");
+    printf("\t\t -i <io_backend> - I/O backend for datagrams, syscall (default) or uring.\n");
+    printf("\t\t -s <shards> - Number of shard threads sharing port (default 1, max %d).\n", MAX_SHARDS);
+    printf("\t\t -c <clients> - Maximum number of connected clients (default %d).\n", MAX_CONCURRENT_CLIENTS);
+    printf("\t\t -a <usec> - Maximum delay of ACKs merged into one (default 0, end of receive batch).\n");
+    printf("\t\t -n <usec> - Hold of datagrams collecting coalesced messages (default 0, end of pass).\n");
+    printf("\t\t -f <log_format> - Format of log file, text (default) or binary (read by cns_logdump).\n");
+    printf("\t\t -w <file> - Capture datagrams to pcap file (see capture command).\n");
+    
     printf("--------------------------------------------------\n");
     printf("LOG LEVELS:\n");
     printf("\t\t 0 - Only necessary server messages will be shown.\n");
@@ -95,78 +104,189 @@ void help() {
 }
 
 /**
- * void _shutdown()
+ * void display_stats()
  * 
- * Shuts down server. Inform all clients with SERVER_SHUTDOWN (without waiting for ACK),
- * frees all allocated memory, asks running threads to terminate and waits 
- * for them to finish.
+ * Shows traffic statistics collected from server start
  */
-void _shutdown() {        
-    char *msg = "CONN_CLOSE";    
+void display_stats() {
+    int i;
     
-    log_line("SERV: Caught shutdown command.", LOG_ALWAYS);
-    log_line("SERV: Informing clients server is going down.", LOG_ALWAYS);
-    
-    /* Inform clients about shutdown */
-    broadcast_clients(msg, 0);
-    
-    log_line("#### START Stats ####", LOG_ALWAYS);
+    LOG_LINE(LOG_ALWAYS, "#### START Stats ####");
     
     /* Elapsed time */
     display_uptime();
     
     /* Sent bytes*/
-    sprintf(log_buffer,
+    LOG_FMT(LOG_ALWAYS,
             "Sent bytes (raw): %u",
             sent_bytes
             );
-    log_line(log_buffer, LOG_ALWAYS);
     
     /* Sent messages */
-    sprintf(log_buffer,
+    LOG_FMT(LOG_ALWAYS,
             "Sent datagrams: %u",
             sent_dgrams
             );
-    log_line(log_buffer, LOG_ALWAYS);
+    
+    /* Send batching */
+    LOG_FMT(LOG_ALWAYS,
+            "Send calls: %u (avg. %.2f datagrams per call)",
+            send_calls,
+            send_calls ? ((double) sent_dgrams / send_calls) : 0.
+            );
     
     /* Received bytes */
-    sprintf(log_buffer,
+    LOG_FMT(LOG_ALWAYS,
             "Received bytes (raw): %u",
             recv_bytes
             );
-    log_line(log_buffer, LOG_ALWAYS);
     
     /* Received messages */
-    sprintf(log_buffer,
+    LOG_FMT(LOG_ALWAYS,
             "Received datagrams: %u",
             recv_dgrams
             );
-    log_line(log_buffer, LOG_ALWAYS);
+    
+    /* io_uring submissions */
+    if(io_backend == IO_BACKEND_URING) {
+        LOG_FMT(LOG_ALWAYS,
+                "io_uring enter calls: %u",
+                uring_enters
+                );
+    }
+    
+    /* Receive batching */
+    LOG_FMT(LOG_ALWAYS,
+            "Receive calls: %u (avg. %.2f datagrams per call, batch size %u)",
+            recv_batches,
+            recv_batches ? ((double) recv_dgrams / recv_batches) : 0.,
+            recv_batch_size
+            );
+    
+    /* Load of shards */
+    if(shard_num > 1) {
+        for(i = 0; i < shard_num; i++) {
+            LOG_FMT(LOG_ALWAYS,
+                    "Shard %d datagrams: %u",
+                    i,
+                    shard_dgrams[i]
+                    );
+        }
+    }
+    
+    /* Datagrams dropped on full client queues */
+    LOG_FMT(LOG_ALWAYS,
+            "Dropped datagrams (client queue full): %u",
+            queue_overflows
+            );
+    
+    /* ACK datagrams saved by merging and piggybacking */
+    LOG_FMT(LOG_ALWAYS,
+            "ACK datagrams saved: %u (%u coalesced, %u piggybacked)",
+            acks_coalesced + acks_piggybacked,
+            acks_coalesced,
+            acks_piggybacked
+            );
+    
+    /* Messages sharing datagram */
+    LOG_FMT(LOG_ALWAYS,
+            "Coalesced messages: %u",
+            coalesced_msgs
+            );
+    
+    /* Clients using binary protocol (v2) */
+    LOG_FMT(LOG_ALWAYS,
+            "Binary datagrams: %u received, %u sent (%u bytes saved)",
+            binary_dgrams_in,
+            binary_dgrams_out,
+            binary_bytes_saved
+            );
+    
+    /* Received commands */
+    for(i = CMD_UNKNOWN + 1; i < CMD_COUNT; i++) {
+        LOG_FMT(LOG_ALWAYS,
+                "Command %s: %u",
+                cmd_defs[i].name,
+                cmd_counts[i]
+                );
+    }
+    
+    LOG_FMT(LOG_ALWAYS,
+            "Malformed or foreign datagrams: %u",
+            malformed_dgrams
+            );
+    
+    /* Client packets arriving out of order */
+    LOG_FMT(LOG_ALWAYS,
+            "Reordered client datagrams: %u held, %u dropped (beyond window or limit)",
+            reorder_buffered,
+            reorder_dropped
+            );
+    
+    /* Packet pools (high-water marks) */
+    for(i = 0; i < shard_num; i++) {
+        LOG_FMT(LOG_ALWAYS,
+                "Shard %d packet pool: %u allocated, peak %d in use",
+                i,
+                shards[i].packet_pool.allocated,
+                shards[i].packet_pool.peak
+                );
+    }
+    
+    /* Datagrams written to pcap file */
+    LOG_FMT(LOG_ALWAYS,
+            "Captured datagrams: %u (%u dropped, capture ring full)",
+            captured_dgrams,
+            capture_dropped
+            );
+    
+    /* Log records lost on full logger ring */
+    LOG_FMT(LOG_ALWAYS,
+            "Dropped log records (logger ring full): %u",
+            log_dropped
+            );
     
     /* Total number of connections */
-    sprintf(log_buffer,
+    LOG_FMT(LOG_ALWAYS,
             "Total # of connections: %u",
             num_connections
             );
-    log_line(log_buffer, LOG_ALWAYS);
     
-    log_line("#### END Stats ####", LOG_ALWAYS);
+    LOG_LINE(LOG_ALWAYS, "#### END Stats ####");
+}
+
+/**
+ * void _shutdown()
+ * 
+ * Shuts down server. Asks running shards to terminate and waits for them
+ * to finish. Each shard informs its clients with CONN_CLOSE (without waiting
+ * for ACK) and frees all their allocated memory.
+ */
+void _shutdown() {        
+    int i;
     
-    /* Clear clients */
-    clear_all_clients();
-    /* Clear games */
-    clear_all_games();
+    LOG_LINE(LOG_ALWAYS, "SERV: Caught shutdown command.");
+    LOG_LINE(LOG_ALWAYS, "SERV: Informing clients server is going down.");
+    LOG_LINE(LOG_ALWAYS, "SERV: Asking threads to terminate.");
     
-    log_line("SERV: Asking threads to terminate.", LOG_ALWAYS);
+    for(i = 0; i < shard_num; i++) {
+        pthread_mutex_unlock(&mtx_thr_shard[i]);
+    }
     
-    pthread_mutex_unlock(&mtx_thr_watchdog);
-    pthread_mutex_unlock(&mtx_thr_receiver);
-    pthread_mutex_unlock(&mtx_thr_sender);
+    /* Wake up all threads */
+    signal_event(shutdown_event);
     
     /* Join threads */
-    pthread_join(thr_watchdog, NULL);
-    pthread_join(thr_receiver, NULL);
-    pthread_join(thr_sender, NULL);
+    for(i = 0; i < shard_num; i++) {
+        pthread_join(thr_shard[i], NULL);
+    }
+    
+    stop_capture();
+    
+    display_stats();
+    
+    close_shards();
+    close_events();
     
     stop_logger();
 }
@@ -182,12 +302,101 @@ void run(int argc, char **argv) {
     char addr_buffer[INET_ADDRSTRLEN] = {0};
     char *buff;
     struct in_addr tmp_addr;
+    struct sockaddr_in client_addr;
+    char *capture_filename = NULL;
     int port;
     int tmp_num;
+    int opt;
     
     /* Get start timestamp */
     gettimeofday(&ts_start, NULL);
     
+    /* Process options, positional arguments follow them */
+    while((opt = getopt(argc, argv, "i:s:c:a:n:f:w:")) != -1) {
+        switch(opt) {
+            /* I/O backend */
+            case 'i':
+                if(strcmp(optarg, "uring") == 0) {
+                    io_backend = IO_BACKEND_URING;
+                }
+                else if(strcmp(optarg, "syscall") != 0) {
+                    help();
+                    raise_error("Unknown I/O backend.\n");
+                }
+                
+                break;
+            
+            /* Number of shards */
+            case 's':
+                shard_num = (int) strtol(optarg, NULL, 10);
+                
+                if(shard_num < 1 || shard_num > MAX_SHARDS) {
+                    help();
+                    raise_error("Number of shards is out of range.\n");
+                }
+                
+                break;
+            
+            /* Maximum number of clients */
+            case 'c':
+                max_clients = (unsigned int) strtoul(optarg, NULL, 10);
+                
+                if(max_clients < 1) {
+                    help();
+                    raise_error("Maximum number of clients is out of range.\n");
+                }
+                
+                break;
+            
+            /* ACK delay */
+            case 'a':
+                ack_delay_usec = (unsigned int) strtoul(optarg, NULL, 10);
+                
+                if(ack_delay_usec > MAX_ACK_DELAY_USEC) {
+                    help();
+                    raise_error("ACK delay is out of range.\n");
+                }
+                
+                break;
+            
+            /* Hold of coalescing datagrams */
+            case 'n':
+                coalesce_delay_usec = (unsigned int) strtoul(optarg, NULL, 10);
+                
+                if(coalesce_delay_usec > MAX_COALESCE_DELAY_USEC) {
+                    help();
+                    raise_error("Coalescing hold is out of range.\n");
+                }
+                
+                break;
+            
+            /* Log file format */
+            case 'f':
+                if(strcmp(optarg, "binary") == 0) {
+                    log_format = LOG_FORMAT_BINARY;
+                }
+                else if(strcmp(optarg, "text") != 0) {
+                    help();
+                    raise_error("Unknown log format.\n");
+                }
+                
+                break;
+            
+            /* Capture file */
+            case 'w':
+                capture_filename = optarg;
+                break;
+                
+            default:
+                help();
+                raise_error("Invalid arguments.\n");
+        }
+    }
+    
+    /* Shift positional arguments so that the first one is argv[1] */
+    argc -= optind - 1;
+    argv += optind - 1;
+    
     /* Init logger first */
     if(argc >= 4) {
         init_logger(argv[3]);
@@ -221,8 +430,8 @@ void run(int argc, char **argv) {
         }
         
         if(port <= 1024 && port != 0) {
-            log_line("Trying to bind to a port number lower than 1024, this "
-                    "might required administrator privileges.", LOG_ALWAYS);
+            LOG_LINE(LOG_ALWAYS, "Trying to bind to a port number lower than 1024, this "
+                    "might required administrator privileges.");
         }
         
         /* Got log severity */
@@ -230,55 +439,66 @@ void run(int argc, char **argv) {
             log_level = (int) strtol(argv[4], NULL, 10);
         }
         
-        sprintf(log_buffer,
+        LOG_FMT(LOG_ALWAYS,
                 "Setting logging level to %d",
                 log_level
                 );
         
-        log_line(log_buffer, LOG_ALWAYS);
-        
         /* Got verbose */
         if(argc == 6) {
             verbose_level = (int) strtol(argv[5], NULL, 10);
         }
         
-        sprintf(log_buffer,
+        LOG_FMT(LOG_ALWAYS,
                 "Setting verbose level to %d",
                 verbose_level
                 );
-        
-        log_line(log_buffer, LOG_ALWAYS);
     }
     else {
         help();
         raise_error("Invalid arguments.\n");
     }
     
+    /* Build command lookup table */
+    init_proto();
+    
     /* Initiate server */
     init_server(addr_buffer, port);
     
-    /* Start watchdog */
-    pthread_mutex_init(&mtx_thr_watchdog, NULL);
-    pthread_mutex_lock(&mtx_thr_watchdog);
+    if(capture_filename) {
+        start_capture(capture_filename);
+    }
     
-    if(pthread_create(&thr_watchdog, NULL, start_watchdog, (void *) &mtx_thr_watchdog) != 0) {
-        raise_error("Error starting watchdog thread.");
+    /* Fall back to plain syscalls if kernel doesn't support io_uring */
+    if(io_backend == IO_BACKEND_URING) {
+        if(uring_available()) {
+            LOG_LINE(LOG_ALWAYS, "Using io_uring I/O backend");
+        }
+        else {
+            io_backend = IO_BACKEND_SYSCALL;
+            
+            LOG_LINE(LOG_ALWAYS, "io_uring is not supported, using syscall I/O backend");
+        }
     }
     
-    /* Start receiver */
-    pthread_mutex_init(&mtx_thr_receiver, NULL);
-    pthread_mutex_lock(&mtx_thr_receiver);
+    /* Create events used to wake up threads */
+    init_events();
     
-    if(pthread_create(&thr_receiver, NULL, start_receiving, (void *) &mtx_thr_receiver) != 0) {
-        raise_error("Error starting receiving thread.");
-    }
+    /* Init rand */
+    srand(time(NULL));
     
-    /* Start sender */
-    pthread_mutex_init(&mtx_thr_sender, NULL);
-    pthread_mutex_lock(&mtx_thr_sender);
+    /* Start shards */
+    init_shards();
     
-    if(pthread_create(&thr_sender, NULL, start_sending, (void *) &mtx_thr_sender) != 0) {
-        raise_error("Error starting sender thread.");
+    for(tmp_num = 0; tmp_num < shard_num; tmp_num++) {
+        pthread_mutex_init(&mtx_thr_shard[tmp_num], NULL);
+        pthread_mutex_lock(&mtx_thr_shard[tmp_num]);
+        
+        shards[tmp_num].thr_mutex = &mtx_thr_shard[tmp_num];
+        
+        if(pthread_create(&thr_shard[tmp_num], NULL, start_shard, (void *) &shards[tmp_num]) != 0) {
+            raise_error("Error starting shard thread.");
+        }
     }
     
     /* Initiate server command line loop */
@@ -308,15 +528,13 @@ void run(int argc, char **argv) {
                         force_roll = (int) strtoul(buff, NULL, 10);
 
                         if(force_roll >= 1 && force_roll <= 6) {
-                            sprintf(log_buffer,
+                            LOG_FMT(LOG_ALWAYS,
                                     "CMD: Forcing roll on all consequent rolls to %d",
                                     force_roll
                                     );
-                            
-                            log_line(log_buffer, LOG_ALWAYS);
                         }
                         else {
-                            log_line("CMD: Rolling will be random now.", LOG_ALWAYS);
+                            LOG_LINE(LOG_ALWAYS, "CMD: Rolling will be random now.");
                         }
                     }
                 }
@@ -333,12 +551,17 @@ void run(int argc, char **argv) {
                         if(tmp_num >= LOG_NONE || tmp_num <= LOG_ALWAYS) {
                             log_level = tmp_num;
                             
-                            sprintf(log_buffer,
+                            LOG_FMT(LOG_ALWAYS,
                                     "CMD: Setting log level to %d",
                                     log_level
                                     );
                             
-                            log_line(log_buffer, LOG_ALWAYS);
+                            if(tmp_num > LOG_FLOOR) {
+                                LOG_FMT(LOG_ALWAYS,
+                                        "CMD: Server is built with log levels up to %d only",
+                                        LOG_FLOOR
+                                        );
+                            }
                         }
                     }
                 }
@@ -355,12 +578,17 @@ void run(int argc, char **argv) {
                         if(tmp_num >= LOG_NONE || tmp_num <= LOG_ALWAYS) {
                             verbose_level = tmp_num;
                             
-                            sprintf(log_buffer,
+                            LOG_FMT(LOG_ALWAYS,
                                     "CMD: Setting verbose level to %d",
                                     verbose_level
                                     );
                             
-                            log_line(log_buffer, LOG_ALWAYS);
+                            if(tmp_num > LOG_FLOOR) {
+                                LOG_FMT(LOG_ALWAYS,
+                                        "CMD: Server is built with log levels up to %d only",
+                                        LOG_FLOOR
+                                        );
+                            }
                         }
                     }
                 }
@@ -371,32 +599,114 @@ void run(int argc, char **argv) {
                 display_uptime();
             }
             
+            /* Get traffic statistics */
+            else if(strncmp(user_input_buffer, "stats", 5) == 0) {
+                display_stats();
+            }
+            
+            /* Set number of datagrams pulled by one receiving call */
+            else if(strncmp(user_input_buffer, "set_recv_batch", 14) == 0) {
+                if(strtok(user_input_buffer, " ") != NULL) {
+                    buff = strtok(NULL, " ");
+                    
+                    if(buff) {
+                        set_recv_batch_size((unsigned int) strtoul(buff, NULL, 10));
+                    }
+                }
+            }
+            
+            /* Get round trip times of all clients */
+            else if(strncmp(user_input_buffer, "rtt", 3) == 0) {
+                display_shards_rtt();
+            }
+            
+            /* Capture datagrams to pcap file (capture start <file>,
+             * capture stop, capture sample <n>, capture client <ip> [port],
+             * capture client all)
+             */
+            else if(strncmp(user_input_buffer, "capture", 7) == 0) {
+                strtok(user_input_buffer, " \n");
+                buff = strtok(NULL, " \n");
+                
+                if(buff && strcmp(buff, "start") == 0 && (buff = strtok(NULL, " \n")) != NULL) {
+                    start_capture(buff);
+                }
+                else if(buff && strcmp(buff, "stop") == 0) {
+                    stop_capture();
+                }
+                else if(buff && strcmp(buff, "sample") == 0 && (buff = strtok(NULL, " \n")) != NULL) {
+                    tmp_num = (int) strtoul(buff, NULL, 10);
+                    set_capture_sample(tmp_num);
+                    
+                    LOG_FMT(LOG_ALWAYS,
+                            "CMD: Capturing one of every %d datagrams",
+                            (tmp_num > 1 ? tmp_num : 1)
+                            );
+                }
+                else if(buff && strcmp(buff, "client") == 0 && (buff = strtok(NULL, " \n")) != NULL) {
+                    memset(&client_addr, 0, sizeof(client_addr));
+                    client_addr.sin_family = AF_INET;
+                    
+                    if(strcmp(buff, "all") == 0) {
+                        set_capture_filter(NULL);
+                        
+                        LOG_LINE(LOG_ALWAYS, "CMD: Capturing datagrams of all clients");
+                    }
+                    else if(inet_pton(AF_INET, buff, &client_addr.sin_addr) > 0) {
+                        if((buff = strtok(NULL, " \n")) != NULL) {
+                            client_addr.sin_port = htons((unsigned short) strtoul(buff, NULL, 10));
+                        }
+                        
+                        set_capture_filter(&client_addr);
+                        
+                        LOG_LINE(LOG_ALWAYS, "CMD: Capturing datagrams of one client only");
+                    }
+                }
+                else {
+                    LOG_LINE(LOG_ALWAYS, "CMD: Usage: capture start <file> | stop | sample <n> | client <ip> [port] | client all");
+                }
+            }
+            
+            /* Dump flight recorder of client (recorder <ip> <port>) */
+            else if(strncmp(user_input_buffer, "recorder", 8) == 0) {
+                if(strtok(user_input_buffer, " ") != NULL) {
+                    buff = strtok(NULL, " ");
+                    
+                    memset(&client_addr, 0, sizeof(client_addr));
+                    client_addr.sin_family = AF_INET;
+                    
+                    if(buff && inet_pton(AF_INET, buff, &client_addr.sin_addr) > 0 &&
+                            (buff = strtok(NULL, " \n")) != NULL) {
+                        client_addr.sin_port = htons((unsigned short) strtoul(buff, NULL, 10));
+                        
+                        dump_shards_recorder(&client_addr);
+                    }
+                    else {
+                        LOG_LINE(LOG_ALWAYS, "CMD: Usage: recorder <ip> <port>");
+                    }
+                }
+            }
+            
             /* Get current number of clients (event timeouted) */
             else if(strncmp(user_input_buffer, "playercount", 11) == 0) {
-                sprintf(log_buffer,
+                LOG_FMT(LOG_ALWAYS,
                         "Current number of clients (including timeouted) is %d",
                         client_num
                         );
-                
-                log_line(log_buffer, LOG_ALWAYS);
             }
 
 	    /* Force sound on to all clients */
 	    else if(strncmp(user_input_buffer, "sound_on", 8) == 0) {
-		broadcast_clients("FORCE_SOUND;1", 1);
+		broadcast_shards("FORCE_SOUND;1", 1);
 
-		strcpy(log_buffer, "Forcing sound ON to all clients!");
-
-		log_line(log_buffer, LOG_ALWAYS);
+		LOG_LINE(LOG_ALWAYS, "Forcing sound ON to all clients!");
 	    }
 	    
 	    /* Force sound off to all clients */
 	    else if(strncmp(user_input_buffer, "sound_off", 9) == 0) {
-		broadcast_clients("FORCE_SOUND;0", 1);
-
-		strcpy(log_buffer, "Forcing sound ON to all clients!");
+		broadcast_shards("FORCE_SOUND;0", 1);
 
-		log_line(log_buffer, LOG_ALWAYS);
+		LOG_LINE(LOG_ALWAYS, "Forcing sound OFF to all clients!");
 	    }
         }
     }
@@ -0,0 +1,107 @@
+/** 
+ * -----------------------------------------------------------------------------
+ * Clovece nezlob se (Server) - simple board game
+ * 
+ * Server for board game Clovece nezlob se using UDP datagrams for communication
+ * with clients and SEND-AND-WAIT method to ensure that all packets arrive
+ * and that they arrive in correct order. 
+ * 
+ * Semestral work for "Uvod do pocitacovich siti" KIV/UPS at
+ * University of West Bohemia.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * File: pool.c
+ * Description: Pool of outgoing packets with inline buffers, packets are
+ *              recycled instead of being freed.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * @author: Martin Kucera, 2014
+ * @version: 1.02
+ * 
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "pool.h"
+#include "shard.h"
+#include "err.h"
+
+/**
+ * packet_t *alloc_packet()
+ * 
+ * Takes packet from pool of current shard, heap is used only if the pool
+ * is empty.
+ */
+packet_t *alloc_packet() {
+    packet_pool_t *pool = &cur_shard->packet_pool;
+    packet_t *pkt = pool->free_list;
+    
+    if(pkt) {
+        pool->free_list = pkt->next;
+    }
+    else {
+        pkt = (packet_t *) malloc(sizeof(packet_t));
+        
+        if(!pkt) {
+            raise_error("Error allocating packet.");
+        }
+        
+        pool->allocated++;
+    }
+    
+    if(++pool->in_use > pool->peak) {
+        pool->peak = pool->in_use;
+    }
+    
+    return pkt;
+}
+
+/**
+ * void free_packet(packet_t *pkt)
+ * 
+ * Returns packet to pool of current shard.
+ */
+void free_packet(packet_t *pkt) {
+    packet_pool_t *pool = &cur_shard->packet_pool;
+    
+    pkt->next = pool->free_list;
+    pool->free_list = pkt;
+    
+    pool->in_use--;
+}
+
+/**
+ * void copy_packet(packet_t *dst, packet_t *src)
+ * 
+ * Copies packet together with its buffer, message and payload of the copy
+ * point to its own buffer.
+ */
+void copy_packet(packet_t *dst, packet_t *src) {
+    memcpy(dst, src, sizeof(packet_t));
+    
+    dst->msg = dst->buffer + (src->msg - src->buffer);
+    
+    /* Payload is built once packet is sent */
+    if(src->state) {
+        dst->payload = dst->buffer + (src->payload - src->buffer);
+    }
+}
+
+/**
+ * void destroy_packet_pool(packet_pool_t *pool)
+ * 
+ * Frees all packets of pool, all of them have to be returned first.
+ */
+void destroy_packet_pool(packet_pool_t *pool) {
+    packet_t *pkt;
+    
+    while(pool->free_list) {
+        pkt = pool->free_list;
+        pool->free_list = pkt->next;
+        
+        free(pkt);
+    }
+}
@@ -0,0 +1,48 @@
+/** 
+ * -----------------------------------------------------------------------------
+ * Clovece nezlob se (Server) - simple board game
+ * 
+ * Server for board game Clovece nezlob se using UDP datagrams for communication
+ * with clients and SEND-AND-WAIT method to ensure that all packets arrive
+ * and that they arrive in correct order. 
+ * 
+ * Semestral work for "Uvod do pocitacovich siti" KIV/UPS at
+ * University of West Bohemia.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * File: pool.c
+ * Description: Pool of outgoing packets with inline buffers, packets are
+ *              recycled instead of being freed.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * @author: Martin Kucera, 2014
+ * @version: 1.02
+ * 
+ */
+
+#ifndef POOL_H
+#define	POOL_H
+
+#include "com.h"
+
+typedef struct {
+    /* Free packets linked by their next member */
+    packet_t *free_list;
+    /* Number of packets allocated from heap */
+    unsigned int allocated;
+    /* Number of packets currently taken from pool */
+    int in_use;
+    /* Highest number of packets taken at once */
+    int peak;
+} packet_pool_t;
+
+/* Function prototypes */
+packet_t *alloc_packet();
+void free_packet(packet_t *pkt);
+void copy_packet(packet_t *dst, packet_t *src);
+void destroy_packet_pool(packet_pool_t *pool);
+
+#endif	/* POOL_H */
+
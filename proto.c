@@ -0,0 +1,928 @@
+/** 
+ * -----------------------------------------------------------------------------
+ * Clovece nezlob se (Server) - simple board game
+ * 
+ * Server for board game Clovece nezlob se using UDP datagrams for communication
+ * with clients and SEND-AND-WAIT method to ensure that all packets arrive
+ * and that they arrive in correct order.
+ * 
+ * Semestral work for "Uvod do pocitacovich siti" KIV/UPS at
+ * University of West Bohemia.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * File: proto.c
+ * Description: Parsing of client datagrams (text protocol and binary
+ *              protocol v2) and encoding of binary datagrams.
+ * 
+ * Binary datagram consists of PROTO_MAGIC, SEQ_ID and ACK_ID (varints,
+ * ACK_ID 0 if datagram doesn't acknowledge anything) followed by opcode
+ * and fixed width fields of command. Client sends one command per datagram,
+ * server may send several messages in one datagram.
+ * 
+ * Field layouts:
+ *   b - unsigned byte
+ *   i - 32 bit signed integer (big endian)
+ *   v - varint (7 bits per byte, least significant group first)
+ *   x - 32 bit bitmap (big endian), hexadecimal in text protocol
+ *   g - game code (GAME_CODE_LEN bytes)
+ *   r - reconnect code (RECONNECT_CODE_LEN bytes)
+ *   s - string (length byte followed by characters)
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * @author: Martin Kucera, 2014
+ * @version: 1.02
+ * 
+ */
+
+#include <netinet/in.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "proto.h"
+#include "global.h"
+#include "client.h"
+#include "com.h"
+#include "err.h"
+
+/* Maximum length of varint encoding 32 bit number */
+#define VARINT_MAX_LEN 5
+
+/* Size of command lookup table (power of 2) */
+#define CMD_HASH_SIZE 32
+/* Hash of command name, has to be perfect for commands in CMD_TABLE */
+#define CMD_HASH(name, len) \
+    ((((unsigned char) (name)[0] << 3) ^ (unsigned char) (name)[(len) - 1] ^ (len)) & (CMD_HASH_SIZE - 1))
+
+typedef struct {
+    /* Message name in text protocol */
+    const char *name;
+    /* Opcode in binary protocol */
+    unsigned char opcode;
+    /* Layout of fields */
+    const char *layout;
+} msg_def_t;
+
+#define CMD_DEF(name, handler, layout, required, flags) \
+    { #name, sizeof(#name) - 1, layout, required, flags },
+
+/* Client commands indexed by opcode */
+const cmd_def_t cmd_defs[CMD_COUNT] = {
+    { NULL, 0, "", 0, 0 },
+    CMD_TABLE(CMD_DEF)
+};
+
+/* Number of received commands by opcode */
+unsigned int cmd_counts[CMD_COUNT] = {0};
+/* Number of malformed datagrams */
+unsigned int malformed_dgrams = 0;
+
+/* Opcodes of commands by hash of their name */
+static unsigned char cmd_hash[CMD_HASH_SIZE];
+
+/* Server messages ordered by opcode, GAME_STATE carries game code, state,
+ * 4x player connected, 16x figure position, playing index, client's index,
+ * timeout, rolled number and SRTT
+ */
+static const msg_def_t msg_defs[] = {
+    { "ACK", MSG_ACK, "vx" },
+    { "RECONNECT_CODE", MSG_RECONNECT_CODE, "r" },
+    { "SEND_WINDOW", MSG_SEND_WINDOW, "b" },
+    { "SERVER_FULL", MSG_SERVER_FULL, "" },
+    { "CONN_CLOSE", MSG_CONN_CLOSE, "" },
+    { "GAME_CREATED", MSG_GAME_CREATED, "gi" },
+    { "GAME_STATE", MSG_GAME_STATE, "gbbbbbbbbbbbbbbbbbbbbbbbiii" },
+    { "GAME_FULL", MSG_GAME_FULL, "" },
+    { "GAME_RUNNING", MSG_GAME_RUNNING, "" },
+    { "GAME_NONEXISTENT", MSG_GAME_NONEXISTENT, "" },
+    { "GAME_LEFT", MSG_GAME_LEFT, "" },
+    { "CLIENT_JOINED_GAME", MSG_CLIENT_JOINED_GAME, "b" },
+    { "CLIENT_LEFT_GAME", MSG_CLIENT_LEFT_GAME, "bbi" },
+    { "CLIENT_TIMEOUT", MSG_CLIENT_TIMEOUT, "bbi" },
+    { "CLIENT_RECONNECT", MSG_CLIENT_RECONNECT, "b" },
+    { "GAME_STARTED", MSG_GAME_STARTED, "bi" },
+    { "ROLLED_DIE", MSG_ROLLED_DIE, "b" },
+    { "PLAYING_INDEX", MSG_PLAYING_INDEX, "bi" },
+    { "FIGURE_MOVED", MSG_FIGURE_MOVED, "bb" },
+    { "GAME_FINISHED", MSG_GAME_FINISHED, "bbbb" },
+    { "MESSAGE", MSG_MESSAGE, "bs" },
+    { "FORCE_SOUND", MSG_FORCE_SOUND, "b" }
+};
+
+/**
+ * int put_varint(unsigned char *out, unsigned int value)
+ * 
+ * Writes value as varint, returns number of written bytes.
+ */
+static int put_varint(unsigned char *out, unsigned int value) {
+    int len = 0;
+    
+    while(value >= 0x80) {
+        out[len++] = (unsigned char) (value | 0x80);
+        value >>= 7;
+    }
+    
+    out[len++] = (unsigned char) value;
+    
+    return len;
+}
+
+/**
+ * int varint_len(unsigned int value)
+ * 
+ * Returns number of bytes of value written as varint.
+ */
+static int varint_len(unsigned int value) {
+    int len = 1;
+    
+    while(value >= 0x80) {
+        value >>= 7;
+        len++;
+    }
+    
+    return len;
+}
+
+/**
+ * int get_varint(const unsigned char *in, const unsigned char *end, unsigned int *value)
+ * 
+ * Reads varint, returns number of read bytes or 0 if it is truncated
+ * or doesn't fit 32 bits.
+ */
+static int get_varint(const unsigned char *in, const unsigned char *end, unsigned int *value) {
+    unsigned int result = 0;
+    int len = 0;
+    
+    while(in + len < end && len < VARINT_MAX_LEN) {
+        result |= (unsigned int) (in[len] & 0x7F) << (7 * len);
+        
+        if(!(in[len++] & 0x80)) {
+            /* Last group has only 4 bits left */
+            if(len == VARINT_MAX_LEN && in[len - 1] > 0x0F) {
+                return 0;
+            }
+            
+            *value = result;
+            
+            return len;
+        }
+    }
+    
+    return 0;
+}
+
+/**
+ * void put_u32(unsigned char *out, unsigned int value)
+ * 
+ * Writes 32 bit number in big endian.
+ */
+static void put_u32(unsigned char *out, unsigned int value) {
+    out[0] = (unsigned char) (value >> 24);
+    out[1] = (unsigned char) (value >> 16);
+    out[2] = (unsigned char) (value >> 8);
+    out[3] = (unsigned char) value;
+}
+
+/**
+ * unsigned int get_u32(const unsigned char *in)
+ * 
+ * Reads 32 bit number in big endian.
+ */
+static unsigned int get_u32(const unsigned char *in) {
+    return ((unsigned int) in[0] << 24) | ((unsigned int) in[1] << 16) |
+            ((unsigned int) in[2] << 8) | (unsigned int) in[3];
+}
+
+/**
+ * int string_field_len(char layout)
+ * 
+ * Returns fixed length of string field, -1 if field has length byte
+ * and 0 if field isn't string.
+ */
+static int string_field_len(char layout) {
+    switch(layout) {
+        case 'g':
+            return GAME_CODE_LEN;
+        case 'r':
+            return RECONNECT_CODE_LEN;
+        case 's':
+            return -1;
+    }
+    
+    return 0;
+}
+
+/**
+ * int proto_is_binary(const char *dgram, int len)
+ * 
+ * Checks if datagram uses binary protocol (starts with PROTO_MAGIC).
+ */
+int proto_is_binary(const char *dgram, int len) {
+    return (len >= PROTO_MAGIC_LEN && memcmp(dgram, PROTO_MAGIC, PROTO_MAGIC_LEN) == 0);
+}
+
+/**
+ * void init_proto()
+ * 
+ * Builds lookup table of commands by hash of their name. Fails if names
+ * of two commands collide, CMD_HASH has to be changed then.
+ */
+void init_proto() {
+    int i;
+    int slot;
+    
+    memset(cmd_hash, 0, sizeof(cmd_hash));
+    
+    for(i = CMD_UNKNOWN + 1; i < CMD_COUNT; i++) {
+        slot = CMD_HASH(cmd_defs[i].name, cmd_defs[i].name_len);
+        
+        if(cmd_hash[slot]) {
+            raise_error("Command names collide in lookup table, change CMD_HASH.");
+        }
+        
+        cmd_hash[slot] = (unsigned char) i;
+    }
+}
+
+/**
+ * int lookup_cmd(const char *name, int len)
+ * 
+ * Returns opcode of command with given name (not null terminated),
+ * CMD_UNKNOWN if there is none.
+ */
+static int lookup_cmd(const char *name, int len) {
+    int cmd;
+    
+    if(len <= 0) {
+        return CMD_UNKNOWN;
+    }
+    
+    cmd = cmd_hash[CMD_HASH(name, len)];
+    
+    if(cmd_defs[cmd].name_len != len || memcmp(name, cmd_defs[cmd].name, len) != 0) {
+        return CMD_UNKNOWN;
+    }
+    
+    return cmd;
+}
+
+/**
+ * int parse_field_num(const char *p, const char *end, int base, unsigned int *value)
+ * 
+ * Parses number of text field between p and end. Negative numbers are
+ * stored in two's complement. Returns 0 if field isn't a number or it
+ * doesn't fit 32 bits.
+ */
+static int parse_field_num(const char *p, const char *end, int base, unsigned int *value) {
+    unsigned int result = 0;
+    int negative = 0;
+    int digit;
+    
+    if(p < end && *p == '-') {
+        negative = 1;
+        p++;
+    }
+    
+    if(p == end) {
+        return 0;
+    }
+    
+    for(; p < end; p++) {
+        if(*p >= '0' && *p <= '9') {
+            digit = *p - '0';
+        }
+        else if(base == 16 && *p >= 'a' && *p <= 'f') {
+            digit = *p - 'a' + 10;
+        }
+        else {
+            return 0;
+        }
+        
+        if(result > (UINT_MAX - digit) / base) {
+            return 0;
+        }
+        
+        result = result * base + digit;
+    }
+    
+    *value = negative ? 0U - result : result;
+    
+    return 1;
+}
+
+/**
+ * int valid_string(const char *str, int len)
+ * 
+ * Checks that string argument doesn't contain null character or separators
+ * of text protocol, so it can be passed to other clients.
+ */
+static int valid_string(const char *str, int len) {
+    int i;
+    
+    for(i = 0; i < len; i++) {
+        if(str[i] == 0 || str[i] == ';' || str[i] == MSG_SEPARATOR) {
+            return 0;
+        }
+    }
+    
+    return 1;
+}
+
+/**
+ * const char *field_end(const char *p, const char *end)
+ * 
+ * Returns end of text field starting at p (next separator or end
+ * of datagram).
+ */
+static const char *field_end(const char *p, const char *end) {
+    const char *sep = memchr(p, ';', end - p);
+    
+    return sep ? sep : end;
+}
+
+/**
+ * int parse_text_dgram(char *dgram, int len, dgram_cmd_t *cmd)
+ * 
+ * Parses datagram of text protocol (APP_TOKEN;SEQ_ID;COMMAND[;ARGS]).
+ * Datagram isn't modified and nothing is read past its length. String
+ * argument is always the last one and takes the rest of datagram, so it
+ * points right into datagram, which has to be null terminated (dgram[len]
+ * is 0). Returns 0 if datagram doesn't belong to us or it is malformed.
+ */
+static int parse_text_dgram(char *dgram, int len, dgram_cmd_t *cmd) {
+    const char *p = dgram;
+    const char *end = dgram + len;
+    const char *next;
+    const char *layout;
+    unsigned int value;
+    int token_len = strlen(STRINGIFY(APP_TOKEN));
+    
+    if(len <= token_len || memcmp(p, STRINGIFY(APP_TOKEN), token_len) != 0 || p[token_len] != ';') {
+        return 0;
+    }
+    
+    /* SEQ_ID */
+    p += token_len + 1;
+    next = field_end(p, end);
+    
+    if(!parse_field_num(p, next, 10, &value) || (int) value <= 0 || next == end) {
+        return 0;
+    }
+    
+    cmd->seq_id = (int) value;
+    
+    /* Command */
+    p = next + 1;
+    next = field_end(p, end);
+    
+    if((cmd->cmd = lookup_cmd(p, next - p)) == CMD_UNKNOWN) {
+        return 0;
+    }
+    
+    p = next;
+    
+    /* Trailing arguments may be left out */
+    for(layout = cmd_defs[cmd->cmd].layout; *layout && end - p > 1; layout++) {
+        p++;
+        
+        if(string_field_len(*layout)) {
+            if(!valid_string(p, end - p)) {
+                return 0;
+            }
+            
+            cmd->str = (char *) p;
+            p = end;
+        }
+        else {
+            next = field_end(p, end);
+            
+            if(!parse_field_num(p, next, *layout == 'x' ? 16 : 10, &cmd->num[cmd->argc])) {
+                return 0;
+            }
+            
+            p = next;
+        }
+        
+        cmd->argc++;
+    }
+    
+    /* Single trailing separator is tolerated */
+    if(end - p == 1 && *p == ';') {
+        p++;
+    }
+    
+    return (p == end && cmd->argc >= cmd_defs[cmd->cmd].required);
+}
+
+/**
+ * int decode_dgram(char *dgram, int len, dgram_cmd_t *cmd)
+ * 
+ * Decodes datagram of binary protocol. Datagram isn't modified or copied,
+ * string argument is always the last one, so it points right into
+ * datagram, which has to be null terminated (dgram[len] is 0). Strings
+ * can't contain separators of text protocol. Returns 0 if datagram
+ * is malformed.
+ */
+static int decode_dgram(char *dgram, int len, dgram_cmd_t *cmd) {
+    unsigned char *p = (unsigned char *) dgram + PROTO_MAGIC_LEN;
+    unsigned char *end = (unsigned char *) dgram + len;
+    const char *layout;
+    unsigned int value;
+    int n;
+    int str_len;
+    
+    cmd->binary = 1;
+    
+    /* Header */
+    if(!(n = get_varint(p, end, &value)) || (int) value <= 0) {
+        return 0;
+    }
+    
+    cmd->seq_id = (int) value;
+    p += n;
+    
+    if(!(n = get_varint(p, end, &value)) || (int) value < 0) {
+        return 0;
+    }
+    
+    cmd->ack_id = (int) value;
+    p += n;
+    
+    if(p == end || *p == CMD_UNKNOWN || *p >= CMD_COUNT) {
+        return 0;
+    }
+    
+    cmd->cmd = *p++;
+    
+    /* Trailing arguments may be left out */
+    for(layout = cmd_defs[cmd->cmd].layout; *layout && p < end; layout++) {
+        switch(*layout) {
+            case 'b':
+                cmd->num[cmd->argc] = *p++;
+                break;
+            
+            case 'i':
+            case 'x':
+                if(end - p < 4) {
+                    return 0;
+                }
+                
+                cmd->num[cmd->argc] = get_u32(p);
+                p += 4;
+                break;
+            
+            case 'v':
+                if(!(n = get_varint(p, end, &cmd->num[cmd->argc]))) {
+                    return 0;
+                }
+                
+                p += n;
+                break;
+            
+            default:
+                str_len = string_field_len(*layout);
+                
+                if(str_len < 0) {
+                    str_len = *p++;
+                }
+                
+                /* String has to end the datagram */
+                if(end - p != str_len || !valid_string((char *) p, str_len)) {
+                    return 0;
+                }
+                
+                cmd->str = (char *) p;
+                p = end;
+                break;
+        }
+        
+        cmd->argc++;
+    }
+    
+    return (p == end && cmd->argc >= cmd_defs[cmd->cmd].required);
+}
+
+/**
+ * int parse_dgram(char *dgram, int len, dgram_cmd_t *cmd)
+ * 
+ * Parses client's datagram of text or binary protocol into command and
+ * counts it. Returns 0 if datagram doesn't belong to us or it is malformed.
+ */
+int parse_dgram(char *dgram, int len, dgram_cmd_t *cmd) {
+    int valid;
+    
+    memset(cmd, 0, sizeof(dgram_cmd_t));
+    
+    if(proto_is_binary(dgram, len)) {
+        valid = decode_dgram(dgram, len, cmd);
+    }
+    else {
+        valid = parse_text_dgram(dgram, len, cmd);
+    }
+    
+    /* Stats */
+    if(valid) {
+        STAT_ADD(cmd_counts[cmd->cmd], 1);
+    }
+    else {
+        STAT_ADD(malformed_dgrams, 1);
+    }
+    
+    return valid;
+}
+
+/**
+ * int format_cmd(dgram_cmd_t *cmd, char *out, int room)
+ * 
+ * Writes command back to datagram of protocol it was received in, so it
+ * can be passed to another shard or held. Datagram is null terminated,
+ * returns its length or -1 if it doesn't fit room.
+ */
+int format_cmd(dgram_cmd_t *cmd, char *out, int room) {
+    unsigned char *p = (unsigned char *) out;
+    const char *layout = cmd_defs[cmd->cmd].layout;
+    int len;
+    int str_len;
+    int i;
+    
+    if(!cmd->binary) {
+        len = snprintf(out, room, "%s;%d;%s",
+                STRINGIFY(APP_TOKEN),
+                cmd->seq_id,
+                cmd_defs[cmd->cmd].name
+                );
+        
+        for(i = 0; i < cmd->argc && len < room; i++) {
+            if(string_field_len(layout[i])) {
+                len += snprintf(out + len, room - len, ";%s", cmd->str);
+            }
+            else {
+                len += snprintf(out + len, room - len, layout[i] == 'x' ? ";%x" : ";%u", cmd->num[i]);
+            }
+        }
+        
+        return (len < room ? len : -1);
+    }
+    
+    str_len = cmd->str ? (int) strlen(cmd->str) : 0;
+    
+    /* Header, opcode, numeric arguments, string and its length byte */
+    if(room < PROTO_MAGIC_LEN + 2 * VARINT_MAX_LEN + 1 +
+            CMD_MAX_ARGS * VARINT_MAX_LEN + str_len + 2) {
+        return -1;
+    }
+    
+    memcpy(p, PROTO_MAGIC, PROTO_MAGIC_LEN);
+    p += PROTO_MAGIC_LEN;
+    p += put_varint(p, (unsigned int) cmd->seq_id);
+    p += put_varint(p, (unsigned int) cmd->ack_id);
+    *p++ = (unsigned char) cmd->cmd;
+    
+    for(i = 0; i < cmd->argc; i++) {
+        switch(layout[i]) {
+            case 'b':
+                *p++ = (unsigned char) cmd->num[i];
+                break;
+            
+            case 'i':
+            case 'x':
+                put_u32(p, cmd->num[i]);
+                p += 4;
+                break;
+            
+            case 'v':
+                p += put_varint(p, cmd->num[i]);
+                break;
+            
+            default:
+                if(string_field_len(layout[i]) < 0) {
+                    *p++ = (unsigned char) str_len;
+                }
+                
+                memcpy(p, cmd->str, str_len);
+                p += str_len;
+                break;
+        }
+    }
+    
+    *p = 0;
+    
+    return (int) (p - (unsigned char *) out);
+}
+
+/**
+ * const msg_def_t *lookup_msg(const char *name, int len)
+ * 
+ * Finds server message by its name, returns NULL if there is none.
+ */
+static const msg_def_t *lookup_msg(const char *name, int len) {
+    unsigned int i;
+    
+    for(i = 0; i < sizeof(msg_defs) / sizeof(msg_defs[0]); i++) {
+        if(strlen(msg_defs[i].name) == len &&
+                strncmp(name, msg_defs[i].name, len) == 0) {
+            return &msg_defs[i];
+        }
+    }
+    
+    return NULL;
+}
+
+/**
+ * const msg_def_t *msg_def(int opcode)
+ * 
+ * Returns server message with given opcode, NULL if it isn't known.
+ */
+static const msg_def_t *msg_def(int opcode) {
+    if(opcode < MSG_ACK || opcode >= MSG_ACK + (int) (sizeof(msg_defs) / sizeof(msg_defs[0]))) {
+        return NULL;
+    }
+    
+    return &msg_defs[opcode - MSG_ACK];
+}
+
+/**
+ * int msg_opcode(const char *msg)
+ * 
+ * Returns opcode of server message at start of msg (terminated by zero,
+ * ';' or MSG_SEPARATOR), 0 if it isn't known.
+ */
+int msg_opcode(const char *msg) {
+    const msg_def_t *def = lookup_msg(msg, strcspn(msg, ";\n"));
+    
+    return (def ? def->opcode : 0);
+}
+
+/**
+ * const char *msg_name(int opcode)
+ * 
+ * Returns name of server message with given opcode, NULL if it isn't known.
+ */
+const char *msg_name(int opcode) {
+    const msg_def_t *def = msg_def(opcode);
+    
+    return (def ? def->name : NULL);
+}
+
+/**
+ * const char *msg_layout(int opcode)
+ * 
+ * Returns layout of fields of server message with given opcode, empty
+ * layout if it isn't known.
+ */
+const char *msg_layout(int opcode) {
+    const msg_def_t *def = msg_def(opcode);
+    
+    return (def ? def->layout : "");
+}
+
+/**
+ * int field_size(char layout, unsigned int value, int str_len)
+ * 
+ * Returns number of bytes of binary field with given layout holding value
+ * (or string of str_len characters).
+ */
+int field_size(char layout, unsigned int value, int str_len) {
+    switch(layout) {
+        case 'b':
+            return 1;
+        
+        case 'i':
+        case 'x':
+            return 4;
+        
+        case 'v':
+            return varint_len(value);
+        
+        case 's':
+            return str_len + 1;
+    }
+    
+    return string_field_len(layout);
+}
+
+/**
+ * char *put_field(char *out, char layout, unsigned int value, const char *str, int str_len)
+ * 
+ * Writes binary field with given layout holding value (or string of
+ * str_len characters, at most 0xFF). Fixed length strings are cut or padded
+ * by zeros. Returns position right after the field.
+ */
+char *put_field(char *out, char layout, unsigned int value, const char *str, int str_len) {
+    unsigned char *o = (unsigned char *) out;
+    int len;
+    
+    switch(layout) {
+        case 'b':
+            *o++ = (unsigned char) value;
+            break;
+        
+        case 'i':
+        case 'x':
+            put_u32(o, value);
+            o += 4;
+            break;
+        
+        case 'v':
+            o += put_varint(o, value);
+            break;
+        
+        case 's':
+            *o++ = (unsigned char) str_len;
+            memcpy(o, str, str_len);
+            o += str_len;
+            break;
+        
+        default:
+            len = string_field_len(layout);
+            
+            if(str_len > len) {
+                str_len = len;
+            }
+            
+            memcpy(o, str, str_len);
+            memset(o + str_len, 0, len - str_len);
+            o += len;
+            break;
+    }
+    
+    return (char *) o;
+}
+
+/**
+ * char *put_dgram_header(char *msg, int seq_id, int ack_id)
+ * 
+ * Writes header of binary datagram (PROTO_MAGIC, SEQ_ID and ACK_ID) right
+ * in front of its messages, there has to be room for PROTO_MAGIC_LEN and
+ * two varints. Returns start of datagram.
+ */
+char *put_dgram_header(char *msg, int seq_id, int ack_id) {
+    unsigned char *p = (unsigned char *) msg - PROTO_MAGIC_LEN -
+            varint_len((unsigned int) seq_id) - varint_len((unsigned int) ack_id);
+    char *start = (char *) p;
+    
+    memcpy(p, PROTO_MAGIC, PROTO_MAGIC_LEN);
+    p += PROTO_MAGIC_LEN;
+    p += put_varint(p, (unsigned int) seq_id);
+    put_varint(p, (unsigned int) ack_id);
+    
+    return start;
+}
+
+/**
+ * int encode_dgram(const char *text, int len, char *out, int room)
+ * 
+ * Encodes datagram built for text protocol (APP_TOKEN;SEQ_ID[:ACK_ID];
+ * MESSAGE, coalesced messages separated by MSG_SEPARATOR) to binary
+ * protocol. Messages for clients using binary protocol are built in it
+ * right away, this is left for the few fixed datagrams. Returns length of
+ * binary datagram or -1 if text datagram can't be encoded or it doesn't
+ * fit room.
+ */
+int encode_dgram(const char *text, int len, char *out, int room) {
+    const char *p;
+    const char *end = text + len;
+    const char *next;
+    const char *layout;
+    const msg_def_t *def;
+    unsigned char *o = (unsigned char *) out;
+    unsigned char *o_end = (unsigned char *) out + room;
+    unsigned int seq_id;
+    unsigned int ack_id = 0;
+    unsigned int value;
+    int token_len = strlen(STRINGIFY(APP_TOKEN));
+    int str_len;
+    
+    if(len <= token_len || strncmp(text, STRINGIFY(APP_TOKEN), token_len) != 0 ||
+            text[token_len] != ';' || room < PROTO_MAGIC_LEN + 2 * VARINT_MAX_LEN) {
+        return -1;
+    }
+    
+    p = text + token_len + 1;
+    
+    /* Header, SEQ_ID and optional piggybacked ACK_ID */
+    for(next = p; next < end && *next != ';' && *next != ':'; next++);
+    
+    if(!parse_field_num(p, next, 10, &seq_id)) {
+        return -1;
+    }
+    
+    if(next < end && *next == ':') {
+        p = next + 1;
+        
+        for(next = p; next < end && *next != ';'; next++);
+        
+        if(!parse_field_num(p, next, 10, &ack_id)) {
+            return -1;
+        }
+    }
+    
+    if(next == end || *next != ';') {
+        return -1;
+    }
+    
+    memcpy(o, PROTO_MAGIC, PROTO_MAGIC_LEN);
+    o += PROTO_MAGIC_LEN;
+    o += put_varint(o, seq_id);
+    o += put_varint(o, ack_id);
+    
+    p = next + 1;
+    
+    /* Messages */
+    while(p < end) {
+        for(next = p; next < end && *next != ';' && *next != MSG_SEPARATOR; next++);
+        
+        def = lookup_msg(p, next - p);
+        
+        if(!def || o == o_end) {
+            return -1;
+        }
+        
+        *o++ = def->opcode;
+        p = next;
+        
+        for(layout = def->layout; *layout; layout++) {
+            str_len = string_field_len(*layout);
+            
+            /* Left out trailing number is sent as 0 */
+            if(p == end || *p == MSG_SEPARATOR) {
+                if(str_len) {
+                    return -1;
+                }
+                
+                next = p;
+                value = 0;
+            }
+            else {
+                if(*p != ';') {
+                    return -1;
+                }
+                
+                p++;
+                
+                /* Text can contain field separator */
+                for(next = p; next < end && *next != MSG_SEPARATOR &&
+                        (*layout == 's' || *next != ';'); next++);
+                
+                if(!str_len && !parse_field_num(p, next, *layout == 'x' ? 16 : 10, &value)) {
+                    return -1;
+                }
+            }
+            
+            if(!str_len) {
+                if(o_end - o < VARINT_MAX_LEN) {
+                    return -1;
+                }
+                
+                switch(*layout) {
+                    case 'b':
+                        *o++ = (unsigned char) value;
+                        break;
+                    
+                    case 'v':
+                        o += put_varint(o, value);
+                        break;
+                    
+                    default:
+                        put_u32(o, value);
+                        o += 4;
+                        break;
+                }
+            }
+            else {
+                if(str_len < 0) {
+                    str_len = next - p;
+                    
+                    if(str_len > 0xFF || o == o_end) {
+                        return -1;
+                    }
+                    
+                    *o++ = (unsigned char) str_len;
+                }
+                
+                if(next - p != str_len || o_end - o < str_len) {
+                    return -1;
+                }
+                
+                memcpy(o, p, str_len);
+                o += str_len;
+            }
+            
+            p = next;
+        }
+        
+        /* Next coalesced message */
+        if(p < end) {
+            if(*p != MSG_SEPARATOR) {
+                return -1;
+            }
+            
+            p++;
+        }
+    }
+    
+    return (int) (o - (unsigned char *) out);
+}
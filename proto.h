@@ -0,0 +1,145 @@
+/** 
+ * -----------------------------------------------------------------------------
+ * Clovece nezlob se (Server) - simple board game
+ * 
+ * Server for board game Clovece nezlob se using UDP datagrams for communication
+ * with clients and SEND-AND-WAIT method to ensure that all packets arrive
+ * and that they arrive in correct order.
+ * 
+ * Semestral work for "Uvod do pocitacovich siti" KIV/UPS at
+ * University of West Bohemia.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * File: proto.c
+ * Description: Parsing of client datagrams (text protocol and binary
+ *              protocol v2) and encoding of binary datagrams.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * @author: Martin Kucera, 2014
+ * @version: 1.02
+ * 
+ */
+
+#ifndef PROTO_H
+#define	PROTO_H
+
+/* Magic at the start of binary (v2) datagrams */
+#define PROTO_MAGIC "CNS\2"
+#define PROTO_MAGIC_LEN 4
+
+/* Command flags */
+/* Command doesn't need existing client */
+#define CMD_SESSION 1
+/* Command is processed even if it is ahead of expected SEQ_ID */
+#define CMD_UNORDERED 2
+
+/* Client commands, X(NAME, handler, argument layout, required arguments,
+ * flags). Position in table is the opcode of binary protocol, so new
+ * commands have to be appended. Argument layouts are described in proto.c.
+ */
+#define CMD_TABLE(X) \
+    X(CONNECT, cmd_connect, "bbb", 0, CMD_SESSION) \
+    X(RECONNECT, cmd_reconnect, "r", 0, CMD_SESSION) \
+    X(ACK, cmd_ack, "vx", 1, CMD_UNORDERED) \
+    X(CREATE_GAME, cmd_create_game, "", 0, 0) \
+    X(CLOSE, cmd_close, "", 0, 0) \
+    X(KEEPALIVE, cmd_keepalive, "", 0, 0) \
+    X(JOIN_GAME, cmd_join_game, "g", 0, 0) \
+    X(LEAVE_GAME, cmd_leave_game, "", 0, 0) \
+    X(START_GAME, cmd_start_game, "", 0, 0) \
+    X(DIE_ROLL, cmd_die_roll, "", 0, 0) \
+    X(FIGURE_MOVE, cmd_figure_move, "b", 1, 0) \
+    X(MESSAGE, cmd_message, "s", 0, 0)
+
+#define CMD_ENUM(name, handler, layout, required, flags) CMD_##name,
+
+/* Client commands (opcodes of binary protocol) */
+enum {
+    CMD_UNKNOWN = 0,
+    CMD_TABLE(CMD_ENUM)
+    CMD_COUNT
+};
+
+/* Server messages (opcodes of binary protocol) */
+#define MSG_ACK 0x40
+#define MSG_RECONNECT_CODE 0x41
+#define MSG_SEND_WINDOW 0x42
+#define MSG_SERVER_FULL 0x43
+#define MSG_CONN_CLOSE 0x44
+#define MSG_GAME_CREATED 0x45
+#define MSG_GAME_STATE 0x46
+#define MSG_GAME_FULL 0x47
+#define MSG_GAME_RUNNING 0x48
+#define MSG_GAME_NONEXISTENT 0x49
+#define MSG_GAME_LEFT 0x4A
+#define MSG_CLIENT_JOINED_GAME 0x4B
+#define MSG_CLIENT_LEFT_GAME 0x4C
+#define MSG_CLIENT_TIMEOUT 0x4D
+#define MSG_CLIENT_RECONNECT 0x4E
+#define MSG_GAME_STARTED 0x4F
+#define MSG_ROLLED_DIE 0x50
+#define MSG_PLAYING_INDEX 0x51
+#define MSG_FIGURE_MOVED 0x52
+#define MSG_GAME_FINISHED 0x53
+#define MSG_MESSAGE 0x54
+#define MSG_FORCE_SOUND 0x55
+
+/* Maximum number of command arguments */
+#define CMD_MAX_ARGS 4
+
+typedef struct {
+    /* Command name in text protocol */
+    const char *name;
+    /* Length of name */
+    int name_len;
+    /* Layout of arguments */
+    const char *layout;
+    /* Number of arguments which have to be present */
+    int required;
+    /* Command flags */
+    int flags;
+} cmd_def_t;
+
+typedef struct {
+    /* Datagram used binary protocol */
+    int binary;
+    /* Sequential ID of datagram */
+    int seq_id;
+    /* SEQ_ID acknowledged in datagram's header, 0 if none */
+    int ack_id;
+    /* Command */
+    int cmd;
+    /* Number of arguments present */
+    int argc;
+    /* Numeric arguments by their position (0 if not present) */
+    unsigned int num[CMD_MAX_ARGS];
+    /* String argument (game code, reconnect code or text), points to
+     * datagram, NULL if not present
+     */
+    char *str;
+} dgram_cmd_t;
+
+/* Client commands indexed by opcode */
+extern const cmd_def_t cmd_defs[CMD_COUNT];
+/* Number of received commands by opcode */
+extern unsigned int cmd_counts[CMD_COUNT];
+/* Number of malformed datagrams */
+extern unsigned int malformed_dgrams;
+
+/* Function prototypes */
+void init_proto();
+int proto_is_binary(const char *dgram, int len);
+int parse_dgram(char *dgram, int len, dgram_cmd_t *cmd);
+int format_cmd(dgram_cmd_t *cmd, char *out, int room);
+int encode_dgram(const char *text, int len, char *out, int room);
+int msg_opcode(const char *msg);
+const char *msg_name(int opcode);
+const char *msg_layout(int opcode);
+int field_size(char layout, unsigned int value, int str_len);
+char *put_field(char *out, char layout, unsigned int value, const char *str, int str_len);
+char *put_dgram_header(char *msg, int seq_id, int ack_id);
+
+#endif	/* PROTO_H */
+
@@ -12,7 +12,7 @@
  * -----------------------------------------------------------------------------
  * 
  * File: receiver.c
- * Description: Receiver thread, handles sending datagrams to clients
+ * Description: Receiving datagrams from shard's socket
  * 
  * -----------------------------------------------------------------------------
  * 
@@ -21,55 +21,182 @@
  * 
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/time.h>
 #include <sys/socket.h>
 #include <pthread.h>
 #include <netinet/in.h>
+#include <unistd.h>
 
 #include "global.h"
 #include "server.h"
 #include "logger.h"
 #include "err.h"
 #include "com.h"
+#include "event.h"
+#include "uring.h"
+#include "shard.h"
+#include "receiver.h"
+
+/* Number of datagrams pulled by one receiving call, can be changed during runtime */
+unsigned int recv_batch_size = DEFAULT_RECV_BATCH_SIZE;
+/* Number of receiving calls which returned at least one datagram */
+unsigned int recv_batches = 0;
+/* Number of datagrams received by each shard */
+unsigned int shard_dgrams[MAX_SHARDS] = {0};
+
+/* Receive buffers of each shard (+1 for terminating null character) */
+static __thread char dgram_buffers[MAX_RECV_BATCH_SIZE][MAX_DGRAM_SIZE + 1];
+static __thread struct sockaddr_in client_addr[MAX_RECV_BATCH_SIZE];
+static __thread struct iovec iov[MAX_RECV_BATCH_SIZE];
+static __thread struct mmsghdr msgs[MAX_RECV_BATCH_SIZE];
 
 /**
- * void *start_receiving(void *arg)
+ * void set_recv_batch_size(unsigned int size)
  * 
- * Entry point for receiving thread. Socket timeout for receiving calls
- * is se to 1s so that the receiving thread can check every second if main
- * thread didn' ask him to terminate. All accepted datagrams passes to
- * process_dgram function.
+ * Sets number of datagrams pulled from socket by one receiving call. Size
+ * of 1 disables batching and the receiver falls back to plain recvfrom.
  */
-void *start_receiving(void *arg) {
-    unsigned int client_len;
-    int n;
-    struct sockaddr_in client_addr;
-    char dgram[MAX_DGRAM_SIZE];
-    pthread_mutex_t *thr_mutex = (pthread_mutex_t *) arg;
+void set_recv_batch_size(unsigned int size) {
+    if(size < 1) {
+        size = 1;
+    }
+    else if(size > MAX_RECV_BATCH_SIZE) {
+        size = MAX_RECV_BATCH_SIZE;
+    }
     
-    client_len = sizeof(client_addr);
+    recv_batch_size = size;
     
-    /* Init rand */
-    srand(time(NULL));
+    LOG_FMT(LOG_ALWAYS,
+            "Setting receive batch size to %u",
+            recv_batch_size
+            );
+}
+
+/**
+ * int receive_batch(int sockfd, struct mmsghdr *msgs, unsigned int batch_size)
+ * 
+ * Pulls datagrams waiting in socket without blocking and passes them to
+ * process_dgram. Returns number of received datagrams. Message headers
+ * have to be bound to null terminable buffers of MAX_DGRAM_SIZE bytes.
+ */
+static int receive_batch(int sockfd, struct mmsghdr *msgs, unsigned int batch_size) {
+    char *dgram;
+    struct sockaddr_in *client_addr;
+    unsigned int client_len;
+    int n, i;
     
-    /* Ticks each second cehcking if thread is still alive */
-    while(!stop_thread(thr_mutex)) {
-        n = recvfrom(server_sockfd, &dgram, sizeof(dgram), 0,
-                (struct sockaddr *) &client_addr, &client_len);
-        
+    /* Batching disabled, receive single datagram */
+    if(batch_size <= 1) {
+        dgram = (char *) msgs[0].msg_hdr.msg_iov->iov_base;
+        client_addr = (struct sockaddr_in *) msgs[0].msg_hdr.msg_name;
+        client_len = sizeof(*client_addr);
+
+        n = recvfrom(sockfd, dgram, MAX_DGRAM_SIZE, 0,
+                (struct sockaddr *) client_addr, &client_len);
+
         /* Got data */
-        if(n > 0) {            
-            process_dgram(dgram, &client_addr);
+        if(n > 0) {
+            dgram[n] = 0;
+
+            process_dgram(dgram, n, client_addr);
+
+            /* Stats */
+            STAT_ADD(recv_bytes, n);
+            STAT_ADD(recv_dgrams, 1);
+            STAT_ADD(recv_batches, 1);
             
+            return 1;
+        }
+
+        return 0;
+    }
+
+    /* Address length is overwritten by each call */
+    for(i = 0; i < batch_size; i++) {
+        msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+    }
+
+    n = recvmmsg(sockfd, msgs, batch_size, 0, NULL);
+
+    /* Got data */
+    if(n > 0) {
+        for(i = 0; i < n; i++) {
+            dgram = (char *) msgs[i].msg_hdr.msg_iov->iov_base;
+            dgram[msgs[i].msg_len] = 0;
+
+            process_dgram(dgram, msgs[i].msg_len, (struct sockaddr_in *) msgs[i].msg_hdr.msg_name);
+
             /* Stats */
-            recv_bytes += n;
-            recv_dgrams++;
+            STAT_ADD(recv_bytes, msgs[i].msg_len);
         }
+
+        /* Stats */
+        STAT_ADD(recv_dgrams, n);
+        STAT_ADD(recv_batches, 1);
+        
+        return n;
     }
     
-    log_line("SERV: Receiving thread terminated.", LOG_ALWAYS);
+    return 0;
+}
+
+/**
+ * void init_receiver()
+ * 
+ * Binds message headers of calling thread to its receive buffers. Has to
+ * be called by each shard before it starts receiving.
+ */
+void init_receiver() {
+    int i;
+    
+    memset(msgs, 0, sizeof(msgs));
+    
+    for(i = 0; i < MAX_RECV_BATCH_SIZE; i++) {
+        iov[i].iov_base = dgram_buffers[i];
+        iov[i].iov_len = MAX_DGRAM_SIZE;
+        
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &client_addr[i];
+    }
+}
+
+/**
+ * void receive_dgrams(int sockfd)
+ * 
+ * Drains shard's socket. Unless batch size is set to 1, datagrams are
+ * pulled by recvmmsg, up to recv_batch_size datagrams per call. Batch which
+ * isn't full means socket is empty.
+ */
+void receive_dgrams(int sockfd) {
+    unsigned int batch_size;
+    int n;
+    
+    do {
+        batch_size = recv_batch_size;
+        n = receive_batch(sockfd, msgs, batch_size);
+        
+        shard_dgrams[cur_shard->index] += n;
+    } while(n == batch_size);
+}
+
+/**
+ * int receive_uring()
+ * 
+ * Processes datagrams received by multishot receive of io_uring backend.
+ * Returns -1 if kernel doesn't support multishot receive.
+ */
+int receive_uring() {
+    int n = uring_recv_process();
+    
+    if(n > 0) {
+        shard_dgrams[cur_shard->index] += n;
+    }
     
-    pthread_exit(NULL);
+    return n;
 }
@@ -12,7 +12,7 @@
  * -----------------------------------------------------------------------------
  * 
  * File: receiver.c
- * Description: Receiver thread, handles sending datagrams to clients
+ * Description: Receiving datagrams from shard's socket
  * 
  * -----------------------------------------------------------------------------
  * 
@@ -24,8 +24,20 @@
 #ifndef RECEIVER_H
 #define	RECEIVER_H
 
+#include "global.h"
+
+/* Number of datagrams pulled by one receiving call */
+extern unsigned int recv_batch_size;
+/* Number of receiving calls which returned at least one datagram */
+extern unsigned int recv_batches;
+/* Number of datagrams received by each shard */
+extern unsigned int shard_dgrams[MAX_SHARDS];
+
 /* Function prototypes */
-void *start_receiving(void *arg);
+void init_receiver();
+void receive_dgrams(int sockfd);
+int receive_uring();
+void set_recv_batch_size(unsigned int size);
 
 #endif	/* RECEIVER_H */
 
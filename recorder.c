@@ -0,0 +1,109 @@
+/** 
+ * -----------------------------------------------------------------------------
+ * Clovece nezlob se (Server) - simple board game
+ * 
+ * Server for board game Clovece nezlob se using UDP datagrams for communication
+ * with clients and SEND-AND-WAIT method to ensure that all packets arrive
+ * and that they arrive in correct order. 
+ * 
+ * Semestral work for "Uvod do pocitacovich siti" KIV/UPS at
+ * University of West Bohemia.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * File: recorder.c
+ * Description: Flight recorder, fixed-size ring of the last datagrams
+ *              received from and sent to client.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * @author: Martin Kucera, 2014
+ * @version: 1.02
+ * 
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "logger.h"
+#include "recorder.h"
+
+/**
+ * void recorder_add(recorder_t *rec, int dir, int seq_id, const char *dgram, int len, struct timeval *tv)
+ * 
+ * Records datagram in place of the oldest one. Only its start is copied,
+ * so recording is cheap enough to be always on. Current time is taken
+ * if tv is NULL.
+ */
+void recorder_add(recorder_t *rec, int dir, int seq_id, const char *dgram, int len, struct timeval *tv) {
+    recorder_entry_t *entry = &rec->entries[rec->count++ & (RECORDER_SIZE - 1)];
+    
+    if(tv) {
+        entry->timestamp = *tv;
+    }
+    else {
+        gettimeofday(&entry->timestamp, NULL);
+    }
+    
+    entry->seq_id = seq_id;
+    entry->len = (unsigned short) len;
+    entry->dir = (unsigned char) dir;
+    
+    memcpy(entry->data, dgram, (len < RECORDER_DATA_SIZE ? len : RECORDER_DATA_SIZE));
+}
+
+/**
+ * void log_recorder(recorder_t *rec, int severity)
+ * 
+ * Logs recorded datagrams from the oldest one. Non-printable bytes (binary
+ * protocol) are written as hex escapes, datagrams longer than
+ * RECORDER_DATA_SIZE are cut with "...".
+ */
+void log_recorder(recorder_t *rec, int severity) {
+    recorder_entry_t *entry;
+    char data[4 * RECORDER_DATA_SIZE + 4];
+    char timestamp[10];
+    time_t sec;
+    unsigned int i;
+    int j, n, len;
+    
+    i = (rec->count > RECORDER_SIZE ? rec->count - RECORDER_SIZE : 0);
+    
+    for(; i < rec->count; i++) {
+        entry = &rec->entries[i & (RECORDER_SIZE - 1)];
+        n = (entry->len < RECORDER_DATA_SIZE ? entry->len : RECORDER_DATA_SIZE);
+        len = 0;
+        
+        for(j = 0; j < n; j++) {
+            if(entry->data[j] >= 32 && entry->data[j] < 127) {
+                data[len++] = entry->data[j];
+            }
+            else {
+                len += sprintf(data + len, "\\x%02x", (unsigned char) entry->data[j]);
+            }
+        }
+        
+        if(n < entry->len) {
+            memcpy(data + len, "...", 3);
+            len += 3;
+        }
+        
+        data[len] = 0;
+        
+        sec = entry->timestamp.tv_sec;
+        strftime(timestamp, sizeof(timestamp), "%H:%M:%S", localtime(&sec));
+        
+        LOG_FMT(severity,
+                "  %s.%06ld %s SEQ_ID %d (%d B): %s",
+                timestamp,
+                (long) entry->timestamp.tv_usec,
+                (entry->dir == RECORDER_IN ? "<---" : "--->"),
+                entry->seq_id,
+                entry->len,
+                data
+                );
+    }
+}
+
@@ -0,0 +1,65 @@
+/** 
+ * -----------------------------------------------------------------------------
+ * Clovece nezlob se (Server) - simple board game
+ * 
+ * Server for board game Clovece nezlob se using UDP datagrams for communication
+ * with clients and SEND-AND-WAIT method to ensure that all packets arrive
+ * and that they arrive in correct order. 
+ * 
+ * Semestral work for "Uvod do pocitacovich siti" KIV/UPS at
+ * University of West Bohemia.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * File: recorder.c
+ * Description: Flight recorder, fixed-size ring of the last datagrams
+ *              received from and sent to client.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * @author: Martin Kucera, 2014
+ * @version: 1.02
+ * 
+ */
+
+
+#ifndef RECORDER_H
+#define	RECORDER_H
+
+#include <sys/time.h>
+
+/* Number of datagrams kept per client (power of 2) */
+#define RECORDER_SIZE 16
+/* Number of bytes kept from start of each datagram */
+#define RECORDER_DATA_SIZE 40
+
+/* Direction of recorded datagram */
+#define RECORDER_IN 0
+#define RECORDER_OUT 1
+
+typedef struct {
+    /* Time when datagram was received or sent */
+    struct timeval timestamp;
+    /* SEQ_ID of datagram */
+    int seq_id;
+    /* Full length of datagram */
+    unsigned short len;
+    /* RECORDER_IN or RECORDER_OUT */
+    unsigned char dir;
+    /* Start of datagram (not terminated) */
+    char data[RECORDER_DATA_SIZE];
+} recorder_entry_t;
+
+typedef struct {
+    /* Recorded datagrams, the oldest is overwritten */
+    recorder_entry_t entries[RECORDER_SIZE];
+    /* Number of recorded datagrams */
+    unsigned int count;
+} recorder_t;
+
+/* Function prototypes */
+void recorder_add(recorder_t *rec, int dir, int seq_id, const char *dgram, int len, struct timeval *tv);
+void log_recorder(recorder_t *rec, int severity);
+
+#endif	/* RECORDER_H */
+
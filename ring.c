@@ -0,0 +1,103 @@
+/** 
+ * -----------------------------------------------------------------------------
+ * Clovece nezlob se (Server) - simple board game
+ * 
+ * Server for board game Clovece nezlob se using UDP datagrams for communication
+ * with clients and SEND-AND-WAIT method to ensure that all packets arrive
+ * and that they arrive in correct order. 
+ * 
+ * Semestral work for "Uvod do pocitacovich siti" KIV/UPS at
+ * University of West Bohemia.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * File: ring.c
+ * Description: Fixed-capacity ring buffer of client's outgoing packets.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * @author: Martin Kucera, 2014
+ * @version: 1.02
+ * 
+ */
+
+#include <stddef.h>
+
+#include "ring.h"
+
+/**
+ * void ring_init(packet_ring_t *ring)
+ * 
+ * Prepares empty ring.
+ */
+void ring_init(packet_ring_t *ring) {
+    ring->head = 0;
+    ring->tail = 0;
+}
+
+/**
+ * unsigned int ring_size(packet_ring_t *ring)
+ * 
+ * Returns number of queued packets.
+ */
+unsigned int ring_size(packet_ring_t *ring) {
+    return ring->tail - ring->head;
+}
+
+/**
+ * int ring_push(packet_ring_t *ring, struct packet *pkt)
+ * 
+ * Appends packet to the end of ring. Returns 0 if ring is full, packet
+ * is not queued then.
+ */
+int ring_push(packet_ring_t *ring, struct packet *pkt) {
+    if(ring_size(ring) >= DGRAM_QUEUE_SIZE) {
+        return 0;
+    }
+    
+    ring->slots[ring->tail++ & (DGRAM_QUEUE_SIZE - 1)] = pkt;
+    
+    return 1;
+}
+
+/**
+ * struct packet *ring_front(packet_ring_t *ring)
+ * 
+ * Returns first packet of ring or NULL if ring is empty.
+ */
+struct packet *ring_front(packet_ring_t *ring) {
+    if(ring->head == ring->tail) {
+        return NULL;
+    }
+    
+    return ring->slots[ring->head & (DGRAM_QUEUE_SIZE - 1)];
+}
+
+/**
+ * struct packet *ring_pop(packet_ring_t *ring)
+ * 
+ * Removes first packet from ring and returns it, or NULL if ring is empty.
+ */
+struct packet *ring_pop(packet_ring_t *ring) {
+    struct packet *pkt = ring_front(ring);
+    
+    if(pkt) {
+        ring->head++;
+    }
+    
+    return pkt;
+}
+
+/**
+ * struct packet *ring_at(packet_ring_t *ring, unsigned int i)
+ * 
+ * Returns i-th packet from front of ring, or NULL if there are not
+ * so many packets.
+ */
+struct packet *ring_at(packet_ring_t *ring, unsigned int i) {
+    if(i >= ring_size(ring)) {
+        return NULL;
+    }
+    
+    return ring->slots[(ring->head + i) & (DGRAM_QUEUE_SIZE - 1)];
+}
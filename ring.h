@@ -0,0 +1,49 @@
+/** 
+ * -----------------------------------------------------------------------------
+ * Clovece nezlob se (Server) - simple board game
+ * 
+ * Server for board game Clovece nezlob se using UDP datagrams for communication
+ * with clients and SEND-AND-WAIT method to ensure that all packets arrive
+ * and that they arrive in correct order. 
+ * 
+ * Semestral work for "Uvod do pocitacovich siti" KIV/UPS at
+ * University of West Bohemia.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * File: ring.c
+ * Description: Fixed-capacity ring buffer of client's outgoing packets.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * @author: Martin Kucera, 2014
+ * @version: 1.02
+ * 
+ */
+
+#ifndef RING_H
+#define	RING_H
+
+#include "global.h"
+
+struct packet;
+
+typedef struct {
+    /* Queued packets (taken from packet pool) */
+    struct packet *slots[DGRAM_QUEUE_SIZE];
+    /* Number of popped packets, front is at head % DGRAM_QUEUE_SIZE */
+    unsigned int head;
+    /* Number of pushed packets */
+    unsigned int tail;
+} packet_ring_t;
+
+/* Function prototypes */
+void ring_init(packet_ring_t *ring);
+unsigned int ring_size(packet_ring_t *ring);
+int ring_push(packet_ring_t *ring, struct packet *pkt);
+struct packet *ring_front(packet_ring_t *ring);
+struct packet *ring_pop(packet_ring_t *ring);
+struct packet *ring_at(packet_ring_t *ring, unsigned int i);
+
+#endif	/* RING_H */
+
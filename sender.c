@@ -12,7 +12,7 @@
  * -----------------------------------------------------------------------------
  * 
  * File: sender.c
- * Description: Handles sending datagram to clients
+ * Description: Handles (re)sending queued datagrams to clients
  * 
  * -----------------------------------------------------------------------------
  * 
@@ -24,6 +24,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
+#include <unistd.h>
 #include <netinet/in.h>
 
 #include "global.h"
@@ -31,121 +32,83 @@
 #include "com.h"
 #include "game.h"
 #include "logger.h"
-
-/* Condition signaling change in packet status for any client */
-pthread_cond_t cond_packet_change;
-/* Mutex protection condition variable */
-pthread_mutex_t mtx_cond_packet_change;
+#include "shard.h"
 
 /**
- * void *start_sending(void *arg)
+ * long sender_pass()
  * 
- * Entry point for sender thread. Loops through all connected users and checks
- * if they have any packets queued that need to be (re)sent. Also check's their
- * timestamps. After checking all clients, goes to sleep for minimum amount of time
- * before any packet timeouts or maximum number of 500ms, in order to check
- * if the main thread didnt ask him to terminate.
+ * Loops through all clients of current shard and checks if they have any
+ * packets queued that need to be (re)sent or ACKs held for too long. Also
+ * check's their timestamps.
+ * Returns time in microseconds before the earliest packet or client
+ * timeout, or -1 if there are no clients and so there is no timeout at all.
  */
-void *start_sending(void *arg) {
-    /* Sender mutex */
-    pthread_mutex_t *thr_mutex = (pthread_mutex_t *) arg;
-    /* Lowest time from all clients before their packet timeouts */
-    int wait;
+long sender_pass() {
+    /* Lowest time from all clients before their packet or client timeouts */
+    int wait = -1;
+    /* Time before client's timestamp timeouts */
+    int client_wait;
+    /* Time before held ACK has to be sent */
+    int ack_wait;
     /* Client index */
     int i;
     /* Temp client */
     client_t *client;
-    /* Temp packet from queue_front */
-    packet_t *packet;
-    /* Timespec for timedwait */
-    struct timespec ts;
     /* How many clients we got in a loop */
-    unsigned int got_clients;
+    unsigned int got_clients = 0;
+    /* Clients can be removed during the pass */
+    unsigned int shard_clients = cur_shard->clients.count;
     
-    while(!stop_thread(thr_mutex)) {
-        got_clients = 0;
-        wait = -1;
+    for(i = 0; i < cur_shard->clients.capacity && got_clients < shard_clients; i++) {
+        client = get_client_by_index(i);
         
-        for(i = 0; i < MAX_CONCURRENT_CLIENTS && got_clients <= client_num; i++) {
-            /* Get client (lock) */
-            client = get_client_by_index(i);
+        if(client) {
+            got_clients++;
+           
+            /* If client is active */
+            if(client->state) {
+                /* Check if client's timestamp is too old */
+                if(client_timestamp_timeout(client)) {
+                    
+                    /* Attempt to timeout player in current game */
+                    timeout_game(client);
+                    client->state = 0;
+                    
+                } 
+                else if(ring_size(&client->dgram_queue) > 0) {
+                    send_queued_packets(client, &wait);
+                }
+            }
+            else if(client_timestamp_remove(client)){
+                if(client->game_index != -1) {
+                    leave_game(client);
+                }
+                
+                remove_client(&client);
+            }
             
-            if(client) {
-                got_clients++;
-               
-                /* If client is active */
-                if(client->state) {
-                    /* Check if client's timestamp is too old */
-                    if(client_timestamp_timeout(client)) {
-                        
-                        /* Attempt to timeout player in current game */
-                        timeout_game(client);
-                        client->state = 0;
-                        
-                    } 
-                    else if(queue_size(client->dgram_queue) > 0) {
-                        packet = queue_front(client->dgram_queue);
-
-                        /* Send new packet or resend packet which is timeouted */
-                        while( packet &&  ( ( packet->state == 0) || 
-                                ( packet->state == 1 && packet_timestamp_old(*packet, &wait)))) {
-                            
-                            send_packet(packet, client);
-                            
-                            if(!packet->req_ack) {
-                                queue_pop(client->dgram_queue, 0);
-                                
-                                free(packet->msg);
-                                free(packet->payload);
-                                free(packet);
-                                
-                                packet = queue_front(client->dgram_queue);
-                            }
-                            else {
-                                packet = NULL;
-                            }
-                            
-                        }
-                    }
+            /* Send held ACK which no packet carried in time */
+            if(client && client->ack_pending) {
+                ack_wait = pending_ack_wait(client);
+                
+                if(ack_wait == 0) {
+                    send_pending_ack(client);
                 }
-                else if(client_timestamp_remove(client)){
-                    if(client->game_index != -1) {
-                        leave_game(client);
-                    }
-                    
-                    remove_client(&client);
+                else if(wait < 0 || ack_wait < wait) {
+                    wait = ack_wait;
                 }
+            }
+            
+            if(client) {
+                /* Wake up when client timeouts or should be removed */
+                client_wait = client_timestamp_wait(client);
                 
-                if(client) {
-                    release_client(client);
+                if(wait < 0 || client_wait < wait) {
+                    wait = client_wait;
                 }
             }
         }
-        
-        /* If no packets are waiting, set wait to default value, periodically
-         * checking if thread is still alive
-         */
-        if(wait < 0 || wait > 500000) {
-            wait = 500000;
-        }
-        
-        pthread_mutex_lock(&mtx_cond_packet_change);
-        clock_gettime(CLOCK_REALTIME, &ts);
-        
-        if((ts.tv_nsec + (wait * 1000)) > NANOSECONDS_IN_SECOND) {
-            ts.tv_sec++;
-            ts.tv_nsec = (ts.tv_nsec + (wait * 1000)) - NANOSECONDS_IN_SECOND;
-        }
-        else {
-            ts.tv_nsec += (wait * 1000);
-        }
-        
-        /* Wait specified amount of time or for receiving thread to signal us */
-        pthread_cond_timedwait(&cond_packet_change, &mtx_cond_packet_change, &ts);        
-        pthread_mutex_unlock(&mtx_cond_packet_change);
     }
     
-    log_line("SERV: Sending thread terminated.", LOG_ALWAYS);
-    
-    pthread_exit(NULL);
+    return wait;
 }
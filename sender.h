@@ -12,7 +12,7 @@
  * -----------------------------------------------------------------------------
  * 
  * File: sender.c
- * Description: Handles sending datagram to clients
+ * Description: Handles (re)sending queued datagrams to clients
  * 
  * -----------------------------------------------------------------------------
  * 
@@ -24,12 +24,8 @@
 #ifndef SENDER_H
 #define	SENDER_H
 
-#include <pthread.h>
-
-extern pthread_cond_t cond_packet_change;
-
 /* Function prototypes */
-void *start_sending(void *arg);
+long sender_pass();
 
 #endif	/* SENDER_H */
 
@@ -31,35 +31,78 @@
 #include <stdlib.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <linux/filter.h>
 
 #include "err.h"
 #include "server.h"
 #include "global.h"
 #include "client.h"
+#include "shard.h"
 #include "com.h"
 #include "game.h"
 #include "logger.h"
+#include "pool.h"
+#include "proto.h"
+#include "capture.h"
 
 /* Server started */
 struct timeval ts_start;
 
-/* Logger buffer */
-char log_buffer[LOG_BUFFER_SIZE];
-
 /* Server socket */
 int server_sockfd;
+/* Server sockets, one per shard */
+int server_sockfds[MAX_SHARDS];
+/* Number of shards, can be set before server is started */
+int shard_num = 1;
+
+/**
+ * void attach_steering_program()
+ * 
+ * Attaches classic BPF program to the reuseport group of server sockets.
+ * Program hashes client's address and port and returns index of socket
+ * (shard) which gets the datagram, so one client is always handled by
+ * the same shard.
+ */
+static void attach_steering_program() {
+    struct sock_filter code[] = {
+        /* M[0] = source address */
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 12),
+        BPF_STMT(BPF_ST, 0),
+        /* X = IP header length */
+        BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, SKF_NET_OFF),
+        /* A = source port */
+        BPF_STMT(BPF_LD | BPF_H | BPF_IND, SKF_NET_OFF),
+        /* A = hash(address ^ port) % shard_num */
+        BPF_STMT(BPF_LDX | BPF_MEM, 0),
+        BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+        BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, 0x9E3779B1),
+        BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 16),
+        BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, shard_num),
+        BPF_STMT(BPF_RET | BPF_A, 0)
+    };
+    struct sock_fprog prog;
+    
+    prog.len = sizeof(code) / sizeof(code[0]);
+    prog.filter = code;
+    
+    if(setsockopt(server_sockfds[0], SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0) {
+        LOG_LINE(LOG_WARN, "Couldn't attach shard steering program, kernel will pick shards.");
+    }
+}
 
 /*
  * void init_server(char *bind_ip, int port)
  * 
  * Starts the server and its threads,
- * binds to given ip and port.
+ * binds to given ip and port. With more shards, each of them gets its
+ * own SO_REUSEPORT socket bound to the same ip and port.
  */
 void init_server(char *bind_ip, int port) {
     int server_len;
     struct sockaddr_in server_addr;
-    
-    server_sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    int reuse = 1;
+    int i;
     
     server_addr.sin_family = AF_INET;
     server_addr.sin_addr.s_addr = inet_addr(bind_ip);
@@ -67,228 +110,379 @@ void init_server(char *bind_ip, int port) {
     
     server_len = sizeof(server_addr);
     
-    if(bind(server_sockfd, (struct sockaddr *) &server_addr, server_len) != 0) {
-        raise_error("Error binding, exiting.");
+    for(i = 0; i < shard_num; i++) {
+        server_sockfds[i] = socket(AF_INET, SOCK_DGRAM, 0);
+        
+        if(shard_num > 1 &&
+                setsockopt(server_sockfds[i], SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) < 0) {
+            raise_error("Error setting SO_REUSEPORT, exiting.");
+        }
+        
+        if(bind(server_sockfds[i], (struct sockaddr *) &server_addr, server_len) != 0) {
+            raise_error("Error binding, exiting.");
+        }
+        
+        /* Receiver waits for socket in event loop, never block on it */
+        set_socket_nonblocking(server_sockfds[i]);
     }
     
-    /* Set socket timeout depending on OS */
-    set_socket_timeout_linux();
+    /* Captured datagrams are addressed to us */
+    set_capture_local(&server_addr);
+    
+    /* Any socket can send, use the first one */
+    server_sockfd = server_sockfds[0];
+    
+    /* Steer each client to one shard (order of sockets in group
+     * is the order of binding)
+     */
+    if(shard_num > 1) {
+        attach_steering_program();
+    }
     
     /* Log */
-    sprintf(log_buffer,
-            "Starting server with IP %s and port %d",
+    LOG_FMT(LOG_ALWAYS,
+            "Starting server with IP %s and port %d (%d shards)",
             bind_ip,
-            port
+            port,
+            shard_num
             );
+}
+
+/**
+ * void process_dgram(char *dgram, int len, struct sockaddr_in *addr)
+ * 
+ * Processes datagram received from shard's socket. If its client is owned
+ * by another shard, datagram is forwarded there.
+ */
+void process_dgram(char *dgram, int len, struct sockaddr_in *addr) {
+    CAPTURE_DGRAM(CAPTURE_IN, dgram, len, addr);
     
-    log_line(log_buffer, LOG_ALWAYS);
+    if(!route_dgram(dgram, len, addr)) {
+        handle_dgram(dgram, len, addr, cur_shard->index);
+    }
 }
 
 /**
- * void process_dgram(char *dgram, struct sockaddr_in *addr)
+ * void log_dgram_in(char *dgram, struct sockaddr_in *addr)
  * 
- * Processes accepted datagram. Checks if sequential ID is correct, if it's lower,
- * we resend the ACK packet and dont bother with that datagram anymore, because
- * it was already processed before.
+ * Logs received datagram (text form of binary datagram).
  */
-void process_dgram(char *dgram, struct sockaddr_in *addr) {
-    /* Protocol token */
-    char *token;
-    /* Token length */
-    int token_len;
-    /* Command */
-    char *type;
-    /* Generic char buffer */
-    char *generic_chbuff;
-    /* Sequential ID of received packet */
-    int packet_seq_id;
-    /* Client which we receive from */
-    client_t *client;
-    /* Generic unsigned int var */
-    unsigned int generic_uint;
-    /* String representation of address */
+static void log_dgram_in(char *dgram, struct sockaddr_in *addr) {
     char addr_str[INET_ADDRSTRLEN];
-
+    
     inet_ntop(AF_INET, &addr->sin_addr, addr_str, INET_ADDRSTRLEN);
     
-    /* Log */
-    sprintf(log_buffer,
+    LOG_FMT(LOG_DEBUG,
             "DATA_IN: %s <--- %s:%d",
             dgram,
-	    addr_str,
-	    htons(addr->sin_port)
+            addr_str,
+            htons(addr->sin_port)
             );
-    log_line(log_buffer, LOG_DEBUG);
+}
+
+/**
+ * void cmd_connect(dgram_cmd_t *cmd, client_t *client, struct sockaddr_in *addr, int home)
+ * 
+ * New client connection, optional send window, ACK piggybacking and
+ * message coalescing (CONNECT;WINDOW;PIGGYBACK;COALESCE)
+ */
+static void cmd_connect(dgram_cmd_t *cmd, client_t *client, struct sockaddr_in *addr, int home) {
+    add_client(addr, cmd->binary);
+    client = get_client_by_addr(addr);
+    
+    if(client) {
+        set_piggyback_acks(client, cmd->num[1]);
+        set_coalescing(client, cmd->num[2]);
+        
+        send_ack(client, 1, 0);
+        send_reconnect_code(client);
+        
+        set_send_window(client, cmd->num[0]);
+    }
+}
+
+/**
+ * void cmd_reconnect(dgram_cmd_t *cmd, client_t *client, struct sockaddr_in *addr, int home)
+ * 
+ * Reconnect of client with given reconnect code. If code was issued by
+ * another shard, command is forwarded there in its own protocol.
+ */
+static void cmd_reconnect(dgram_cmd_t *cmd, client_t *client, struct sockaddr_in *addr, int home) {
+    char forward[MAX_DGRAM_SIZE + 1];
+    int shard = shard_by_code(cmd->str);
+    int len;
+    
+    /* Reconnect code was issued by another shard */
+    if(shard >= 0 && shard != cur_shard->index) {
+        if(home == cur_shard->index && (len = format_cmd(cmd, forward, sizeof(forward))) > 0) {
+            forward_dgram(forward, len, addr, shard, home);
+        }
+    }
+    else {
+        client = get_client_by_index(get_client_index_by_rcode(cmd->str));
+        
+        if(client) {
+            /* Sends ACK aswell after resetting clients SEQ_ID */
+            reconnect_client(client, addr, home, cmd->binary);
+        }
+    }
+}
+
+/**
+ * void cmd_ack(dgram_cmd_t *cmd, client_t *client, struct sockaddr_in *addr, int home)
+ * 
+ * Receive ACK packet, acknowledged SEQ_ID and optional SACK bitmap
+ * (ACK;SEQ_ID[;BITMAP])
+ */
+static void cmd_ack(dgram_cmd_t *cmd, client_t *client, struct sockaddr_in *addr, int home) {
+    recv_ack(client, (int) cmd->num[0], cmd->num[1]);
+    
+    update_client_timestamp(client);
+}
+
+/**
+ * void cmd_create_game(dgram_cmd_t *cmd, client_t *client, struct sockaddr_in *addr, int home)
+ * 
+ * Create new game
+ */
+static void cmd_create_game(dgram_cmd_t *cmd, client_t *client, struct sockaddr_in *addr, int home) {
+    /* ACK client */
+    send_ack(client, cmd->seq_id, 0);
+    
+    create_game(client);
+}
+
+/**
+ * void cmd_close(dgram_cmd_t *cmd, client_t *client, struct sockaddr_in *addr, int home)
+ * 
+ * Close client connection
+ */
+static void cmd_close(dgram_cmd_t *cmd, client_t *client, struct sockaddr_in *addr, int home) {
+    /* ACK client */
+    send_ack(client, cmd->seq_id, 0);
+    
+    leave_game(client);
+    remove_client(&client);
+}
+
+/**
+ * void cmd_keepalive(dgram_cmd_t *cmd, client_t *client, struct sockaddr_in *addr, int home)
+ * 
+ * Keepalive loop
+ */
+static void cmd_keepalive(dgram_cmd_t *cmd, client_t *client, struct sockaddr_in *addr, int home) {
+    /* ACK client */
+    send_ack(client, cmd->seq_id, 0);
+}
+
+/**
+ * void cmd_join_game(dgram_cmd_t *cmd, client_t *client, struct sockaddr_in *addr, int home)
+ * 
+ * Join existing game
+ */
+static void cmd_join_game(dgram_cmd_t *cmd, client_t *client, struct sockaddr_in *addr, int home) {
+    /* ACK client */
+    send_ack(client, cmd->seq_id, 0);
+    
+    join_game(client, cmd->str);
+}
+
+/**
+ * void cmd_leave_game(dgram_cmd_t *cmd, client_t *client, struct sockaddr_in *addr, int home)
+ * 
+ * Leave existing game
+ */
+static void cmd_leave_game(dgram_cmd_t *cmd, client_t *client, struct sockaddr_in *addr, int home) {
+    /* ACK client */
+    send_ack(client, cmd->seq_id, 0);
+    
+    leave_game(client);
+}
+
+/**
+ * void cmd_start_game(dgram_cmd_t *cmd, client_t *client, struct sockaddr_in *addr, int home)
+ * 
+ * Start game
+ */
+static void cmd_start_game(dgram_cmd_t *cmd, client_t *client, struct sockaddr_in *addr, int home) {
+    /* ACK client */
+    send_ack(client, cmd->seq_id, 0);
+    
+    start_game(client);
+}
+
+/**
+ * void cmd_die_roll(dgram_cmd_t *cmd, client_t *client, struct sockaddr_in *addr, int home)
+ * 
+ * Rolling die
+ */
+static void cmd_die_roll(dgram_cmd_t *cmd, client_t *client, struct sockaddr_in *addr, int home) {
+    /* ACK client */
+    send_ack(client, cmd->seq_id, 0);
     
-    token = strtok(dgram, ";");
-    token_len = strlen(token);
+    roll_die(client);
+}
+
+/**
+ * void cmd_figure_move(dgram_cmd_t *cmd, client_t *client, struct sockaddr_in *addr, int home)
+ * 
+ * Moving figure
+ */
+static void cmd_figure_move(dgram_cmd_t *cmd, client_t *client, struct sockaddr_in *addr, int home) {
+    /* ACK client */
+    send_ack(client, cmd->seq_id, 0);
     
-    generic_chbuff = strtok(NULL, ";");
-    packet_seq_id = (int) strtol(generic_chbuff, NULL, 0);
+    move_figure(client, cmd->num[0]);
+}
+
+/**
+ * void cmd_message(dgram_cmd_t *cmd, client_t *client, struct sockaddr_in *addr, int home)
+ * 
+ * Chat message to other players in game
+ */
+static void cmd_message(dgram_cmd_t *cmd, client_t *client, struct sockaddr_in *addr, int home) {
+    /* ACK client */
+    send_ack(client, cmd->seq_id, 0);
+    
+    broadcast_message(client, cmd->str);
+}
+
+#define CMD_CASE(name, handler, layout, required, flags) \
+    case CMD_##name: \
+        handler(cmd, client, addr, home); \
+        break;
+
+/**
+ * void dispatch_cmd(dgram_cmd_t *cmd, client_t *client, struct sockaddr_in *addr, int home)
+ * 
+ * Calls handler of command given in CMD_TABLE. Client is NULL for commands
+ * flagged CMD_SESSION.
+ */
+static void dispatch_cmd(dgram_cmd_t *cmd, client_t *client, struct sockaddr_in *addr, int home) {
+    switch(cmd->cmd) {
+        CMD_TABLE(CMD_CASE)
+    }
+}
+
+/**
+ * void handle_dgram(char *dgram, int len, struct sockaddr_in *addr, int home)
+ * 
+ * Processes accepted datagram of text or binary protocol. Checks if
+ * sequential ID is correct, if it's lower, we resend the ACK packet and
+ * dont bother with that datagram anymore, because it was already processed
+ * before. Home is the shard which received datagram from socket.
+ * 
+ * All datagrams sent while processing are collected and flushed by a single
+ * sendmmsg call at the end.
+ */
+void handle_dgram(char *dgram, int len, struct sockaddr_in *addr, int home) {
+    /* Parsed command */
+    dgram_cmd_t cmd;
+    /* Client which we receive from */
+    client_t *client;
+    /* Datagram held for reordering (or its text form for logging) */
+    char held[MAX_DGRAM_SIZE + 1];
+    /* Held datagram which can be processed after this one */
+    packet_t *next_dgram = NULL;
+    
+    /* Everything sent while handling this datagram goes out at once */
+    begin_send_batch();
+    
+    /* Log */
+    if(LOG_TEXT_ENABLED(LOG_DEBUG) && !proto_is_binary(dgram, len)) {
+        log_dgram_in(dgram, addr);
+    }
     
     /* Check if datagram belongs to us */
-    if( (token_len == strlen(STRINGIFY(APP_TOKEN))) &&
-            strncmp(token, STRINGIFY(APP_TOKEN), strlen(STRINGIFY(APP_TOKEN))) == 0 &&
-            packet_seq_id > 0) {
-        
-        type = strtok(NULL, ";");
+    if(parse_dgram(dgram, len, &cmd)) {
         
-        /* New client connection */
-        if(strncmp(type, "CONNECT", 7) == 0) {
+        if(cmd.binary) {
+            /* Stats */
+            STAT_ADD(binary_dgrams_in, 1);
             
-            add_client(addr);            
-            client = get_client_by_addr(addr);
-            
-            if(client) {
-                send_ack(client, 1, 0);
-                send_reconnect_code(client);
+            /* Log */
+            if(LOG_TEXT_ENABLED(LOG_DEBUG)) {
+                cmd.binary = 0;
+                format_cmd(&cmd, held, sizeof(held));
+                cmd.binary = 1;
                 
-                /* Release client */
-                release_client(client);
+                log_dgram_in(held, addr);
             }
-            
         }
-        /* Reconnect */
-        else if(strncmp(type, "RECONNECT", 9) == 0) {            
-            client = get_client_by_index(get_client_index_by_rcode(strtok(NULL, ";")));
-            
-            if(client) {
-                /* Sends ACK aswell after resetting clients SEQ_ID */
-                reconnect_client(client, addr);
-                
-                /* Release client */
-                release_client(client);
-            }
+        
+        LOG_EVENT(LOG_DEBUG, EV_DATA_IN, -1, -1, cmd.seq_id, cmd.cmd, len,
+                addr->sin_addr.s_addr, ntohs(addr->sin_port));
+        
+        /* Connect or reconnect */
+        if(cmd_defs[cmd.cmd].flags & CMD_SESSION) {
+            dispatch_cmd(&cmd, NULL, addr, home);
         }
         /* Client should already exist */
-        else {
-            client = get_client_by_addr(addr);
+        else if((client = get_client_by_addr(addr)) != NULL) {
+            /* Flight recorder */
+            recorder_add(&client->recorder, RECORDER_IN, cmd.seq_id, dgram, len, NULL);
             
-            if(client != NULL) {
-                /* Check if expected seq ID matches */
-                if(packet_seq_id == client->pkt_recv_seq_id) {
-                    
-                    /* Get command */
-                    if(strncmp(type, "CREATE_GAME", 11) == 0) {
-                                                
-                        /* ACK client */
-                        send_ack(client, packet_seq_id, 0);
-                        
-                        create_game(client);
-                        
-                    }
-                    /* Receive ACK packet */
-                    else if(strncmp(type, "ACK", 3) == 0) {
-                        
-                        recv_ack(client, 
-                                (int) strtoul(strtok(NULL, ";"), NULL, 10));
-                        
-                        update_client_timestamp(client);
-                        
-                    }
-                    /* Close client connection */
-                    else if(strncmp(type, "CLOSE", 5) == 0) {
-                        
-                        /* ACK client */
-                        send_ack(client, packet_seq_id, 0);
-                        
-                        leave_game(client);
-                        remove_client(&client);
-                        
-                    }
-                    /* Keepalive loop */
-                    else if(strncmp(type, "KEEPALIVE", 9) == 0) {
-                        
-                        /* ACK client */
-                        send_ack(client, packet_seq_id, 0);
-                        
-                    }
-                    /* Join existing game */
-                    else if(strncmp(type, "JOIN_GAME", 9) == 0) {
-                        
-                        /* ACK client */
-                        send_ack(client, packet_seq_id, 0);
-                        
-                        join_game(client, strtok(NULL, ";"));
-                        
-                    }
-                    /* Leave existing game */
-                    else if(strncmp(type, "LEAVE_GAME", 10) == 0) {
-                        
-                        /* ACK client */
-                        send_ack(client, packet_seq_id, 0);
-                        
-                        leave_game(client);
-                    }
-                    /* Start game */
-                    else if(strncmp(type, "START_GAME", 10) == 0) {
-                        
-                        /* ACK client */
-                        send_ack(client, packet_seq_id, 0);
-                        
-                        start_game(client);
-                    }
-                    /* Rolling die */
-                    else if(strncmp(type, "DIE_ROLL", 8) == 0) {
-                        
-                        /* ACK client */
-                        send_ack(client, packet_seq_id, 0);
-                        
-                        roll_die(client);
-                    }
-                    /* Moving figure */
-                    else if(strncmp(type, "FIGURE_MOVE", 11) == 0) {
-                        
-                        /* ACK client */
-                        send_ack(client, packet_seq_id, 0);
-                        
-                        /* Parse figure id */
-                        generic_chbuff = strtok(NULL, ";");
-                        generic_uint = (unsigned int) strtoul(generic_chbuff, NULL, 10);
-
-                        move_figure(client, generic_uint);
-                    }
-
-		   else if(strncmp(type, "MESSAGE", 7) == 0) {
-			
-			/* ACK client */
-			send_ack(client, packet_seq_id, 0);
-			
-			broadcast_message(client, strtok(NULL, ";"));
-		   }
-                                        
-                }
-                /* Packet was already processed */
-                else if(packet_seq_id < client->pkt_recv_seq_id &&
-                        strncmp(type, "ACK", 3) != 0) {
-                    
-                    send_ack(client, packet_seq_id, 1);
-                    
+            /* ACK carried in header of client's packet */
+            if(cmd.ack_id > 0) {
+                recv_ack(client, cmd.ack_id, 0);
+            }
+            
+            /* Check if expected seq ID matches, ACKs don't need ordering */
+            if(cmd.seq_id == client->pkt_recv_seq_id ||
+                    (cmd.seq_id > client->pkt_recv_seq_id && (cmd_defs[cmd.cmd].flags & CMD_UNORDERED))) {
+                
+                dispatch_cmd(&cmd, client, addr, home);
+                
+                /* Following packet may be waiting in reorder buffer (client
+                 * could be removed or handed over to another shard)
+                 */
+                client = get_client_by_addr(addr);
+                
+                if(client) {
+                    next_dgram = take_reordered_dgram(client);
                 }
+            }
+            /* Packet is ahead, hold it until the gap is filled (in text
+             * form, its ACK was already processed)
+             */
+            else if(cmd.seq_id > client->pkt_recv_seq_id) {
+                cmd.binary = 0;
                 
-                /* If client didnt close conection */
-                if(client != NULL) {
-                    
-                    /* Release client */
-                    release_client(client);
+                /* Duplicate ACK tells client which packet is missing */
+                if(format_cmd(&cmd, held, sizeof(held)) > 0 &&
+                        hold_reordered_dgram(client, cmd.seq_id, held)) {
+                    send_dup_ack(client);
                 }
             }
+            /* Packet was already processed */
+            else if(cmd.seq_id < client->pkt_recv_seq_id && !(cmd_defs[cmd.cmd].flags & CMD_UNORDERED)) {
+                
+                send_ack(client, cmd.seq_id, 1);
+                
+            }
         }
     }
+    
+    /* Process held datagram (recursion is bounded by REORDER_WINDOW) */
+    if(next_dgram) {
+        handle_dgram(next_dgram->msg, strlen(next_dgram->msg), addr, home);
+        
+        free_packet(next_dgram);
+    }
+    
+    flush_send_batch();
 }
 
 /**
- * void set_socket_timeout_linux()
+ * void set_socket_nonblocking(int sockfd)
  * 
- * Sets socket timeout on receiving calls to one second.
+ * Switches server socket to non-blocking mode. Receiving thread sleeps in
+ * its event loop until socket is readable and then drains it.
  */
-void set_socket_timeout_linux() {
-    struct timeval cur_tv;
-    
-    cur_tv.tv_sec = 1;
-    cur_tv.tv_usec = 0;
+void set_socket_nonblocking(int sockfd) {
+    int flags = fcntl(sockfd, F_GETFL, 0);
     
-    if(setsockopt(server_sockfd, SOL_SOCKET, SO_RCVTIMEO, &cur_tv, sizeof(cur_tv)) < 0) {
-        raise_error("Error setting socket timeout (linux).");
+    if(flags < 0 || fcntl(sockfd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        raise_error("Error setting socket to non-blocking mode.");
     }
 }
@@ -26,17 +26,23 @@
 
 #include <netinet/in.h>
 
+#include "global.h"
+
 /* Server started */
 extern struct timeval ts_start;
 
-/* Global server socket */
+/* Global server socket (used for sending) */
 extern int server_sockfd;
+/* Server sockets, one per shard */
+extern int server_sockfds[MAX_SHARDS];
+/* Number of shards */
+extern int shard_num;
 
 /* Function prototypes */
 void init_server(char *bind_ip, int port);
-void process_dgram(char *dgram, struct sockaddr_in *addr);
-void set_socket_timeout_linux();
-void set_socket_timeout_windows();
+void process_dgram(char *dgram, int len, struct sockaddr_in *addr);
+void handle_dgram(char *dgram, int len, struct sockaddr_in *addr, int home);
+void set_socket_nonblocking(int sockfd);
 
 #endif	/* SERVER_H */
 
@@ -0,0 +1,613 @@
+/** 
+ * -----------------------------------------------------------------------------
+ * Clovece nezlob se (Server) - simple board game
+ * 
+ * Server for board game Clovece nezlob se using UDP datagrams for communication
+ * with clients and SEND-AND-WAIT method to ensure that all packets arrive
+ * and that they arrive in correct order.
+ * 
+ * Semestral work for "Uvod do pocitacovich siti" KIV/UPS at
+ * University of West Bohemia.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * File: shard.c
+ * Description: Shard threads owning disjoint sets of clients and games,
+ *              cross-shard mailboxes.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * @author: Martin Kucera, 2014
+ * @version: 1.02
+ * 
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <netinet/in.h>
+
+#include "global.h"
+#include "server.h"
+#include "receiver.h"
+#include "sender.h"
+#include "game_watchdog.h"
+#include "client.h"
+#include "game.h"
+#include "com.h"
+#include "event.h"
+#include "uring.h"
+#include "logger.h"
+#include "shard.h"
+#include "err.h"
+
+/* All shards */
+shard_t shards[MAX_SHARDS];
+/* Shard owned by calling thread */
+__thread shard_t *cur_shard = NULL;
+
+/**
+ * void init_shards()
+ * 
+ * Prepares empty shards and their mailboxes. Has to be called before any
+ * shard is started.
+ */
+void init_shards() {
+    int i;
+    
+    for(i = 0; i < shard_num; i++) {
+        shards[i].index = i;
+        
+        slab_init(&shards[i].clients, sizeof(client_t));
+        slab_init(&shards[i].games, sizeof(game_t));
+        index_map_init(&shards[i].client_map);
+        index_map_init(&shards[i].rcode_map);
+        index_map_init(&shards[i].game_map);
+        index_map_init(&shards[i].route_map);
+        
+        shards[i].mbox_stub = new_shard_msg(SHARD_MSG_DGRAM, NULL, NULL, 0);
+        shards[i].mbox_head = shards[i].mbox_stub;
+        shards[i].mbox_tail = shards[i].mbox_stub;
+        shards[i].mbox_event = create_event();
+    }
+}
+
+/**
+ * shard_msg_t *pop_shard_msg(shard_t *shard)
+ * 
+ * Takes oldest message from shard's mailbox, can be called only by shard's
+ * own thread. Returns NULL if mailbox is empty or if a producer didn't
+ * finish posting yet (it signals mailbox afterwards).
+ */
+static shard_msg_t *pop_shard_msg(shard_t *shard) {
+    shard_msg_t *tail = shard->mbox_tail;
+    shard_msg_t *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    
+    /* Skip stub */
+    if(tail == shard->mbox_stub) {
+        if(!next) {
+            return NULL;
+        }
+        
+        shard->mbox_tail = next;
+        tail = next;
+        next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    }
+    
+    if(next) {
+        shard->mbox_tail = next;
+        
+        return tail;
+    }
+    
+    /* Producer is between exchanging head and linking message */
+    if(tail != __atomic_load_n(&shard->mbox_head, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    
+    /* Last message, put stub behind it so it can be taken */
+    shard->mbox_stub->next = NULL;
+    post_shard_msg(shard->index, shard->mbox_stub);
+    
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    
+    if(next) {
+        shard->mbox_tail = next;
+        
+        return tail;
+    }
+    
+    return NULL;
+}
+
+/**
+ * void close_shards()
+ * 
+ * Frees messages left in mailboxes, closes their events and frees shards'
+ * tables, after all shards finished.
+ */
+void close_shards() {
+    shard_msg_t *msg;
+    int i;
+    
+    for(i = 0; i < shard_num; i++) {
+        while((msg = pop_shard_msg(&shards[i])) != NULL) {
+            free(msg->packets);
+            free(msg);
+        }
+        
+        free(shards[i].mbox_stub);
+        
+        close(shards[i].mbox_event);
+        
+        slab_destroy(&shards[i].clients);
+        slab_destroy(&shards[i].games);
+        index_map_destroy(&shards[i].client_map);
+        index_map_destroy(&shards[i].rcode_map);
+        index_map_destroy(&shards[i].game_map);
+        index_map_destroy(&shards[i].route_map);
+        destroy_packet_pool(&shards[i].packet_pool);
+    }
+}
+
+/**
+ * void post_shard_msg(int shard, shard_msg_t *msg)
+ * 
+ * Appends message to shard's mailbox and wakes the shard up. Can be called
+ * by any thread, message belongs to the receiving shard from now on.
+ */
+void post_shard_msg(int shard, shard_msg_t *msg) {
+    shard_msg_t *prev;
+    
+    msg->next = NULL;
+    
+    prev = __atomic_exchange_n(&shards[shard].mbox_head, msg, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&prev->next, msg, __ATOMIC_RELEASE);
+    
+    /* Stub is reinserted by the shard itself */
+    if(msg != shards[shard].mbox_stub) {
+        signal_event(shards[shard].mbox_event);
+    }
+}
+
+/**
+ * shard_msg_t *new_shard_msg(int type, struct sockaddr_in *addr, const char *data, int len)
+ * 
+ * Allocates mailbox message of given type with copy of address (if any)
+ * and len bytes of data (if any), data are null terminated.
+ */
+shard_msg_t *new_shard_msg(int type, struct sockaddr_in *addr, const char *data, int len) {
+    shard_msg_t *msg = (shard_msg_t *) malloc(sizeof(shard_msg_t) + len + 1);
+    
+    memset(msg, 0, sizeof(shard_msg_t));
+    msg->type = type;
+    
+    if(addr) {
+        memcpy(&msg->addr, addr, sizeof(struct sockaddr_in));
+    }
+    
+    if(data) {
+        memcpy(msg->data, data, len);
+    }
+    
+    msg->len = len;
+    msg->data[len] = 0;
+    
+    return msg;
+}
+
+/**
+ * int shard_by_code(char *code)
+ * 
+ * Returns index of shard which issued given game or reconnect code,
+ * or -1 if code is invalid.
+ */
+int shard_by_code(char *code) {
+    if(code && code[0] >= SHARD_CODE_CHAR(0) && code[0] < SHARD_CODE_CHAR(shard_num)) {
+        return code[0] - SHARD_CODE_CHAR(0);
+    }
+    
+    return -1;
+}
+
+/**
+ * void update_route(struct sockaddr_in *addr, int owner)
+ * 
+ * Sets shard owning client with given address in current shard's routes.
+ * Negative owner (or current shard) removes the route.
+ */
+static void update_route(struct sockaddr_in *addr, int owner) {
+    if(owner < 0 || owner == cur_shard->index) {
+        index_map_remove(&cur_shard->route_map, addr_key(addr), -1);
+    }
+    else if(!index_map_put(&cur_shard->route_map, addr_key(addr), owner)) {
+        LOG_LINE(LOG_WARN, "SERV: No free route for migrated client.");
+    }
+}
+
+/**
+ * void set_route(int shard, struct sockaddr_in *addr, int owner)
+ * 
+ * Tells shard which receives datagrams from given address which shard
+ * owns the client. Negative owner removes the route.
+ */
+void set_route(int shard, struct sockaddr_in *addr, int owner) {
+    shard_msg_t *msg;
+    
+    if(shard == cur_shard->index) {
+        update_route(addr, owner);
+    }
+    else {
+        msg = new_shard_msg(owner < 0 ? SHARD_MSG_UNROUTE : SHARD_MSG_ROUTE, addr, NULL, 0);
+        msg->owner = owner;
+        
+        post_shard_msg(shard, msg);
+    }
+}
+
+/**
+ * int forward_dgram(char *dgram, int len, struct sockaddr_in *addr, int shard, int home)
+ * 
+ * Passes datagram to shard owning its client. Home is the shard which
+ * received datagram from socket.
+ */
+int forward_dgram(char *dgram, int len, struct sockaddr_in *addr, int shard, int home) {
+    shard_msg_t *msg = new_shard_msg(SHARD_MSG_DGRAM, addr, dgram, len);
+    
+    msg->home = home;
+    
+    post_shard_msg(shard, msg);
+    
+    return 1;
+}
+
+/**
+ * int route_dgram(char *dgram, int len, struct sockaddr_in *addr)
+ * 
+ * If datagram received from socket belongs to client owned by another
+ * shard, forwards it there and returns 1, otherwise returns 0.
+ */
+int route_dgram(char *dgram, int len, struct sockaddr_in *addr) {
+    int owner = index_map_get(&cur_shard->route_map, addr_key(addr));
+    
+    if(owner >= 0) {
+        return forward_dgram(dgram, len, addr, owner, cur_shard->index);
+    }
+    
+    return 0;
+}
+
+/**
+ * void migrate_client(client_t *client, int shard, char *game_code)
+ * 
+ * Hands client over to another shard which owns the game he wants to join.
+ * Client's datagrams are forwarded there from now on.
+ */
+void migrate_client(client_t *client, int shard, char *game_code) {
+    shard_msg_t *msg = new_shard_msg(SHARD_MSG_MIGRATE, NULL, game_code, strlen(game_code));
+    unsigned int queued = ring_size(&client->dgram_queue);
+    packet_t *held[REORDER_WINDOW];
+    struct sockaddr_in addr;
+    int home = client->home_shard;
+    unsigned int j;
+    int code;
+    int i;
+    
+    /* Log, code sent by client is kept as text if it can't be packed */
+    if(LOG_EVENT_ENABLED(LOG_DEBUG) && (code = evlog_pack_code(game_code)) >= 0) {
+        log_event(LOG_DEBUG, EV_CLIENT_MIGRATED, client->client_index, -1, 0,
+                code, shard, 0, 0);
+    }
+    else {
+        LOG_FMT(LOG_DEBUG,
+                "Migrating client with index %d to shard %d to join game with code %s",
+                client->client_index,
+                shard,
+                game_code
+                );
+    }
+    
+    set_route(client->home_shard, client->addr, shard);
+    
+    /* ACK can't wait for packets sent by another shard */
+    send_pending_ack(client);
+    
+    /* Queued packets are copied, originals go back to pool of current shard */
+    if(queued) {
+        msg->packets = (packet_t *) malloc(queued * sizeof(packet_t));
+        
+        if(!msg->packets) {
+            raise_error("Error allocating migrated packets.");
+        }
+        
+        for(j = 0; j < queued; j++) {
+            copy_packet(&msg->packets[j], ring_at(&client->dgram_queue, j));
+        }
+    }
+    
+    /* Target shard owns the record once message is posted, whatever is
+     * needed afterwards is kept aside
+     */
+    memcpy(&addr, client->addr, sizeof(struct sockaddr_in));
+    memcpy(held, client->reorder, sizeof(held));
+    
+    /* Record is copied, its slot is reused by current shard */
+    memcpy(&msg->client, client, sizeof(client_t));
+    memset(msg->client.reorder, 0, sizeof(msg->client.reorder));
+    memset(client->reorder, 0, sizeof(client->reorder));
+    clear_client_dgram_queue(client);
+    detach_client(client);
+    
+    post_shard_msg(shard, msg);
+    
+    /* Packets held for reordering follow client */
+    for(i = 0; i < REORDER_WINDOW; i++) {
+        if(held[i]) {
+            forward_dgram(held[i]->msg, strlen(held[i]->msg), &addr, shard, home);
+            
+            free_packet(held[i]);
+            cur_shard->reorder_held--;
+        }
+    }
+}
+
+/**
+ * void adopt_packets(client_t *client, shard_msg_t *msg)
+ * 
+ * Refills queue of client migrated to current shard with packets from
+ * its pool, copied from the ones client had queued in previous shard.
+ */
+static void adopt_packets(client_t *client, shard_msg_t *msg) {
+    unsigned int queued = ring_size(&client->dgram_queue);
+    packet_t *packet;
+    unsigned int i;
+    
+    ring_init(&client->dgram_queue);
+    
+    for(i = 0; i < queued; i++) {
+        packet = alloc_packet();
+        copy_packet(packet, &msg->packets[i]);
+        
+        ring_push(&client->dgram_queue, packet);
+    }
+}
+
+/**
+ * void broadcast_shards(char *msg, int req_ack)
+ * 
+ * Asks all shards to send message to all their clients.
+ */
+void broadcast_shards(char *msg, int req_ack) {
+    shard_msg_t *shard_msg;
+    int i;
+    
+    for(i = 0; i < shard_num; i++) {
+        shard_msg = new_shard_msg(SHARD_MSG_BROADCAST, NULL, msg, strlen(msg));
+        shard_msg->req_ack = req_ack;
+        
+        post_shard_msg(i, shard_msg);
+    }
+}
+
+/**
+ * void display_shards_rtt()
+ * 
+ * Asks all shards to log round trip times of their clients.
+ */
+void display_shards_rtt() {
+    int i;
+    
+    for(i = 0; i < shard_num; i++) {
+        post_shard_msg(i, new_shard_msg(SHARD_MSG_RTT, NULL, NULL, 0));
+    }
+}
+
+/**
+ * void dump_shards_recorder(struct sockaddr_in *addr)
+ * 
+ * Asks all shards to log flight recorder of client with given address,
+ * only the shard owning him does.
+ */
+void dump_shards_recorder(struct sockaddr_in *addr) {
+    int i;
+    
+    for(i = 0; i < shard_num; i++) {
+        post_shard_msg(i, new_shard_msg(SHARD_MSG_RECORDER, addr, NULL, 0));
+    }
+}
+
+/**
+ * void process_mailbox(shard_t *shard)
+ * 
+ * Handles all messages posted to shard.
+ */
+static void process_mailbox(shard_t *shard) {
+    shard_msg_t *msg;
+    client_t *client;
+    
+    while((msg = pop_shard_msg(shard)) != NULL) {
+        switch(msg->type) {
+            /* Datagram of owned client received by another shard */
+            case SHARD_MSG_DGRAM:
+                handle_dgram(msg->data, msg->len, &msg->addr, msg->home);
+                break;
+            
+            /* Client joining game owned by this shard */
+            case SHARD_MSG_MIGRATE:
+                client = attach_client(&msg->client);
+                adopt_packets(client, msg);
+                
+                /* Reconnect code has to point to this shard now */
+                send_reconnect_code(client);
+                
+                join_game(client, msg->data);
+                break;
+            
+            case SHARD_MSG_ROUTE:
+            case SHARD_MSG_UNROUTE:
+                update_route(&msg->addr, msg->owner);
+                break;
+            
+            case SHARD_MSG_BROADCAST:
+                broadcast_clients(msg->data, msg->req_ack);
+                break;
+            
+            case SHARD_MSG_RTT:
+                display_clients_rtt();
+                break;
+            
+            case SHARD_MSG_RECORDER:
+                dump_recorder_by_addr(&msg->addr);
+                break;
+        }
+        
+        free(msg->packets);
+        free(msg);
+    }
+}
+
+/**
+ * void pin_shard(int index)
+ * 
+ * Pins calling shard to one CPU, so datagrams steered to the shard
+ * are always processed on the same core.
+ */
+static void pin_shard(int index) {
+    cpu_set_t cpus;
+    long cpu_num = sysconf(_SC_NPROCESSORS_ONLN);
+    
+    if(cpu_num < 1) {
+        return;
+    }
+    
+    CPU_ZERO(&cpus);
+    CPU_SET(index % cpu_num, &cpus);
+    
+    if(pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+        LOG_LINE(LOG_WARN, "SERV: Couldn't pin shard thread to CPU.");
+    }
+}
+
+/**
+ * void *start_shard(void *arg)
+ * 
+ * Entry point for shard thread. Shard owns one socket of the reuseport
+ * group together with all clients whose datagrams are steered to it and
+ * all games created by them. Clients joining games of other shards are
+ * migrated there and their datagrams are forwarded through mailboxes.
+ * 
+ * Thread sleeps in event loop until its socket is readable, a message is
+ * posted to its mailbox, the earliest packet, client or game timeout
+ * expires or until main thread asks him to terminate. After each wakeup
+ * handles all messages and datagrams, (re)sends queued packets and checks
+ * timeouts of clients and games.
+ */
+void *start_shard(void *arg) {
+    shard_t *shard = (shard_t *) arg;
+    int sockfd = server_sockfds[shard->index];
+    /* Event loop watching socket, mailbox, timer and shutdown */
+    int fds[4];
+    int ready[4];
+    int epfd, timer;
+    /* Receiving ring when io_uring backend is used */
+    int ring_fd = -1;
+    /* Lowest time before packet, client or game timeouts */
+    long wait, game_wait;
+    int i, n;
+    
+    cur_shard = shard;
+    log_shard = shard->index;
+    
+    if(shard_num > 1) {
+        pin_shard(shard->index);
+    }
+    
+    init_receiver();
+    
+    /* With io_uring backend, completions are watched instead of socket */
+    if(io_backend == IO_BACKEND_URING) {
+        if((ring_fd = uring_recv_start(sockfd)) < 0) {
+            LOG_LINE(LOG_ERR, "SERV: Couldn't start io_uring receive, using recvmmsg.");
+        }
+    }
+    
+    timer = create_timer();
+    
+    fds[0] = ring_fd >= 0 ? ring_fd : sockfd;
+    fds[1] = shard->mbox_event;
+    fds[2] = timer;
+    fds[3] = shutdown_event;
+    epfd = create_event_loop(fds, 4);
+    
+    while(!stop_thread(shard->thr_mutex)) {
+        /* Send everything from this pass at once */
+        begin_send_batch();
+        
+        process_mailbox(shard);
+        
+        if(ring_fd >= 0 && receive_uring() < 0) {
+            /* Multishot receive not supported, watch socket from now on */
+            LOG_LINE(LOG_ERR, "SERV: Multishot receive not supported, using recvmmsg.");
+            
+            uring_recv_stop();
+            close(epfd);
+            
+            ring_fd = -1;
+            fds[0] = sockfd;
+            epfd = create_event_loop(fds, 4);
+        }
+        
+        if(ring_fd < 0) {
+            receive_dgrams(sockfd);
+        }
+        
+        /* Games first, packets they enqueue are sent by this sender pass */
+        game_wait = watchdog_pass();
+        wait = sender_pass();
+        
+        if(game_wait >= 0 && (wait < 0 || game_wait < wait)) {
+            wait = game_wait;
+        }
+        
+        flush_send_batch();
+        
+        /* Sleep until next timeout or until we are woken up */
+        set_timer(timer, wait);
+        
+        n = wait_events(epfd, ready, 4);
+        
+        for(i = 0; i < n; i++) {
+            if(ready[i] == shard->mbox_event || ready[i] == timer) {
+                clear_event(ready[i]);
+            }
+        }
+    }
+    
+    /* Inform clients about shutdown and free them */
+    begin_send_batch();
+    
+    broadcast_clients("CONN_CLOSE", 0);
+    clear_all_clients();
+    clear_all_games();
+    
+    flush_send_batch();
+    
+    close(epfd);
+    close(timer);
+    
+    if(ring_fd >= 0) {
+        uring_recv_stop();
+    }
+    
+    LOG_FMT(LOG_ALWAYS,
+            "SERV: Shard %d terminated.",
+            shard->index
+            );
+    
+    pthread_exit(NULL);
+}
@@ -0,0 +1,131 @@
+/** 
+ * -----------------------------------------------------------------------------
+ * Clovece nezlob se (Server) - simple board game
+ * 
+ * Server for board game Clovece nezlob se using UDP datagrams for communication
+ * with clients and SEND-AND-WAIT method to ensure that all packets arrive
+ * and that they arrive in correct order.
+ * 
+ * Semestral work for "Uvod do pocitacovich siti" KIV/UPS at
+ * University of West Bohemia.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * File: shard.c
+ * Description: Shard threads owning disjoint sets of clients and games,
+ *              cross-shard mailboxes.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * @author: Martin Kucera, 2014
+ * @version: 1.02
+ * 
+ */
+
+#ifndef SHARD_H
+#define	SHARD_H
+
+#include <pthread.h>
+#include <netinet/in.h>
+
+#include "global.h"
+#include "client.h"
+#include "game.h"
+#include "slab.h"
+#include "index_map.h"
+#include "pool.h"
+
+/* Mailbox message types */
+#define SHARD_MSG_DGRAM 0
+#define SHARD_MSG_MIGRATE 1
+#define SHARD_MSG_ROUTE 2
+#define SHARD_MSG_UNROUTE 3
+#define SHARD_MSG_BROADCAST 4
+#define SHARD_MSG_RTT 5
+#define SHARD_MSG_RECORDER 6
+
+/* First letter of game and reconnect codes identifies owning shard */
+#define SHARD_CODE_CHAR(index) ((char) ('A' + (index)))
+
+typedef struct shard_msg {
+    /* Next message in mailbox */
+    struct shard_msg *next;
+    /* Message type */
+    int type;
+    /* Shard which received datagram from socket */
+    int home;
+    /* Shard owning routed client */
+    int owner;
+    /* Client's address */
+    struct sockaddr_in addr;
+    /* Migrated client (record is moved to target shard) */
+    client_t client;
+    /* Copies of migrated client's queued packets, target shard takes them
+     * into its own packet pool
+     */
+    packet_t *packets;
+    /* Broadcast requires ACK */
+    int req_ack;
+    /* Length of data (binary datagram may contain zeros) */
+    int len;
+    /* Datagram, game code or broadcasted message */
+    char data[];
+} shard_msg_t;
+
+typedef struct {
+    /* Shard index */
+    int index;
+    /* Thread's stop mutex */
+    pthread_mutex_t *thr_mutex;
+    
+    /* Clients owned by shard (client_t records) */
+    slab_t clients;
+    /* Indexes of owned clients by their address */
+    index_map_t client_map;
+    /* Indexes of owned clients by their reconnect code */
+    index_map_t rcode_map;
+    
+    /* Games owned by shard (game_t records) */
+    slab_t games;
+    /* Indexes of owned games by their code */
+    index_map_t game_map;
+    
+    /* Shards owning clients steered to this shard by their address */
+    index_map_t route_map;
+    
+    /* Outgoing packets of owned clients */
+    packet_pool_t packet_pool;
+    /* Number of client packets held for reordering */
+    unsigned int reorder_held;
+    
+    /* Mailbox (multiple producers, shard is the only consumer) */
+    shard_msg_t *mbox_head;
+    shard_msg_t *mbox_tail;
+    shard_msg_t *mbox_stub;
+    /* Signalled after message is posted */
+    int mbox_event;
+    
+} shard_t;
+
+/* All shards */
+extern shard_t shards[MAX_SHARDS];
+/* Shard owned by calling thread */
+extern __thread shard_t *cur_shard;
+
+/* Function prototypes */
+void init_shards();
+void close_shards();
+void *start_shard(void *arg);
+void post_shard_msg(int shard, shard_msg_t *msg);
+shard_msg_t *new_shard_msg(int type, struct sockaddr_in *addr, const char *data, int len);
+int shard_by_code(char *code);
+int forward_dgram(char *dgram, int len, struct sockaddr_in *addr, int shard, int home);
+int route_dgram(char *dgram, int len, struct sockaddr_in *addr);
+void set_route(int shard, struct sockaddr_in *addr, int owner);
+void migrate_client(client_t *client, int shard, char *game_code);
+void broadcast_shards(char *msg, int req_ack);
+void display_shards_rtt();
+void dump_shards_recorder(struct sockaddr_in *addr);
+
+#endif	/* SHARD_H */
+
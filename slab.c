@@ -0,0 +1,167 @@
+/** 
+ * -----------------------------------------------------------------------------
+ * Clovece nezlob se (Server) - simple board game
+ * 
+ * Server for board game Clovece nezlob se using UDP datagrams for communication
+ * with clients and SEND-AND-WAIT method to ensure that all packets arrive
+ * and that they arrive in correct order. 
+ * 
+ * Semestral work for "Uvod do pocitacovich siti" KIV/UPS at
+ * University of West Bohemia.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * File: slab.c
+ * Description: Chunked tables of fixed size records with free-index stack,
+ *              records never move once allocated.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * @author: Martin Kucera, 2014
+ * @version: 1.02
+ * 
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "slab.h"
+
+/**
+ * unsigned char *slab_used(slab_t *slab, unsigned int index)
+ * 
+ * Returns pointer to used flag of record with given index.
+ */
+static unsigned char *slab_used(slab_t *slab, unsigned int index) {
+    return (unsigned char *) slab->chunks[index / SLAB_CHUNK_SIZE] +
+            SLAB_CHUNK_SIZE * slab->rec_size + index % SLAB_CHUNK_SIZE;
+}
+
+/**
+ * int slab_grow(slab_t *slab)
+ * 
+ * Allocates one more chunk and pushes its indexes to the free stack.
+ * Already allocated chunks stay where they are. Returns 0 if memory
+ * couldn't be allocated.
+ */
+static int slab_grow(slab_t *slab) {
+    char **chunks;
+    unsigned int *free_stack;
+    char *chunk;
+    unsigned int i;
+    
+    chunks = (char **) realloc(slab->chunks, (slab->chunk_num + 1) * sizeof(char *));
+    
+    if(!chunks) {
+        return 0;
+    }
+    
+    slab->chunks = chunks;
+    
+    free_stack = (unsigned int *) realloc(slab->free_stack,
+            (slab->capacity + SLAB_CHUNK_SIZE) * sizeof(unsigned int));
+    
+    if(!free_stack) {
+        return 0;
+    }
+    
+    slab->free_stack = free_stack;
+    
+    chunk = (char *) calloc(SLAB_CHUNK_SIZE, slab->rec_size + 1);
+    
+    if(!chunk) {
+        return 0;
+    }
+    
+    slab->chunks[slab->chunk_num++] = chunk;
+    
+    /* Push in reverse, so that lower indexes are used first */
+    for(i = SLAB_CHUNK_SIZE; i > 0; i--) {
+        slab->free_stack[slab->free_num++] = slab->capacity + i - 1;
+    }
+    
+    slab->capacity += SLAB_CHUNK_SIZE;
+    
+    return 1;
+}
+
+/**
+ * void slab_init(slab_t *slab, size_t rec_size)
+ * 
+ * Prepares empty slab of records with given size, no memory is allocated
+ * until first record is.
+ */
+void slab_init(slab_t *slab, size_t rec_size) {
+    memset(slab, 0, sizeof(slab_t));
+    
+    slab->rec_size = rec_size;
+}
+
+/**
+ * void slab_destroy(slab_t *slab)
+ * 
+ * Frees all chunks of slab.
+ */
+void slab_destroy(slab_t *slab) {
+    unsigned int i;
+    
+    for(i = 0; i < slab->chunk_num; i++) {
+        free(slab->chunks[i]);
+    }
+    
+    free(slab->chunks);
+    free(slab->free_stack);
+    
+    slab_init(slab, slab->rec_size);
+}
+
+/**
+ * int slab_alloc(slab_t *slab)
+ * 
+ * Takes free record (zeroed) from top of the free stack, grows slab if there
+ * is none. Returns index of record or -1 if memory couldn't be allocated.
+ */
+int slab_alloc(slab_t *slab) {
+    unsigned int index;
+    
+    if(!slab->free_num && !slab_grow(slab)) {
+        return -1;
+    }
+    
+    index = slab->free_stack[--slab->free_num];
+    
+    memset(slab->chunks[index / SLAB_CHUNK_SIZE] + (index % SLAB_CHUNK_SIZE) * slab->rec_size,
+            0, slab->rec_size);
+    *slab_used(slab, index) = 1;
+    
+    slab->count++;
+    
+    return (int) index;
+}
+
+/**
+ * void *slab_get(slab_t *slab, int index)
+ * 
+ * Returns record with given index or NULL if it isn't allocated.
+ */
+void *slab_get(slab_t *slab, int index) {
+    if(index < 0 || (unsigned int) index >= slab->capacity || !*slab_used(slab, index)) {
+        return NULL;
+    }
+    
+    return slab->chunks[index / SLAB_CHUNK_SIZE] + (index % SLAB_CHUNK_SIZE) * slab->rec_size;
+}
+
+/**
+ * void slab_free(slab_t *slab, int index)
+ * 
+ * Returns record with given index to the free stack.
+ */
+void slab_free(slab_t *slab, int index) {
+    if(slab_get(slab, index)) {
+        *slab_used(slab, index) = 0;
+        slab->free_stack[slab->free_num++] = index;
+        
+        slab->count--;
+    }
+}
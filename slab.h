@@ -0,0 +1,61 @@
+/** 
+ * -----------------------------------------------------------------------------
+ * Clovece nezlob se (Server) - simple board game
+ * 
+ * Server for board game Clovece nezlob se using UDP datagrams for communication
+ * with clients and SEND-AND-WAIT method to ensure that all packets arrive
+ * and that they arrive in correct order. 
+ * 
+ * Semestral work for "Uvod do pocitacovich siti" KIV/UPS at
+ * University of West Bohemia.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * File: slab.c
+ * Description: Chunked tables of fixed size records with free-index stack,
+ *              records never move once allocated.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * @author: Martin Kucera, 2014
+ * @version: 1.02
+ * 
+ */
+
+#ifndef SLAB_H
+#define	SLAB_H
+
+#include <stddef.h>
+
+/* Number of records allocated at once when slab grows */
+#define SLAB_CHUNK_SIZE 1024
+
+typedef struct {
+    /* Size of one record */
+    size_t rec_size;
+    
+    /* Chunks of records, each followed by used flags of its records */
+    char **chunks;
+    /* Number of allocated chunks */
+    unsigned int chunk_num;
+    /* Number of records in allocated chunks */
+    unsigned int capacity;
+    
+    /* Stack of free indexes */
+    unsigned int *free_stack;
+    /* Number of free indexes */
+    unsigned int free_num;
+    
+    /* Number of used records */
+    unsigned int count;
+} slab_t;
+
+/* Function prototypes */
+void slab_init(slab_t *slab, size_t rec_size);
+void slab_destroy(slab_t *slab);
+int slab_alloc(slab_t *slab);
+void *slab_get(slab_t *slab, int index);
+void slab_free(slab_t *slab, int index);
+
+#endif	/* SLAB_H */
+
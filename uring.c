@@ -0,0 +1,585 @@
+/** 
+ * -----------------------------------------------------------------------------
+ * Clovece nezlob se (Server) - simple board game
+ * 
+ * Server for board game Clovece nezlob se using UDP datagrams for communication
+ * with clients and SEND-AND-WAIT method to ensure that all packets arrive
+ * and that they arrive in correct order. 
+ * 
+ * Semestral work for "Uvod do pocitacovich siti" KIV/UPS at
+ * University of West Bohemia.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * File: uring.c
+ * Description: io_uring I/O backend for receiving and sending datagrams.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * @author: Martin Kucera, 2014
+ * @version: 1.02
+ * 
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/io_uring.h>
+
+#include "global.h"
+#include "server.h"
+#include "com.h"
+#include "receiver.h"
+#include "logger.h"
+#include "uring.h"
+
+/* Size of one receive buffer, kernel writes recvmsg header, source address
+ * and payload into it, last byte is kept for terminating null character.
+ * Rounded up to 8 bytes so that every header stays aligned.
+ */
+#define URING_RECV_BUFFER_SIZE ((sizeof(struct io_uring_recvmsg_out) + \
+        sizeof(struct sockaddr_in) + MAX_DGRAM_SIZE + 8) & ~7UL)
+
+/* User data of multishot receive */
+#define URING_RECV_TAG 1
+
+/* Selected I/O backend */
+int io_backend = IO_BACKEND_SYSCALL;
+/* Number of io_uring_enter calls */
+unsigned int uring_enters = 0;
+
+typedef struct {
+    /* Ring descriptor */
+    int fd;
+    
+    /* Submission queue */
+    unsigned int sq_entries;
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_array;
+    struct io_uring_sqe *sqes;
+    /* Tail of filled SQEs, published on submit */
+    unsigned int sqe_tail;
+    
+    /* Completion queue */
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_cqe *cqes;
+    
+    /* Mapped memory */
+    void *sq_ring;
+    size_t sq_ring_len;
+    void *cq_ring;
+    size_t cq_ring_len;
+    size_t sqes_len;
+} uring_t;
+
+/* Receiving ring of each shard */
+static __thread uring_t recv_ring;
+/* Socket received from */
+static __thread int recv_sockfd;
+/* Registered buffer ring */
+static __thread struct io_uring_buf *recv_bufs = NULL;
+/* Local tail of buffer ring, published after recycling buffers */
+static __thread unsigned short recv_bufs_tail;
+/* Memory of receive buffers */
+static __thread char *recv_buf_mem = NULL;
+/* Template of multishot recvmsg */
+static __thread struct msghdr recv_msg;
+
+/* Sending ring of each thread, created on first send */
+static __thread uring_t *send_ring = NULL;
+/* Set if sending ring couldn't be created */
+static __thread int send_ring_failed = 0;
+
+/**
+ * int uring_enter(uring_t *ring, unsigned int to_submit, unsigned int min_complete)
+ * 
+ * Submits SQEs and optionally waits for given number of completions.
+ */
+static int uring_enter(uring_t *ring, unsigned int to_submit, unsigned int min_complete) {
+    /* Stats */
+    STAT_ADD(uring_enters, 1);
+    
+    return (int) syscall(__NR_io_uring_enter, ring->fd, to_submit, min_complete,
+            min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+/**
+ * void uring_exit(uring_t *ring)
+ * 
+ * Unmaps ring memory and closes ring
+ */
+static void uring_exit(uring_t *ring) {
+    if(ring->sqes && ring->sqes != MAP_FAILED) {
+        munmap(ring->sqes, ring->sqes_len);
+    }
+    
+    if(ring->cq_ring && ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring) {
+        munmap(ring->cq_ring, ring->cq_ring_len);
+    }
+    
+    if(ring->sq_ring && ring->sq_ring != MAP_FAILED) {
+        munmap(ring->sq_ring, ring->sq_ring_len);
+    }
+    
+    if(ring->fd >= 0) {
+        close(ring->fd);
+    }
+    
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
+
+/**
+ * int uring_init(uring_t *ring, unsigned int entries, unsigned int cq_entries)
+ * 
+ * Creates new ring and maps its queues. If cq_entries is not 0, completion
+ * queue is created with given size. Returns 1 on success.
+ */
+static int uring_init(uring_t *ring, unsigned int entries, unsigned int cq_entries) {
+    struct io_uring_params p;
+    char *sq, *cq;
+    
+    memset(ring, 0, sizeof(*ring));
+    memset(&p, 0, sizeof(p));
+    
+    p.flags = IORING_SETUP_SUBMIT_ALL;
+    
+    if(cq_entries) {
+        p.flags |= IORING_SETUP_CQSIZE;
+        p.cq_entries = cq_entries;
+    }
+    
+    ring->fd = (int) syscall(__NR_io_uring_setup, entries, &p);
+    
+    if(ring->fd < 0) {
+        return 0;
+    }
+    
+    ring->sq_entries = p.sq_entries;
+    ring->sq_ring_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    ring->cq_ring_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    
+    /* Both rings can be mapped at once */
+    if(p.features & IORING_FEAT_SINGLE_MMAP) {
+        if(ring->cq_ring_len > ring->sq_ring_len) {
+            ring->sq_ring_len = ring->cq_ring_len;
+        }
+        
+        ring->cq_ring_len = ring->sq_ring_len;
+    }
+    
+    ring->sq_ring = mmap(NULL, ring->sq_ring_len, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    
+    if(ring->sq_ring == MAP_FAILED) {
+        uring_exit(ring);
+        
+        return 0;
+    }
+    
+    if(p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring = ring->sq_ring;
+    }
+    else {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_len, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        
+        if(ring->cq_ring == MAP_FAILED) {
+            uring_exit(ring);
+            
+            return 0;
+        }
+    }
+    
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    
+    if(ring->sqes == MAP_FAILED) {
+        uring_exit(ring);
+        
+        return 0;
+    }
+    
+    sq = (char *) ring->sq_ring;
+    cq = (char *) ring->cq_ring;
+    
+    ring->sq_head = (unsigned int *) (sq + p.sq_off.head);
+    ring->sq_tail = (unsigned int *) (sq + p.sq_off.tail);
+    ring->sq_mask = (unsigned int *) (sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned int *) (sq + p.sq_off.array);
+    ring->sqe_tail = *ring->sq_tail;
+    
+    ring->cq_head = (unsigned int *) (cq + p.cq_off.head);
+    ring->cq_tail = (unsigned int *) (cq + p.cq_off.tail);
+    ring->cq_mask = (unsigned int *) (cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+    
+    return 1;
+}
+
+/**
+ * struct io_uring_sqe *uring_get_sqe(uring_t *ring)
+ * 
+ * Returns next free SQE (cleared) or NULL if submission queue is full.
+ */
+static struct io_uring_sqe *uring_get_sqe(uring_t *ring) {
+    struct io_uring_sqe *sqe;
+    unsigned int head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    unsigned int index;
+    
+    if(ring->sqe_tail - head >= ring->sq_entries) {
+        return NULL;
+    }
+    
+    index = ring->sqe_tail & *ring->sq_mask;
+    sqe = &ring->sqes[index];
+    ring->sq_array[index] = index;
+    ring->sqe_tail++;
+    
+    memset(sqe, 0, sizeof(*sqe));
+    
+    return sqe;
+}
+
+/**
+ * int uring_submit(uring_t *ring, unsigned int min_complete)
+ * 
+ * Publishes filled SQEs to kernel and submits them, optionally waiting
+ * for given number of completions.
+ */
+static int uring_submit(uring_t *ring, unsigned int min_complete) {
+    unsigned int to_submit = ring->sqe_tail - *ring->sq_tail;
+    
+    __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+    
+    return uring_enter(ring, to_submit, min_complete);
+}
+
+/**
+ * int uring_available()
+ * 
+ * Checks if kernel supports io_uring by creating a small ring.
+ */
+int uring_available() {
+    uring_t ring;
+    
+    if(!uring_init(&ring, 2, 0)) {
+        return 0;
+    }
+    
+    uring_exit(&ring);
+    
+    return 1;
+}
+
+/**
+ * void uring_recycle_buffer(unsigned short bid)
+ * 
+ * Returns receive buffer back to buffer ring. Ring tail has to be published
+ * afterwards.
+ */
+static void uring_recycle_buffer(unsigned short bid) {
+    struct io_uring_buf *buf = &recv_bufs[recv_bufs_tail & (URING_RECV_BUFFERS - 1)];
+    
+    /* Tail overlays resv of first entry, don't touch it */
+    buf->addr = (unsigned long) (recv_buf_mem + bid * URING_RECV_BUFFER_SIZE);
+    buf->len = URING_RECV_BUFFER_SIZE - 1;
+    buf->bid = bid;
+    
+    recv_bufs_tail++;
+}
+
+/**
+ * void uring_publish_buffers()
+ * 
+ * Makes recycled buffers visible to kernel.
+ */
+static void uring_publish_buffers() {
+    __atomic_store_n((unsigned short *) &recv_bufs[0].resv, recv_bufs_tail, __ATOMIC_RELEASE);
+}
+
+/**
+ * int uring_arm_recv()
+ * 
+ * Posts multishot recvmsg picking buffers from registered buffer ring.
+ */
+static int uring_arm_recv() {
+    struct io_uring_sqe *sqe = uring_get_sqe(&recv_ring);
+    
+    if(!sqe) {
+        return 0;
+    }
+    
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = recv_sockfd;
+    sqe->addr = (unsigned long) &recv_msg;
+    sqe->len = 1;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_RECV_BGID;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->user_data = URING_RECV_TAG;
+    
+    return (uring_submit(&recv_ring, 0) >= 0);
+}
+
+/**
+ * int uring_recv_start(int sockfd)
+ * 
+ * Creates receiving ring of calling thread, registers buffer ring with
+ * receive buffers and posts multishot receive on given server socket.
+ * Returns ring descriptor which becomes readable when datagrams arrive,
+ * or -1 on failure.
+ */
+int uring_recv_start(int sockfd) {
+    struct io_uring_buf_reg reg;
+    int i;
+    
+    recv_sockfd = sockfd;
+    
+    /* Every buffer can be filled before completions are reaped, completion
+     * ending multishot receive (-ENOBUFS) has to fit too, otherwise it
+     * overflows and receive is never rearmed
+     */
+    if(!uring_init(&recv_ring, 8, 2 * URING_RECV_BUFFERS)) {
+        return -1;
+    }
+    
+    recv_bufs = mmap(NULL, URING_RECV_BUFFERS * sizeof(struct io_uring_buf),
+            PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    recv_buf_mem = (char *) malloc(URING_RECV_BUFFERS * URING_RECV_BUFFER_SIZE);
+    
+    if(recv_bufs == MAP_FAILED || !recv_buf_mem) {
+        if(recv_bufs == MAP_FAILED) {
+            recv_bufs = NULL;
+        }
+        
+        uring_recv_stop();
+        
+        return -1;
+    }
+    
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long) recv_bufs;
+    reg.ring_entries = URING_RECV_BUFFERS;
+    reg.bgid = URING_RECV_BGID;
+    
+    if(syscall(__NR_io_uring_register, recv_ring.fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        uring_recv_stop();
+        
+        return -1;
+    }
+    
+    /* Hand all buffers to kernel */
+    recv_bufs_tail = 0;
+    
+    for(i = 0; i < URING_RECV_BUFFERS; i++) {
+        uring_recycle_buffer(i);
+    }
+    
+    uring_publish_buffers();
+    
+    /* Kernel fills in source address and payload only */
+    memset(&recv_msg, 0, sizeof(recv_msg));
+    recv_msg.msg_namelen = sizeof(struct sockaddr_in);
+    
+    if(!uring_arm_recv()) {
+        uring_recv_stop();
+        
+        return -1;
+    }
+    
+    return recv_ring.fd;
+}
+
+/**
+ * int uring_recv_process()
+ * 
+ * Reaps completed receives without entering kernel, passes datagrams to
+ * process_dgram and recycles their buffers. If multishot receive ended,
+ * posts it again. Returns number of processed datagrams or -1 if kernel
+ * doesn't support multishot receive.
+ */
+int uring_recv_process() {
+    struct io_uring_cqe *cqe;
+    struct io_uring_recvmsg_out *out;
+    unsigned int head, tail;
+    unsigned short bid;
+    char *buf, *payload;
+    unsigned int len, avail;
+    int n = 0;
+    int rearm = 0;
+    
+    head = *recv_ring.cq_head;
+    tail = __atomic_load_n(recv_ring.cq_tail, __ATOMIC_ACQUIRE);
+    
+    while(head != tail) {
+        cqe = &recv_ring.cqes[head & *recv_ring.cq_mask];
+        head++;
+        
+        if(cqe->user_data != URING_RECV_TAG) {
+            continue;
+        }
+        
+        /* Multishot receive isn't armed anymore */
+        if(!(cqe->flags & IORING_CQE_F_MORE)) {
+            rearm = 1;
+        }
+        
+        if(cqe->res < 0) {
+            /* Not supported by kernel */
+            if(cqe->res == -EINVAL) {
+                __atomic_store_n(recv_ring.cq_head, head, __ATOMIC_RELEASE);
+                
+                return -1;
+            }
+            
+            /* Ran out of buffers (-ENOBUFS) or other error, just rearm */
+            continue;
+        }
+        
+        if(!(cqe->flags & IORING_CQE_F_BUFFER)) {
+            continue;
+        }
+        
+        bid = (unsigned short) (cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        buf = recv_buf_mem + bid * URING_RECV_BUFFER_SIZE;
+        out = (struct io_uring_recvmsg_out *) buf;
+        payload = buf + sizeof(*out) + recv_msg.msg_namelen + recv_msg.msg_controllen;
+        
+        /* Payload might have been truncated */
+        avail = cqe->res - (payload - buf);
+        len = out->payloadlen < avail ? out->payloadlen : avail;
+        payload[len] = 0;
+        
+        if(out->namelen >= sizeof(struct sockaddr_in)) {
+            process_dgram(payload, len, (struct sockaddr_in *) (buf + sizeof(*out)));
+        }
+        
+        /* Stats */
+        STAT_ADD(recv_bytes, len);
+        STAT_ADD(recv_dgrams, 1);
+        n++;
+        
+        uring_recycle_buffer(bid);
+    }
+    
+    __atomic_store_n(recv_ring.cq_head, head, __ATOMIC_RELEASE);
+    uring_publish_buffers();
+    
+    if(n > 0) {
+        /* Stats */
+        STAT_ADD(recv_batches, 1);
+    }
+    
+    if(rearm) {
+        uring_arm_recv();
+    }
+    
+    return n;
+}
+
+/**
+ * void uring_recv_stop()
+ * 
+ * Closes receiving ring and frees receive buffers.
+ */
+void uring_recv_stop() {
+    uring_exit(&recv_ring);
+    
+    if(recv_bufs) {
+        munmap(recv_bufs, URING_RECV_BUFFERS * sizeof(struct io_uring_buf));
+        recv_bufs = NULL;
+    }
+    
+    free(recv_buf_mem);
+    recv_buf_mem = NULL;
+}
+
+/**
+ * int uring_send(struct mmsghdr *msgs, unsigned int count)
+ * 
+ * Sends datagrams by submitting one sendmsg SQE per datagram on calling
+ * thread's sending ring and waits for their completion, so that buffers
+ * can be reused. Returns number of sent datagrams or -1 if ring couldn't
+ * be used at all.
+ */
+int uring_send(struct mmsghdr *msgs, unsigned int count) {
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+    unsigned int head, tail;
+    unsigned int i, done = 0;
+    int sent = 0;
+    
+    if(!send_ring && !send_ring_failed) {
+        send_ring = (uring_t *) malloc(sizeof(uring_t));
+        
+        if(!uring_init(send_ring, MAX_SEND_BATCH_SIZE, 0)) {
+            free(send_ring);
+            send_ring = NULL;
+            send_ring_failed = 1;
+        }
+    }
+    
+    if(!send_ring || count > send_ring->sq_entries) {
+        return -1;
+    }
+    
+    for(i = 0; i < count; i++) {
+        sqe = uring_get_sqe(send_ring);
+        
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = server_sockfd;
+        sqe->addr = (unsigned long) &msgs[i].msg_hdr;
+        sqe->len = 1;
+        sqe->user_data = i;
+    }
+    
+    /* Ring is broken, never use it again */
+    if(uring_submit(send_ring, count) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+        uring_exit(send_ring);
+        free(send_ring);
+        send_ring = NULL;
+        send_ring_failed = 1;
+        
+        return -1;
+    }
+    
+    while(done < count) {
+        head = *send_ring->cq_head;
+        tail = __atomic_load_n(send_ring->cq_tail, __ATOMIC_ACQUIRE);
+        
+        while(head != tail) {
+            cqe = &send_ring->cqes[head & *send_ring->cq_mask];
+            head++;
+            done++;
+            
+            if(cqe->res >= 0) {
+                sent++;
+            }
+        }
+        
+        __atomic_store_n(send_ring->cq_head, head, __ATOMIC_RELEASE);
+        
+        /* Submit whatever wasn't consumed yet and wait for the rest */
+        if(done < count) {
+            uring_enter(send_ring,
+                    send_ring->sqe_tail - __atomic_load_n(send_ring->sq_head, __ATOMIC_ACQUIRE),
+                    count - done);
+        }
+    }
+    
+    return sent;
+}
@@ -0,0 +1,51 @@
+/** 
+ * -----------------------------------------------------------------------------
+ * Clovece nezlob se (Server) - simple board game
+ * 
+ * Server for board game Clovece nezlob se using UDP datagrams for communication
+ * with clients and SEND-AND-WAIT method to ensure that all packets arrive
+ * and that they arrive in correct order. 
+ * 
+ * Semestral work for "Uvod do pocitacovich siti" KIV/UPS at
+ * University of West Bohemia.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * File: uring.c
+ * Description: io_uring I/O backend for receiving and sending datagrams.
+ * 
+ * -----------------------------------------------------------------------------
+ * 
+ * @author: Martin Kucera, 2014
+ * @version: 1.02
+ * 
+ */
+
+#ifndef URING_H
+#define	URING_H
+
+/* I/O backends */
+#define IO_BACKEND_SYSCALL 0
+#define IO_BACKEND_URING 1
+
+/* Number of receive buffers in registered buffer ring (power of 2) */
+#define URING_RECV_BUFFERS 256
+/* Buffer group ID of receive buffers */
+#define URING_RECV_BGID 0
+
+/* Selected I/O backend */
+extern int io_backend;
+/* Number of io_uring_enter calls */
+extern unsigned int uring_enters;
+
+struct mmsghdr;
+
+/* Function prototypes */
+int uring_available();
+int uring_recv_start(int sockfd);
+int uring_recv_process();
+void uring_recv_stop();
+int uring_send(struct mmsghdr *msgs, unsigned int count);
+
+#endif	/* URING_H */
+